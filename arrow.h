@@ -0,0 +1,135 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+
+/*
+ * arrow.h
+ *
+ * This file implements the Arrow C data interface for the batch evaluation.
+ * The evaluation reads float64 columns in place, and converts the other input
+ * types one block at a time. Each exported result column is a single block of
+ * memory, which the release callback frees.
+ */
+
+// an exported result column, followed by the validity bitmap
+struct arrow_out {
+	const void *buffers[2];
+	double values[];
+};
+
+/*
+ * the format of a supported input column, i.e., 'g', 'f', or 'l', or 0
+ */
+static inline char arrow_format(const struct ArrowSchema *const s, const struct ArrowArray *const a)
+{
+	if (!s || !a || !s->release || !a->release || !s->format || (0 != s->n_children) || s->dictionary)
+		return 0;
+	if (!strchr("gfl", s->format[0]) || ('\0' == s->format[0]) || ('\0' != s->format[1]))
+		return 0;
+	if ((2 != a->n_buffers) || !a->buffers || (a->length < 0) || (a->offset < 0) || (!a->buffers[1] && a->length))
+		return 0;
+	return s->format[0];
+}
+
+static inline bool arrow_valid(const struct ArrowArray *const a, size_t i)
+{
+	// without a bitmap, all rows are valid
+	const uint8_t *const bits = a->buffers[0];
+	const size_t k = (size_t) a->offset + i;
+	return !bits || (bits[k / 8] >> (k % 8) & 1);
+}
+
+/*
+ * get the values of a block of rows, as double
+ */
+static inline const double *arrow_block(char format, const struct ArrowArray *const a, size_t first, size_t rows, double *const buf)
+{
+	const size_t off = (size_t) a->offset + first;
+	if ('g' == format)
+		return (const double *) a->buffers[1] + off;
+	if ('f' == format) {
+		const float *const f = (const float *) a->buffers[1] + off;
+		for (size_t j = 0; j < rows; j++)
+			buf[j] = f[j];
+	} else {
+		const int64_t *const l = (const int64_t *) a->buffers[1] + off;
+		for (size_t j = 0; j < rows; j++)
+			buf[j] = l[j];
+	}
+	return buf;
+}
+
+static void arrow_release_schema(struct ArrowSchema *s)
+{
+	s->release = NULL;
+}
+
+static void arrow_release_array(struct ArrowArray *a)
+{
+	free(a->private_data);
+	a->release = NULL;
+}
+
+/*
+ * allocate a float64 result column of n rows
+ */
+static inline struct arrow_out *arrow_out_new(size_t n)
+{
+	if (n > (SIZE_MAX - sizeof(struct arrow_out)) / (sizeof(double) + 1))
+		return NULL;
+	struct arrow_out *out = malloc(sizeof(struct arrow_out) + n * sizeof(double) + (n + 7) / 8);
+	if (!out)
+		return NULL;
+	out->buffers[0] = NULL;
+	out->buffers[1] = out->values;
+	return out;
+}
+
+static inline uint8_t *arrow_out_bits(struct arrow_out *const out, size_t n)
+{
+	return (uint8_t *) &out->values[n];
+}
+
+static inline void arrow_export(struct arrow_out *const out, size_t n, size_t nulls, struct ArrowSchema *const s, struct ArrowArray *const a)
+{
+	if (nulls)
+		out->buffers[0] = arrow_out_bits(out, n);
+	*s = (struct ArrowSchema) {
+		.format = "g",
+		.name = "",
+		.flags = ARROW_FLAG_NULLABLE,
+		.release = arrow_release_schema,
+	};
+	*a = (struct ArrowArray) {
+		.length = n,
+		.null_count = nulls,
+		.n_buffers = 2,
+		.buffers = out->buffers,
+		.release = arrow_release_array,
+		.private_data = out,
+	};
+}
@@ -42,7 +42,8 @@
  * ===== ===========
  * 0     always use stack allocation
  * 1     always use heap allocation
- * >1    use heap allocation when input length (including 0-byte) exceeds this limit
+ * >1    use heap allocation when input length (including 0-byte) exceeds this limit,
+ *       where the token limit bounds the input length
  */
 #define CONFIG_STACK_LIMIT 256
 
@@ -55,3 +56,56 @@
  * 1     enabled, the variable $malloc overrides CONFIG_STACK_LIMIT
  */
 #define CONFIG_DYNAMIC_STACK_LIMIT 1
+
+/*
+ * default evaluation limits
+ *
+ * CONFIG_LIMIT_LEN      maximum input length, excluding the 0-byte
+ * CONFIG_LIMIT_DEPTH    maximum nesting depth of braces
+ * CONFIG_LIMIT_TOKENS   maximum number of tokens, excluding space
+ * CONFIG_LIMIT_ARGS     maximum number of arguments of a function call
+ * CONFIG_LIMIT_OPS      maximum number of reduce operations
+ * CONFIG_LIMIT_TIMEOUT  maximum evaluation time, in seconds
+ *
+ * value description
+ * ===== ===========
+ * 0     unlimited
+ * >0    evaluation fails with XPR_ERR_LIMIT when exceeding the limit
+ */
+#define CONFIG_LIMIT_LEN 0
+#define CONFIG_LIMIT_DEPTH 0
+#define CONFIG_LIMIT_TOKENS 0
+#define CONFIG_LIMIT_ARGS 0
+#define CONFIG_LIMIT_OPS 0
+#define CONFIG_LIMIT_TIMEOUT 0
+
+/*
+ * check for limit reconfiguration via variables
+ *
+ * value description
+ * ===== ===========
+ * 0     disabled
+ * 1     enabled, the variables $maxlen, $maxdepth, $maxtokens, $maxargs,
+ *       $maxops, and $timeout override the CONFIG_LIMIT_* values
+ */
+#define CONFIG_DYNAMIC_LIMITS 1
+
+/*
+ * rewrite power series, like 1 + 2*x + 3*x^2, into poly() in compiled programs
+ *
+ * value description
+ * ===== ===========
+ * 0     disabled, programs compute the same results as xpr()
+ * 1     enabled, the results of programs may differ in rounding
+ */
+#define CONFIG_POLY 0
+
+/*
+ * check for power series reconfiguration via variable
+ *
+ * value description
+ * ===== ===========
+ * 0     disabled
+ * 1     enabled, the variable $poly overrides CONFIG_POLY
+ */
+#define CONFIG_DYNAMIC_POLY 1
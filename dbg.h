@@ -38,10 +38,14 @@ static inline void dbg_dump_tok(const char *name, const tok *t, const char *end)
 		switch (t->tag) {
 		case BS_SET(BS_NONE,  TK_NUM):  dbg("0[%lf]", t->data.value); goto out;
 		case BS_SET(BS_OPEN,  TK_NUM):  dbg("1[%lf]", t->data.value); goto out;
-		case BS_SET(BS_PLUS,  TK_NUM):  dbg("2[%lf]", t->data.value); goto out;
-		case BS_SET(BS_MUL,   TK_NUM):  dbg("3[%lf]", t->data.value); goto out;
-		case BS_SET(BS_EXP,   TK_NUM):  dbg("4[%lf]", t->data.value); goto out;
-		case BS_SET(BS_UNARY, TK_NUM):  dbg("5[%lf]", t->data.value); goto out;
+		case BS_SET(BS_OR,    TK_NUM):  dbg("2[%lf]", t->data.value); goto out;
+		case BS_SET(BS_AND,   TK_NUM):  dbg("3[%lf]", t->data.value); goto out;
+		case BS_SET(BS_NOT,   TK_NUM):  dbg("4[%lf]", t->data.value); goto out;
+		case BS_SET(BS_CMP,   TK_NUM):  dbg("5[%lf]", t->data.value); goto out;
+		case BS_SET(BS_PLUS,  TK_NUM):  dbg("6[%lf]", t->data.value); goto out;
+		case BS_SET(BS_MUL,   TK_NUM):  dbg("7[%lf]", t->data.value); goto out;
+		case BS_SET(BS_EXP,   TK_NUM):  dbg("8[%lf]", t->data.value); goto out;
+		case BS_SET(BS_UNARY, TK_NUM):  dbg("9[%lf]", t->data.value); goto out;
 		default:                        dbg("?[%lf]", t->data.value); goto out;
 		}
 	} else if (CLASS_FUNC == CLASS_GET(t->tag)) {
@@ -65,6 +69,14 @@ static inline void dbg_dump_tok(const char *name, const tok *t, const char *end)
 		case TK_FUN_MIN:                dbg("[min]");                   goto out;
 		case TK_FUN_MAX:                dbg("[max]");                   goto out;
 		case TK_FUN_SUM:                dbg("[sum]");                   goto out;
+		case TK_FUN_SELECT:             dbg("[select]");                goto out;
+		case TK_FUN_WSUM:               dbg("[wsum]");                  goto out;
+		case TK_FUN_WMIN:               dbg("[wmin]");                  goto out;
+		case TK_FUN_WMAX:               dbg("[wmax]");                  goto out;
+		case TK_FUN_WAVG:               dbg("[wavg]");                  goto out;
+		case TK_FUN_LAG:                dbg("[lag]");                   goto out;
+		case TK_FUN_POLY:               dbg("[poly]");                  goto out;
+		case TK_FUN_USER:               dbg("[%s]", t->data.fun->name); goto out;
 		default:                        dbg("[?()]");                   goto out;
 		}
 	} else {
@@ -82,6 +94,15 @@ static inline void dbg_dump_tok(const char *name, const tok *t, const char *end)
 		case BS_IGN(TK_OPEN):           dbg("(");                     goto out;
 		case BS_IGN(TK_CLOSE):          dbg(")");                     goto out;
 		case BS_IGN(TK_COMMA):          dbg(",");                     goto out;
+		case BS_IGN(TK_OR):             dbg("or");                    goto out;
+		case BS_IGN(TK_AND):            dbg("and");                   goto out;
+		case BS_IGN(TK_NOT):            dbg("not");                   goto out;
+		case BS_IGN(TK_LT):             dbg("<");                     goto out;
+		case BS_IGN(TK_LE):             dbg("<=");                    goto out;
+		case BS_IGN(TK_GT):             dbg(">");                     goto out;
+		case BS_IGN(TK_GE):             dbg(">=");                    goto out;
+		case BS_IGN(TK_EQ):             dbg("==");                    goto out;
+		case BS_IGN(TK_NE):             dbg("!=");                    goto out;
 		default:                        dbg("%x?", t->tag);           goto out;
 		}
 	}
@@ -101,3 +122,9 @@ static inline void dbg_dump_tok(const char *name, const tok *t, const char *end)
 }
 #endif
 
+static inline double fun_dummy(size_t nargs, const tok *ap)
+{
+	printf("FUNCTION DUMMY: %zu {", nargs); for (size_t i = 0; i < nargs; i++) dbg_dump_tok(NULL, &ap[2*i], " "); printf("}\n");
+	return 0;
+}
+
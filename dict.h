@@ -0,0 +1,97 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+
+/*
+ * dict.h
+ *
+ * This file implements the batch evaluation of dictionary-encoded and constant
+ * columns. Each node is either constant for the batch, depends on a single
+ * dictionary column, or varies by row. The evaluation computes constant nodes
+ * once, and the nodes of a dictionary column once per dictionary entry. The
+ * rows gather their values by index, so only the remaining nodes are computed
+ * per row. For instance, exp(rate) of a dictionary column rate is a lookup.
+ */
+
+#define KIND_ROW         NONE
+#define KIND_CONST       (NONE - 1)
+// otherwise, the kind is the slot of the dictionary column
+
+static inline uint32_t dict_join(uint32_t a, uint32_t b)
+{
+	if (KIND_CONST == a)
+		return b;
+	if (KIND_CONST == b)
+		return a;
+	return (a == b) ? a : KIND_ROW;
+}
+
+/*
+ * find the kind of each node, and whether the rows need the values of a node,
+ * i.e., if it is a result or an operand of a row node
+ */
+static inline void dict_classify(const struct xpr_prog *const prog, const struct xpr_column *const cols, size_t n, uint32_t *const kind, bool *const need)
+{
+	const struct node *const nodes = prog_nodes(prog);
+	const uint32_t *const args = prog_args(prog);
+	for (size_t i = 0; i < prog->nnodes; i++) {
+		const struct node *const q = &nodes[i];
+		need[i] = false;
+		if (OP_CONST == q->op) {
+			kind[i] = KIND_CONST;
+		} else if (OP_VAR == q->op) {
+			const int k = cols[q->data.slot].kind;
+			kind[i] = (XPR_COL_CONST == k) ? KIND_CONST : (XPR_COL_DICT == k) ? q->data.slot : KIND_ROW;
+		} else {
+			uint32_t k = KIND_CONST;
+			for (size_t a = 0; a < q->nargs; a++)
+				k = dict_join(k, kind[node_arg(q, args, a)]);
+			// impure functions are called once per row
+			if ((OP_FUN == q->op) && (q->data.arg[1] >= FUN_USER) && !(prog->ext.funs[q->data.arg[1] - FUN_USER].flags & XPR_FUN_PURE))
+				k = KIND_ROW;
+			// computing each entry of a large dictionary does not pay off
+			if ((k < KIND_CONST) && (cols[k].nvalues > n))
+				k = KIND_ROW;
+			kind[i] = k;
+		}
+		if (KIND_ROW == kind[i])
+			for (size_t a = 0; a < q->nargs; a++)
+				need[node_arg(q, args, a)] = true;
+	}
+	for (size_t r = 0; r < prog->nroots; r++)
+		need[prog_roots(prog)[r]] = true;
+}
+
+/*
+ * gather the values of a dictionary node for a block of rows
+ */
+static inline void dict_gather(double *const v, const double *const table, const struct xpr_column *const col, size_t first, size_t rows)
+{
+	const uint32_t *const index = &col->index[first];
+	for (size_t j = 0; j < rows; j++)
+		v[j] = (index[j] < col->nvalues) ? table[index[j]] : XPR_ERR;
+}
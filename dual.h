@@ -0,0 +1,224 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+
+/*
+ * dual.h
+ *
+ * This file implements forward-mode automatic differentiation of compiled
+ * programs. Next to the value of each node, the evaluation propagates its
+ * tangents, i.e., its partial derivatives with respect to a list of variable
+ * slots. Each node combines the tangents of its operands with its own partial
+ * derivatives by the chain rule, so a single pass computes the values and the
+ * whole gradient.
+ *
+ * The evaluation processes blocks of rows like prog_run_block(), and keeps the
+ * tangents of each node and variable in blocks of rows as well. Comparisons,
+ * logical operators, floor, ceil, and round are piecewise constant, so their
+ * derivative is zero. For user-defined functions, the derivatives are central
+ * differences. The tangents of errors are errors.
+ */
+
+// the tangents of node i with respect to the k-th variable
+#define DOT(i, k)        (&dot[((size_t) (i) * nwrt + (k)) * BLOCK])
+
+// a zero tangent contributes nothing, even if the partial derivative is not finite
+#define CHAIN(p, d)      ((0 != (d)) ? (p) * (d) : 0)
+
+/*
+ * the partial derivative of a built-in function with respect to argument i,
+ *   where x are the arguments and y is the result
+ */
+static inline double dual_fun(uint32_t funid, size_t nargs, const double *const x, double y, size_t i)
+{
+	switch (funid) {
+	case FUNID(TK_FUN_NONE):  return 1;
+	case FUNID(TK_FUN_ACOS):  return -1 / sqrt(1 - x[0] * x[0]);
+	case FUNID(TK_FUN_ACOSH): return 1 / sqrt(x[0] * x[0] - 1);
+	case FUNID(TK_FUN_ASIN):  return 1 / sqrt(1 - x[0] * x[0]);
+	case FUNID(TK_FUN_ASINH): return 1 / sqrt(x[0] * x[0] + 1);
+	case FUNID(TK_FUN_ATAN):  return 1 / (1 + x[0] * x[0]);
+	case FUNID(TK_FUN_ATANH): return 1 / (1 - x[0] * x[0]);
+	case FUNID(TK_FUN_CBRT):  return 1 / (3 * y * y);
+	case FUNID(TK_FUN_COS):   return -sin(x[0]);
+	case FUNID(TK_FUN_COSH):  return sinh(x[0]);
+	case FUNID(TK_FUN_EXP):   return y;
+	case FUNID(TK_FUN_SIN):   return cos(x[0]);
+	case FUNID(TK_FUN_SINH):  return cosh(x[0]);
+	case FUNID(TK_FUN_SQRT):  return 1 / (2 * y);
+	case FUNID(TK_FUN_SUM):   return 1;
+	case FUNID(TK_FUN_TAN):   return 1 + y * y;
+	case FUNID(TK_FUN_TANH):  return 1 - y * y;
+	case FUNID(TK_FUN_LOG):
+		if (1 == nargs)
+			return 1 / x[0];
+		return i ? 1 / (x[1] * log(x[0])) : -y / (x[0] * log(x[0]));
+	case FUNID(TK_FUN_MAX):
+	case FUNID(TK_FUN_MIN):
+		// follow the first argument that equals the result
+		for (size_t k = 0; k < i; k++)
+			if (x[k] == y)
+				return 0;
+		return x[i] == y;
+	case FUNID(TK_FUN_SCALE):
+		if (3 == nargs) {
+			const double p[] = { -y / x[0], x[2] / x[0], x[1] / x[0] };
+			return p[i];
+		} else {
+			const double d = (x[3] - x[2]) / (x[1] - x[0]);
+			const double t = (x[4] - x[0]) / (x[1] - x[0]);
+			const double p[] = { (t - 1) * d, -t * d, 1 - t, t, d };
+			return p[i];
+		}
+	case FUNID(TK_FUN_SELECT):
+		return i ? ((1 == i) == (0 != x[0])) : 0;
+	case FUNID(TK_FUN_POLY):
+		if (0 == i) {
+			// the derivative of the polynomial, by Horner's scheme
+			double d = 0;
+			for (size_t k = nargs - 1; k > 1; k--)
+				d = d * x[0] + (k - 1) * x[k];
+			return d;
+		}
+		return (1 == i) ? 1 : pow(x[0], i - 1);
+	case FUNID(TK_FUN_WSUM):
+	case FUNID(TK_FUN_WMIN):
+	case FUNID(TK_FUN_WMAX):
+	case FUNID(TK_FUN_WAVG):
+	case FUNID(TK_FUN_LAG):
+		// a window of one row, the window size is a constant
+		return 0 == i;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * the partial derivative of a user-defined function with respect to argument i
+ */
+static inline double dual_user(const struct xpr_fun *const f, size_t nargs, double *const x, size_t i)
+{
+	const double xi = x[i];
+	const double h = cbrt(DBL_EPSILON) * ((fabs(xi) > 1) ? fabs(xi) : 1);
+	x[i] = xi + h;
+	const double hi = f->fun(f->arg, nargs, x);
+	x[i] = xi - h;
+	const double lo = f->fun(f->arg, nargs, x);
+	x[i] = xi;
+	return (hi - lo) / (2 * h);
+}
+
+/*
+ * compute the tangents of a function node i for a block of rows
+ */
+static inline void block_fun_dual(const struct node *const n, size_t i, const uint32_t *const args, const double *const blk, double *const dot, size_t nwrt, size_t rows, const struct xpr_fun *const funs, void *const argv)
+{
+	const size_t nargs = n->nargs;
+	const uint32_t *const a = &args[n->data.arg[0]];
+	const uint32_t funid = n->data.arg[1];
+	const double *const y = &blk[i * BLOCK];
+	for (size_t k = 0; k < nwrt; k++)
+		memset(DOT(i, k), 0, rows * sizeof(double));
+
+	// the arguments of a row, in the scratch space of the workspace
+	double *const x = argv;
+	for (size_t j = 0; j < rows; j++) {
+		for (size_t m = 0; m < nargs; m++)
+			x[m] = blk[a[m] * BLOCK + j];
+		for (size_t m = 0; m < nargs; m++) {
+			// arguments without tangents need no derivative
+			bool any = false;
+			for (size_t k = 0; k < nwrt; k++)
+				any |= (0 != DOT(a[m], k)[j]);
+			if (!any)
+				continue;
+			const double p = (funid < FUN_USER) ? dual_fun(funid, nargs, x, y[j], m) : dual_user(&funs[funid - FUN_USER], nargs, x, m);
+			for (size_t k = 0; k < nwrt; k++)
+				DOT(i, k)[j] += CHAIN(p, DOT(a[m], k)[j]);
+		}
+	}
+}
+
+/*
+ * evaluate a block of rows with tangents, starting at the given row
+ *
+ * The values go to blk, like for prog_run_block(), and the tangents of node i
+ *   with respect to the variable slot wrt[k] go to dot.
+ */
+static inline void prog_run_block_dual(const struct xpr_prog *const prog, double *const blk, double *const dot, const size_t *const wrt, size_t nwrt, const double *const *const cols, size_t first, size_t rows, void *const argv)
+{
+	prog_run_block(prog, blk, cols, first, rows, argv);
+	const struct node *const nodes = prog_nodes(prog);
+	const uint32_t *const args = prog_args(prog);
+	for (size_t i = 0; i < prog->nnodes; i++) {
+		const struct node *const n = &nodes[i];
+		const double *const y = &blk[i * BLOCK];
+		if ((OP_CONST == n->op) || (OP_VAR == n->op)) {
+			for (size_t k = 0; k < nwrt; k++)
+				for (size_t j = 0; j < rows; j++)
+					DOT(i, k)[j] = (OP_VAR == n->op) && (wrt[k] == n->data.slot);
+		} else if (OP_FUN == n->op) {
+			block_fun_dual(n, i, args, blk, dot, nwrt, rows, prog->ext.funs, argv);
+		} else {
+			// the partial derivatives with respect to both operands
+			double pl[BLOCK], pr[BLOCK];
+#			define PART(dl, dr) for (size_t j = 0; j < rows; j++) { pl[j] = (dl); pr[j] = (dr); }
+#			define l (blk[n->data.arg[0] * (size_t) BLOCK + j])
+#			define r (blk[n->data.arg[1] * (size_t) BLOCK + j])
+			switch (n->op) {
+			case OP_NEG: PART(-1, 0);                                                 break;
+			case OP_ADD: PART(1, 1);                                                  break;
+			case OP_SUB: PART(1, -1);                                                 break;
+			case OP_MUL: PART(r, l);                                                  break;
+			case OP_DIV: PART(1 / r, -y[j] / r);                                      break;
+			case OP_POW: PART(r * pow(l, r - 1), (0 == y[j]) ? 0 : y[j] * log(l));    break;
+			default:     PART(0, 0);                                                  break;
+			}
+#			undef PART
+#			undef l
+#			undef r
+			for (size_t k = 0; k < nwrt; k++) {
+				double *const d = DOT(i, k);
+				const double *const dl = DOT(n->data.arg[0], k);
+				if (1 == OP_NARGS(n->op)) {
+					for (size_t j = 0; j < rows; j++)
+						d[j] = CHAIN(pl[j], dl[j]);
+				} else {
+					const double *const dr = DOT(n->data.arg[1], k);
+					for (size_t j = 0; j < rows; j++)
+						d[j] = CHAIN(pl[j], dl[j]) + CHAIN(pr[j], dr[j]);
+				}
+			}
+		}
+		for (size_t k = 0; k < nwrt; k++)
+			for (size_t j = 0; j < rows; j++)
+				DOT(i, k)[j] = isnan(y[j]) ? XPR_ERR : DOT(i, k)[j];
+	}
+}
+
+#undef DOT
+#undef CHAIN
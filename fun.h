@@ -25,32 +25,53 @@
  *
  *****/
 
-#define ARG(ap, n) (ap[2*(n)].data.value)
+/*
+ * fun.h
+ *
+ * This file implements the XPR functions. It is included once for each
+ * representation of the argument list, and the including file defines:
+ *
+ *  FUN(name)   the name of the function that implements name
+ *  ARGS        the element type of the argument list
+ *  ARG(ap, n)  the value of the n-th argument in the argument list ap
+ *
+ * Optionally, the including file defines the precision of the functions:
+ *
+ *  REAL        the result type, double by default
+ *  MATH(name)  the math library function for REAL, e.g., name##f for float
+ */
 
-static inline double fun_identity(size_t nargs, const tok *ap)
+#ifndef WINDOW_OK
+// window sizes are integers, lag() also accepts 0, and large windows do not fit into memory
+#define WINDOW_MAX       (1 << 24)
+#define WINDOW_OK(n, min) (((n) >= (min)) && ((n) <= WINDOW_MAX) && ((n) == (size_t) (n)))
+#endif
+
+#ifndef REAL
+#define REAL double
+#endif
+#ifndef MATH
+#define MATH(name) name
+#endif
+
+static inline REAL FUN(identity)(size_t nargs, const ARGS *ap)
 {
 	if (nargs != 1)
 		return XPR_ERR;
 	return ARG(ap, 0);
 }
 
-static inline double fun_dummy(size_t nargs, const tok *ap)
-{
-	printf("FUNCTION DUMMY: %zu {", nargs); for (size_t i = 0; i < nargs; i++) dbg_dump_tok(NULL, &ap[2*i], " "); printf("}\n");
-	return 0;
-}
-
 
 #define FOLD(name, empty, expr) \
-	static inline double fun_##name(size_t nargs, const tok *ap) \
+	static inline REAL FUN(name)(size_t nargs, const ARGS *ap) \
 	{ \
 		if (0 == nargs) \
 			return (empty); \
-		double l = ARG(ap, 0); \
+		REAL l = ARG(ap, 0); \
 		if (isnan(l)) \
 			return l; \
 		for (size_t i = 1; i < nargs; i++) { \
-			double r = ARG(ap, i); \
+			REAL r = ARG(ap, i); \
 			l = (expr); \
 			if (isnan(l)) \
 				return l; \
@@ -58,18 +79,62 @@ static inline double fun_dummy(size_t nargs, const tok *ap)
 		return l; \
 	}
 
+// a single row is a window of its own, streams keep the windows, see win.h
+#define WINDOW(name) \
+	static inline REAL FUN(name)(size_t nargs, const ARGS *ap) \
+	{ \
+		if ((2 != nargs) || !WINDOW_OK(ARG(ap, 1), 1)) \
+			return XPR_ERR; \
+		return ARG(ap, 0); \
+	}
+
 #define WRAP(name) \
-	static inline double fun_##name(size_t nargs, const tok *ap) \
+	static inline REAL FUN(name)(size_t nargs, const ARGS *ap) \
 	{ \
 		if (nargs != 1) \
 			return XPR_ERR; \
-		return name(ARG(ap, 0)); \
+		return MATH(name)(ARG(ap, 0)); \
 	}
 
 FOLD(min, XPR_ERR, (l < r) ? l : r)
 FOLD(max, XPR_ERR, (l > r) ? l : r)
 FOLD(sum, 0, l + r);
 
+WINDOW(wsum)
+WINDOW(wmin)
+WINDOW(wmax)
+WINDOW(wavg)
+
+// multiply and add, fused if the hardware supports it
+static inline REAL FUN(madd)(REAL a, REAL b, REAL c)
+{
+#if defined(FP_FAST_FMA) && defined(FP_FAST_FMAF)
+	return MATH(fma)(a, b, c);
+#else
+	return a * b + c;
+#endif
+}
+
+static inline REAL FUN(poly)(size_t nargs, const ARGS *ap)
+{
+	// poly(x,c0,...,cn) is c0 + c1*x + ... + cn*x^n, by Horner's scheme
+	if (nargs < 2)
+		return XPR_ERR;
+	const REAL x = ARG(ap, 0);
+	REAL r = ARG(ap, nargs - 1);
+	for (size_t i = nargs - 1; i-- > 1;)
+		r = FUN(madd)(r, x, ARG(ap, i));
+	return r;
+}
+
+static inline REAL FUN(lag)(size_t nargs, const ARGS *ap)
+{
+	// there is no previous row
+	if ((2 != nargs) || !WINDOW_OK(ARG(ap, 1), 0) || (0 != ARG(ap, 1)))
+		return XPR_ERR;
+	return ARG(ap, 0);
+}
+
 WRAP(acos)
 WRAP(asin)
 WRAP(atan)
@@ -89,38 +154,38 @@ WRAP(sqrt)
 WRAP(cbrt)
 WRAP(exp)
 
-static inline double fun_log(size_t nargs, const tok *ap)
+static inline REAL FUN(log)(size_t nargs, const ARGS *ap)
 {
 	if (nargs == 1) {
 		if (ARG(ap, 0) <= 0)
 			return XPR_ERR;
-		return log(ARG(ap, 0));
+		return MATH(log)(ARG(ap, 0));
 	} else if (nargs == 2) {
 		if (ARG(ap, 0) <= 0 || ARG(ap, 0) == 1 || ARG(ap, 1) <= 0)
 			return XPR_ERR;
-		return log(ARG(ap, 1)) / log(ARG(ap, 0));
+		return MATH(log)(ARG(ap, 1)) / MATH(log)(ARG(ap, 0));
 	} else {
 		return XPR_ERR;
 	}
 }
 
-static inline double fun_scale(size_t nargs, const tok *ap)
+static inline REAL FUN(scale)(size_t nargs, const ARGS *ap)
 {
 	if (3 == nargs) {
 		// scale(A,B,x) translates x from scale [0,A] to [0,B]
-		double da = ARG(ap, 0);
-		double db = ARG(ap, 1);
+		REAL da = ARG(ap, 0);
+		REAL db = ARG(ap, 1);
 		if (0 == da)
 			return XPR_ERR;
 		return ARG(ap, 2) / da * db;
 	} else if (5 == nargs) {
 		// scale(a,A,b,B,x) translates x from scale [a,A] to [b,B]
-		double al = ARG(ap, 0);
-		double ah = ARG(ap, 1);
-		double bl = ARG(ap, 2);
-		double bh = ARG(ap, 3);
-		double da = ah - al;
-		double db = bh - bl;
+		REAL al = ARG(ap, 0);
+		REAL ah = ARG(ap, 1);
+		REAL bl = ARG(ap, 2);
+		REAL bh = ARG(ap, 3);
+		REAL da = ah - al;
+		REAL db = bh - bl;
 		if (0 == da)
 			return XPR_ERR;
 		return (ARG(ap, 4) - al) / da * db + bl;
@@ -129,7 +194,20 @@ static inline double fun_scale(size_t nargs, const tok *ap)
 	}
 }
 
+static inline REAL FUN(select)(size_t nargs, const ARGS *ap)
+{
+	// all arguments are evaluated, so errors in either branch propagate
+	if ((3 != nargs) || isnan(ARG(ap, 0)) || isnan(ARG(ap, 1)) || isnan(ARG(ap, 2)))
+		return XPR_ERR;
+	return (0 != ARG(ap, 0)) ? ARG(ap, 1) : ARG(ap, 2);
+}
+
+#undef FUN
+#undef ARGS
 #undef ARG
+#undef REAL
+#undef MATH
 #undef FOLD
+#undef WINDOW
 #undef WRAP
 
@@ -0,0 +1,199 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+/*
+ * img.h
+ *
+ * This file implements images, which store compiled programs in a binary
+ * format. An image is position-independent, so it can be used directly from a
+ * memory mapping, without parsing or copying. The layout is:
+ *
+ *  header  magic, version, byte order, number of programs, size, checksum
+ *  offset  the offset of each program from the start of the image
+ *  progs   the programs, each aligned to 8 bytes, in the format of prog.h
+ *
+ * The checksum covers everything after the header. Loading an image verifies
+ * the checksum, and checks that all indices of all programs are in bounds, so
+ * corrupt images are errors instead of crashes.
+ */
+
+/*
+ * The version grows whenever programs gain opcodes or function IDs, so readers
+ * reject newer images as a whole. Older versions are subsets of newer ones:
+ *
+ *  1  arithmetic operators, and the functions up to tanh()
+ *  2  comparisons, logical operators, select(), window functions, and poly()
+ */
+#define IMG_MAGIC        "XPRI"
+#define IMG_VERSION      2
+#define IMG_ENDIAN       0x01020304
+#define IMG_ALIGN        8
+
+struct img_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t nprogs;
+	uint64_t size;
+	uint64_t checksum;
+};
+
+#define img_offset(h)    ((const uint64_t *) ((h) + 1))
+
+struct xpr_image {
+	const struct img_header *header;
+	void *map;           // the memory mapping, or NULL
+	size_t mapsz;
+};
+
+static inline size_t img_align(size_t n)
+{
+	return (n + IMG_ALIGN - 1) & ~(size_t) (IMG_ALIGN - 1);
+}
+
+/*
+ * checksum of 8-byte words, the size must be a multiple of 8
+ */
+static inline uint64_t img_checksum(const void *const data, size_t size)
+{
+	const unsigned char *p = data;
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ size;
+	for (size_t i = 0; i < size; i += 8) {
+		uint64_t w;
+		memcpy(&w, p + i, sizeof(w));
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 29;
+	}
+	return h;
+}
+
+static inline size_t prog_bytes(const struct xpr_prog *const prog)
+{
+	return prog_size(prog->nnodes, prog->nargs, prog->nroots, prog->nvars, prog->ndeps);
+}
+
+/*
+ * check that a program only refers to its own data
+ */
+static inline bool prog_valid(const struct xpr_prog *const prog, size_t avail)
+{
+	if ((avail < sizeof(struct xpr_prog)) || (avail < prog_bytes(prog)))
+		return false;
+	if ((0 == prog->nroots) || (0 != prog->reserved) || (NULL != prog->ext.funs))
+		return false;
+
+	const struct node *const nodes = prog_nodes(prog);
+	const uint32_t *const args = prog_args(prog);
+	for (uint32_t i = 0; i < prog->nnodes; i++) {
+		const struct node *const n = &nodes[i];
+		switch (n->op) {
+		case OP_CONST:
+			if (0 != n->nargs)
+				return false;
+			break;
+		case OP_VAR:
+			if ((0 != n->nargs) || (n->data.slot >= prog->nvars) || (prog_varnode(prog)[n->data.slot] != i))
+				return false;
+			break;
+		case OP_NEG:
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_DIV:
+		case OP_POW:
+		case OP_LT:
+		case OP_LE:
+		case OP_GT:
+		case OP_GE:
+		case OP_EQ:
+		case OP_NE:
+		case OP_AND:
+		case OP_OR:
+		case OP_NOT:
+			if ((OP_NARGS(n->op) != n->nargs) || (n->data.arg[0] >= i) || ((2 == n->nargs) && (n->data.arg[1] >= i)))
+				return false;
+			break;
+		case OP_FUN:
+			if ((n->data.arg[1] >= sizeof(pfuns) / sizeof(pfuns[0])) || !pfuns[n->data.arg[1]])
+				return false;
+			if ((n->data.arg[0] > prog->nargs) || (n->nargs > prog->nargs - n->data.arg[0]))
+				return false;
+			for (uint32_t k = 0; k < n->nargs; k++)
+				if (args[n->data.arg[0] + k] >= i)
+					return false;
+			size_t size;
+			if (IS_WINDOW(n->data.arg[1]) && !node_window(nodes, args, n, &size))
+				return false;
+			break;
+		default:
+			return false;
+		}
+	}
+	for (uint32_t r = 0; r < prog->nroots; r++)
+		if (prog_roots(prog)[r] >= prog->nnodes)
+			return false;
+	for (uint32_t slot = 0; slot < prog->nvars; slot++) {
+		const uint32_t v = prog_varnode(prog)[slot];
+		if ((NONE != v) && ((v >= prog->nnodes) || (OP_VAR != nodes[v].op) || (slot != nodes[v].data.slot)))
+			return false;
+	}
+	const uint32_t *const depoff = prog_depoff(prog);
+	if ((0 != depoff[0]) || (prog->ndeps != depoff[prog->nvars]))
+		return false;
+	for (uint32_t slot = 0; slot < prog->nvars; slot++)
+		if (depoff[slot] > depoff[slot + 1])
+			return false;
+	for (uint32_t k = 0; k < prog->ndeps; k++)
+		if (prog_deps(prog)[k] >= prog->nnodes)
+			return false;
+	return true;
+}
+
+/*
+ * check an image, returns 0, or ENOTSUP for other versions, or EINVAL
+ */
+static inline int img_valid(const struct img_header *const h, size_t size)
+{
+	if ((size < sizeof(*h)) || ((uintptr_t) h % IMG_ALIGN))
+		return EINVAL;
+	if (memcmp(h->magic, IMG_MAGIC, sizeof(h->magic)) || (IMG_ENDIAN != h->endian))
+		return EINVAL;
+	if ((h->version < 1) || (h->version > IMG_VERSION))
+		return ENOTSUP;
+	if ((h->size > size) || (h->size % IMG_ALIGN) || ((h->size - sizeof(*h)) / sizeof(uint64_t) < h->nprogs))
+		return EINVAL;
+	if (h->checksum != img_checksum(h + 1, h->size - sizeof(*h)))
+		return EINVAL;
+	for (uint32_t i = 0; i < h->nprogs; i++) {
+		const uint64_t off = img_offset(h)[i];
+		if ((off % IMG_ALIGN) || (off < sizeof(*h)) || (off >= h->size))
+			return EINVAL;
+		if (!prog_valid((const struct xpr_prog *) ((const char *) h + off), h->size - off))
+			return EINVAL;
+	}
+	return 0;
+}
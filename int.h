@@ -0,0 +1,286 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+/*
+ * int.h
+ *
+ * This file implements the exact evaluation of compiled programs with int64
+ * values. A program qualifies if all of its nodes are integer operations:
+ * integral constants, variables, the arithmetic, comparison, and logical
+ * operators, and the functions floor, ceil, round, min, max, sum, and select.
+ * All operations check for overflow, and a division must not have a
+ * remainder, except where floor, ceil, or round directly apply to the
+ * quotient. Otherwise, the value of the node is inexact, and the caller falls
+ * back to double precision.
+ *
+ * The evaluation processes blocks of rows like prog_run_block(), and keeps an
+ * inexact flag per node and row next to the values.
+ */
+
+static inline bool int_add(int64_t a, int64_t b, int64_t *const out)
+{
+	if ((b > 0) ? (a > INT64_MAX - b) : (a < INT64_MIN - b))
+		return false;
+	*out = a + b;
+	return true;
+}
+
+static inline bool int_sub(int64_t a, int64_t b, int64_t *const out)
+{
+	if ((b < 0) ? (a > INT64_MAX + b) : (a < INT64_MIN + b))
+		return false;
+	*out = a - b;
+	return true;
+}
+
+static inline bool int_mul(int64_t a, int64_t b, int64_t *const out)
+{
+	if ((a > 0) ? ((b > 0) ? (a > INT64_MAX / b) : (b < INT64_MIN / a))
+	            : ((b > 0) ? (a < INT64_MIN / b) : ((a != 0) && (b < INT64_MAX / a))))
+		return false;
+	*out = a * b;
+	return true;
+}
+
+static inline bool int_pow(int64_t a, int64_t b, int64_t *const out)
+{
+	if (b < 0)
+		return false;
+	int64_t result = 1;
+	while (b) {
+		if ((b & 1) && !int_mul(result, a, &result))
+			return false;
+		b >>= 1;
+		if (b && !int_mul(a, a, &a))
+			return false;
+	}
+	*out = result;
+	return true;
+}
+
+/*
+ * divide, and round the quotient like the given function
+ */
+static inline bool int_div(int64_t a, int64_t b, uint32_t funid, int64_t *const out)
+{
+	if ((0 == b) || ((INT64_MIN == a) && (-1 == b)))
+		return false;
+	int64_t q = a / b;
+	int64_t r = a % b;
+	if (0 == r) {
+		*out = q;
+		return true;
+	}
+	// the exact quotient is between q and q+d, and it is closer to q+d iff 2|r| >= |b|
+	const int64_t d = ((r < 0) == (b < 0)) ? 1 : -1;
+	const uint64_t ar = (r < 0) ? -(uint64_t) r : (uint64_t) r;
+	const uint64_t ab = (b < 0) ? -(uint64_t) b : (uint64_t) b;
+	switch (funid) {
+	case FUNID(TK_FUN_FLOOR): *out = q + ((d < 0) ? -1 : 0);          return true;
+	case FUNID(TK_FUN_CEIL):  *out = q + ((d > 0) ? 1 : 0);           return true;
+	case FUNID(TK_FUN_ROUND): *out = q + ((ar >= ab - ar) ? d : 0);   return true;
+	default:                  return false;
+	}
+}
+
+static inline bool int_const(double d, int64_t *const out)
+{
+	if (!(d >= -0x1p63 && d < 0x1p63) || (d != (double) (int64_t) d))
+		return false;
+	*out = (int64_t) d;
+	return true;
+}
+
+/*
+ * check whether a node is an integer operation
+ */
+static inline bool node_is_int(const struct node *const n)
+{
+	int64_t i;
+	switch (n->op) {
+	case OP_CONST: return int_const(n->data.value, &i);
+	case OP_FUN:
+		switch (n->data.arg[1]) {
+		case FUNID(TK_FUN_NONE):
+		case FUNID(TK_FUN_FLOOR):
+		case FUNID(TK_FUN_CEIL):
+		case FUNID(TK_FUN_ROUND):
+		case FUNID(TK_FUN_MIN):
+		case FUNID(TK_FUN_MAX):
+		case FUNID(TK_FUN_SUM):
+		case FUNID(TK_FUN_SELECT):
+			return true;
+		default:
+			return false;
+		}
+	default:
+		return true;
+	}
+}
+
+static inline bool prog_is_int(const struct xpr_prog *const prog)
+{
+	const struct node *const nodes = prog_nodes(prog);
+	for (size_t i = 0; i < prog->nnodes; i++)
+		if (!node_is_int(&nodes[i]))
+			return false;
+	return true;
+}
+
+/*
+ * compute a function node for a block of rows
+ */
+static inline void block_fun_int(const struct node *const nodes, const struct node *const n, const uint32_t *const args, const int64_t *const blk, const bool *const bad, size_t rows, int64_t *const v, bool *const vbad)
+{
+	const uint32_t *const a = &args[n->data.arg[0]];
+	const uint32_t funid = n->data.arg[1];
+	const size_t nargs = n->nargs;
+	if (FUNID(TK_FUN_SELECT) == funid) {
+		if (3 != nargs) {
+			for (size_t j = 0; j < rows; j++)
+				vbad[j] = true;
+			return;
+		}
+		const int64_t *const c = &blk[a[0] * (size_t) BLOCK];
+		const int64_t *const x = &blk[a[1] * (size_t) BLOCK];
+		const int64_t *const y = &blk[a[2] * (size_t) BLOCK];
+		for (size_t j = 0; j < rows; j++) {
+			v[j] = c[j] ? x[j] : y[j];
+			vbad[j] = bad[a[0] * BLOCK + j] | bad[a[1] * BLOCK + j] | bad[a[2] * BLOCK + j];
+		}
+		return;
+	}
+	const bool rounds = (FUNID(TK_FUN_FLOOR) == funid) || (FUNID(TK_FUN_CEIL) == funid) || (FUNID(TK_FUN_ROUND) == funid);
+	if ((1 == nargs) && rounds && (OP_DIV == nodes[a[0]].op)) {
+		// round the quotient directly, the division itself may be inexact
+		const struct node *const q = &nodes[a[0]];
+		const int64_t *const l = &blk[q->data.arg[0] * (size_t) BLOCK];
+		const int64_t *const r = &blk[q->data.arg[1] * (size_t) BLOCK];
+		const bool *const lbad = &bad[q->data.arg[0] * (size_t) BLOCK];
+		const bool *const rbad = &bad[q->data.arg[1] * (size_t) BLOCK];
+		for (size_t j = 0; j < rows; j++)
+			vbad[j] = lbad[j] || rbad[j] || !int_div(l[j], r[j], funid, &v[j]);
+		return;
+	}
+	if ((1 == nargs) && (rounds || (FUNID(TK_FUN_NONE) == funid))) {
+		memcpy(v, &blk[a[0] * BLOCK], rows * sizeof(int64_t));
+		memcpy(vbad, &bad[a[0] * BLOCK], rows * sizeof(bool));
+		return;
+	}
+	if ((0 == nargs) || (1 == nargs && !(FUNID(TK_FUN_SUM) == funid || FUNID(TK_FUN_MIN) == funid || FUNID(TK_FUN_MAX) == funid)) || (1 < nargs && rounds)) {
+		// like in fun.h, sum() is 0, and all other argument counts are errors
+		const bool err = !((0 == nargs) && (FUNID(TK_FUN_SUM) == funid));
+		for (size_t j = 0; j < rows; j++) {
+			v[j] = 0;
+			vbad[j] = err;
+		}
+		return;
+	}
+	memcpy(v, &blk[a[0] * BLOCK], rows * sizeof(int64_t));
+	memcpy(vbad, &bad[a[0] * BLOCK], rows * sizeof(bool));
+	for (size_t i = 1; i < nargs; i++) {
+		const int64_t *const x = &blk[a[i] * (size_t) BLOCK];
+		const bool *const xbad = &bad[a[i] * (size_t) BLOCK];
+		for (size_t j = 0; j < rows; j++) {
+			switch (funid) {
+			case FUNID(TK_FUN_MIN): v[j] = (x[j] < v[j]) ? x[j] : v[j]; break;
+			case FUNID(TK_FUN_MAX): v[j] = (x[j] > v[j]) ? x[j] : v[j]; break;
+			default:                vbad[j] |= !int_add(v[j], x[j], &v[j]); break;
+			}
+			vbad[j] |= xbad[j];
+		}
+	}
+}
+
+/*
+ * evaluate a block of rows with int64 values, starting at the given row
+ *
+ * A program must pass prog_is_int() first. Without cols, the variables of the
+ * single row come from row.
+ */
+static inline void prog_run_block_int(const struct xpr_prog *const prog, int64_t *const blk, bool *const bad, const int64_t *const *const cols, const int64_t *const row, size_t first, size_t rows)
+{
+	const struct node *const nodes = prog_nodes(prog);
+	const uint32_t *const args = prog_args(prog);
+	for (size_t i = 0; i < prog->nnodes; i++) {
+		const struct node *const n = &nodes[i];
+		int64_t *const v = &blk[i * BLOCK];
+		bool *const vbad = &bad[i * BLOCK];
+#		define ROWS(ok) for (size_t j = 0; j < rows; j++) vbad[j] = lbad || rbad || !(ok)
+#		define l (blk[n->data.arg[0] * (size_t) BLOCK + j])
+#		define r (blk[n->data.arg[1] * (size_t) BLOCK + j])
+#		define lbad (bad[n->data.arg[0] * (size_t) BLOCK + j])
+#		define rbad (bad[n->data.arg[1] * (size_t) BLOCK + j])
+		switch (n->op) {
+		case OP_NEG:   for (size_t j = 0; j < rows; j++) vbad[j] = lbad || !int_sub(0, l, &v[j]); break;
+		case OP_ADD:   ROWS(int_add(l, r, &v[j]));                                                  break;
+		case OP_SUB:   ROWS(int_sub(l, r, &v[j]));                                                  break;
+		case OP_MUL:   ROWS(int_mul(l, r, &v[j]));                                                  break;
+		case OP_DIV:   ROWS(int_div(l, r, FUNID(TK_FUN_NONE), &v[j]));                              break;
+		case OP_POW:   ROWS(int_pow(l, r, &v[j]));                                                  break;
+		case OP_FUN:   block_fun_int(nodes, n, args, blk, bad, rows, v, vbad);                     break;
+		case OP_LT:    ROWS((v[j] = (l < r), true));                                                break;
+		case OP_LE:    ROWS((v[j] = (l <= r), true));                                               break;
+		case OP_GT:    ROWS((v[j] = (l > r), true));                                                break;
+		case OP_GE:    ROWS((v[j] = (l >= r), true));                                               break;
+		case OP_EQ:    ROWS((v[j] = (l == r), true));                                               break;
+		case OP_NE:    ROWS((v[j] = (l != r), true));                                               break;
+		case OP_AND:   ROWS((v[j] = ((l != 0) & (r != 0)), true));                                  break;
+		case OP_OR:    ROWS((v[j] = ((l != 0) | (r != 0)), true));                                  break;
+		case OP_NOT:   for (size_t j = 0; j < rows; j++) { v[j] = (l == 0); vbad[j] = lbad; }     break;
+		case OP_CONST: {
+			int64_t c = 0;
+			bool cbad = !int_const(n->data.value, &c);
+			for (size_t j = 0; j < rows; j++) {
+				v[j] = c;
+				vbad[j] = cbad;
+			}
+			break;
+		}
+		case OP_VAR:
+			if (!cols) {
+				v[0] = row[n->data.slot];
+				vbad[0] = false;
+				break;
+			}
+			if (cols[n->data.slot])
+				memcpy(v, &cols[n->data.slot][first], rows * sizeof(int64_t));
+			for (size_t j = 0; j < rows; j++)
+				vbad[j] = !cols[n->data.slot];
+			break;
+		default:
+			assert(0 || !!! "invalid node");
+			for (size_t j = 0; j < rows; j++)
+				vbad[j] = true;
+		}
+#		undef ROWS
+#		undef l
+#		undef r
+#		undef lbad
+#		undef rbad
+	}
+}
@@ -0,0 +1,78 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+
+/*
+ * interp.h
+ *
+ * This file implements the lookup tables of xpr_interp() and xpr_step(). The
+ * search counts the breakpoints up to x without branches: a linear scan of
+ * small tables, which the compiler vectorizes, and a binary search that halves
+ * the range of large tables.
+ */
+
+// tables up to this size use a linear scan
+#define INTERP_SCAN 16
+
+/*
+ * get the number of breakpoints <= x
+ */
+static inline size_t interp_find(const struct xpr_table *const t, double x)
+{
+	if (t->n <= INTERP_SCAN) {
+		size_t k = 0;
+		for (size_t i = 0; i < t->n; i++)
+			k += (t->x[i] <= x);
+		return k;
+	}
+	const double *base = t->x;
+	size_t len = t->n;
+	while (len > 1) {
+		const size_t half = len / 2;
+		base = (base[half] <= x) ? base + half : base;
+		len -= half;
+	}
+	return (size_t) (base - t->x) + (*base <= x);
+}
+
+/*
+ * look up x, where values outside of the breakpoints are the first or last
+ * value of the table
+ */
+static inline double interp_eval(const struct xpr_table *const t, double x, bool linear)
+{
+	if (!t->n || isnan(x))
+		return XPR_ERR;
+	const size_t k = interp_find(t, x);
+	if (0 == k)
+		return t->y[0];
+	if ((t->n == k) || !linear)
+		return t->y[k - 1];
+	// x[k - 1] <= x < x[k]
+	const double dx = t->x[k] - t->x[k - 1];
+	return t->y[k - 1] + (x - t->x[k - 1]) / dx * (t->y[k] - t->y[k - 1]);
+}
@@ -0,0 +1,427 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+
+/*
+ * ival.h
+ *
+ * This file implements the evaluation of compiled programs with intervals.
+ * Each variable is a range of values, and the value of each node is a range
+ * that encloses all results of the node for any values in these ranges, i.e.,
+ * the interval extension of the node. The bounds round outwards, so the
+ * enclosure is guaranteed: the basic operators are exact to half an ulp, and
+ * the math library to one ulp, so the bounds widen by one and two ulps.
+ *
+ * Errors cannot be part of a range. Instead, each interval records whether
+ * some values in the ranges result in an error, e.g., division by an interval
+ * that contains 0. If all values result in an error, the interval is empty,
+ * i.e., lo > hi. Like errors, empty intervals propagate through all nodes.
+ *
+ * The enclosures are not always tight: for instance, division by an interval
+ * that contains 0 is unbounded, and user-defined functions are unbounded.
+ */
+
+struct ival {
+	double lo;
+	double hi;
+	bool err;            // whether some values result in an error
+};
+
+// the scratch space per argument: a value, a pointer to a block, an interval, or a float and its double copy
+#define ARGV_SIZE        ((sizeof(struct ival) > 2 * sizeof(double)) ? sizeof(struct ival) : 2 * sizeof(double))
+
+#define IV(l, h, e)      ((struct ival) { (l), (h), (e) })
+#define IV_EMPTY         IV(INFINITY, -INFINITY, true)
+#define IV_ALL(e)        IV(-INFINITY, INFINITY, (e))
+#define IV_BOOL(t, f, e) IV((t) ? 1 : 0, (f) ? 0 : 1, (e))
+
+#define iv_empty(a)      (!((a).lo <= (a).hi))
+#define iv_point(a)      ((a).lo == (a).hi)
+
+// outward rounding, by one ulp for basic operators, and by two for the math library
+#define DOWN(x)          nextafter((x), -INFINITY)
+#define UP(x)            nextafter((x), INFINITY)
+#define DOWN2(x)         DOWN(DOWN(x))
+#define UP2(x)           UP(UP(x))
+
+static inline double iv_min4(double a, double b, double c, double d)
+{
+	double ab = (a < b) ? a : b;
+	double cd = (c < d) ? c : d;
+	return (ab < cd) ? ab : cd;
+}
+
+static inline double iv_max4(double a, double b, double c, double d)
+{
+	double ab = (a > b) ? a : b;
+	double cd = (c > d) ? c : d;
+	return (ab > cd) ? ab : cd;
+}
+
+/*
+ * the enclosure of four corner values, e.g., of a product
+ *
+ * A NaN corner is an undefined form like inf-inf or 0*inf, and values near it
+ * are unbounded.
+ */
+static inline struct ival iv_corners(double a, double b, double c, double d, bool err)
+{
+	if (isnan(a) || isnan(b) || isnan(c) || isnan(d))
+		return IV_ALL(true);
+	return IV(DOWN(iv_min4(a, b, c, d)), UP(iv_max4(a, b, c, d)), err);
+}
+
+static inline struct ival iv_hull(struct ival a, struct ival b)
+{
+	if (iv_empty(a))
+		return IV(b.lo, b.hi, true);
+	if (iv_empty(b))
+		return IV(a.lo, a.hi, true);
+	return IV((a.lo < b.lo) ? a.lo : b.lo, (a.hi > b.hi) ? a.hi : b.hi, a.err || b.err);
+}
+
+// inf-inf and 0*inf are undefined even where they are no corners of the result
+static inline struct ival iv_add(struct ival a, struct ival b)
+{
+	const bool undef = ((INFINITY == a.hi) && (-INFINITY == b.lo)) || ((-INFINITY == a.lo) && (INFINITY == b.hi));
+	return iv_corners(a.lo + b.lo, a.hi + b.hi, a.lo + b.lo, a.hi + b.hi, a.err || b.err || undef);
+}
+
+static inline struct ival iv_sub(struct ival a, struct ival b)
+{
+	const bool undef = ((INFINITY == a.hi) && (INFINITY == b.hi)) || ((-INFINITY == a.lo) && (-INFINITY == b.lo));
+	return iv_corners(a.lo - b.hi, a.hi - b.lo, a.lo - b.hi, a.hi - b.lo, a.err || b.err || undef);
+}
+
+static inline struct ival iv_mul(struct ival a, struct ival b)
+{
+#	define ZERO(x) (((x).lo <= 0) && (0 <= (x).hi))
+#	define INF(x)  (isinf((x).lo) || isinf((x).hi))
+	const bool undef = (ZERO(a) && INF(b)) || (ZERO(b) && INF(a));
+#	undef ZERO
+#	undef INF
+	return iv_corners(a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi, a.err || b.err || undef);
+}
+
+static inline struct ival iv_div(struct ival a, struct ival b)
+{
+	const bool err = a.err || b.err;
+	if ((0 == b.lo) && (0 == b.hi))
+		return IV_EMPTY;
+	if ((b.lo <= 0) && (0 <= b.hi)) {
+		// dividing by values close to 0 is unbounded
+		if ((0 == a.lo) && (0 == a.hi))
+			return IV(0, 0, true);
+		return IV_ALL(true);
+	}
+	return iv_corners(a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi, err);
+}
+
+// x^y for x >= 0 is monotonic in x and in y, so the extremes are in the corners
+static inline struct ival iv_pow_pos(struct ival a, struct ival b)
+{
+	const double c[] = { pow(a.lo, b.lo), pow(a.lo, b.hi), pow(a.hi, b.lo), pow(a.hi, b.hi) };
+	struct ival r = iv_corners(c[0], c[1], c[2], c[3], a.err || b.err);
+	return IV(DOWN(r.lo), UP(r.hi), r.err);
+}
+
+static inline struct ival iv_pow(struct ival a, struct ival b)
+{
+	struct ival r = IV_EMPTY;
+	const bool err = a.err || b.err;
+	if (a.hi >= 0)
+		r = iv_pow_pos(IV((a.lo > 0) ? a.lo : 0, a.hi, err), b);
+	if (a.lo >= 0)
+		return r;
+
+	// negative bases need integral exponents, then x^y is +-|x|^y
+	const struct ival neg = IV((a.hi < 0) ? -a.hi : 0, -a.lo, err);
+	if (!iv_point(b) || (fabs(b.lo) >= 0x1p53))
+		return iv_hull(r, IV_ALL(true));
+	if (round(b.lo) != b.lo)
+		return (a.hi >= 0) ? IV(r.lo, r.hi, true) : IV_EMPTY;
+	struct ival m = iv_pow_pos(neg, b);
+	if (0 != fmod(b.lo, 2))
+		m = IV(-m.hi, -m.lo, m.err);
+	return (a.hi >= 0) ? iv_hull(r, m) : m;
+}
+
+/*
+ * a monotonic function on a domain [dlo, dhi], where values outside the
+ * domain result in an error
+ */
+static inline struct ival iv_mono(struct ival a, double (*f)(double), bool inc, double dlo, double dhi, bool exact)
+{
+	bool err = a.err;
+	if ((a.lo < dlo) || (a.hi > dhi)) {
+		err = true;
+		a.lo = (a.lo < dlo) ? dlo : a.lo;
+		a.hi = (a.hi > dhi) ? dhi : a.hi;
+		if (iv_empty(a))
+			return IV_EMPTY;
+	}
+	double lo = f(inc ? a.lo : a.hi);
+	double hi = f(inc ? a.hi : a.lo);
+	if (isnan(lo) || isnan(hi))
+		return IV_ALL(true);
+	return exact ? IV(lo, hi, err) : IV(DOWN2(lo), UP2(hi), err);
+}
+
+/*
+ * sin or cos, which have their maximum at peak + 2*k*pi, and their minimum at
+ * peak + pi + 2*k*pi
+ */
+static inline struct ival iv_trig(struct ival a, double (*f)(double), double peak)
+{
+	if (!isfinite(a.lo) || !isfinite(a.hi))
+		return IV(-1, 1, true);
+	if ((a.hi - a.lo >= 2 * M_PI) || (fabs(a.lo) > 0x1p20) || (fabs(a.hi) > 0x1p20))
+		return IV(-1, 1, a.err);
+	double lo = f(a.lo), hi = f(a.hi);
+	if (lo > hi) {
+		double t = lo;
+		lo = hi;
+		hi = t;
+	}
+	lo = DOWN2(lo);
+	hi = UP2(hi);
+	// extremes within the interval, with some slack for the rounding of pi
+	const double slack = 1e-9;
+	if (peak + 2 * M_PI * ceil((a.lo - peak) / (2 * M_PI) - slack) <= a.hi + slack)
+		hi = 1;
+	if (peak + M_PI + 2 * M_PI * ceil((a.lo - peak - M_PI) / (2 * M_PI) - slack) <= a.hi + slack)
+		lo = -1;
+	return IV((lo < -1) ? -1 : lo, (hi > 1) ? 1 : hi, a.err);
+}
+
+static inline struct ival iv_tan(struct ival a)
+{
+	if (!isfinite(a.lo) || !isfinite(a.hi))
+		return IV_ALL(true);
+	if ((a.hi - a.lo >= M_PI) || (fabs(a.lo) > 0x1p20) || (fabs(a.hi) > 0x1p20))
+		return IV_ALL(a.err);
+	// tan has poles at pi/2 + k*pi
+	const double slack = 1e-9;
+	const double k = ceil((a.lo - M_PI / 2) / M_PI - slack);
+	if (M_PI / 2 + M_PI * k <= a.hi + slack)
+		return IV_ALL(a.err);
+	return IV(DOWN2(tan(a.lo)), UP2(tan(a.hi)), a.err);
+}
+
+static inline struct ival iv_cosh(struct ival a)
+{
+	if ((a.lo <= 0) && (0 <= a.hi)) {
+		const double m = (-a.lo > a.hi) ? -a.lo : a.hi;
+		return IV(1, UP2(cosh(m)), a.err);
+	}
+	return (a.lo > 0) ? iv_mono(a, cosh, true, -INFINITY, INFINITY, false)
+	                  : iv_mono(a, cosh, false, -INFINITY, INFINITY, false);
+}
+
+static inline struct ival iv_log(struct ival a)
+{
+	// fun.h rejects values <= 0, the smallest positive value is the limit
+	return iv_mono(a, log, true, nextafter(0, 1), INFINITY, false);
+}
+
+/*
+ * the truth value of an interval: whether all values are nonzero, or all zero
+ */
+#define iv_true(a)       (((a).lo > 0) || ((a).hi < 0))
+#define iv_false(a)      ((0 == (a).lo) && (0 == (a).hi))
+
+static inline struct ival iv_fun(uint32_t funid, size_t nargs, const struct ival *const x)
+{
+	for (size_t i = 0; i < nargs; i++)
+		if (iv_empty(x[i]))
+			return IV_EMPTY;
+	bool err = false;
+	for (size_t i = 0; i < nargs; i++)
+		err |= x[i].err;
+
+	switch (funid) {
+	case FUNID(TK_FUN_SUM): {
+		struct ival r = IV(0, 0, err);
+		for (size_t i = 0; i < nargs; i++)
+			r = iv_add(r, x[i]);
+		return r;
+	}
+	case FUNID(TK_FUN_MIN):
+	case FUNID(TK_FUN_MAX): {
+		if (0 == nargs)
+			return IV_EMPTY;
+		const bool max = (FUNID(TK_FUN_MAX) == funid);
+		struct ival r = x[0];
+		for (size_t i = 1; i < nargs; i++) {
+			if (max ? (x[i].lo > r.lo) : (x[i].lo < r.lo))
+				r.lo = x[i].lo;
+			if (max ? (x[i].hi > r.hi) : (x[i].hi < r.hi))
+				r.hi = x[i].hi;
+		}
+		return IV(r.lo, r.hi, err);
+	}
+	case FUNID(TK_FUN_SELECT):
+		if (3 != nargs)
+			return IV_EMPTY;
+		if (iv_true(x[0]))
+			return IV(x[1].lo, x[1].hi, err);
+		if (iv_false(x[0]))
+			return IV(x[2].lo, x[2].hi, err);
+		return IV((x[1].lo < x[2].lo) ? x[1].lo : x[2].lo, (x[1].hi > x[2].hi) ? x[1].hi : x[2].hi, err);
+	case FUNID(TK_FUN_SCALE):
+		if (3 == nargs)
+			return iv_mul(iv_div(x[2], x[0]), x[1]);
+		if (5 == nargs)
+			return iv_add(iv_mul(iv_div(iv_sub(x[4], x[0]), iv_sub(x[1], x[0])), iv_sub(x[3], x[2])), x[2]);
+		return IV_EMPTY;
+	case FUNID(TK_FUN_POLY): {
+		if (nargs < 2)
+			return IV_EMPTY;
+		struct ival r = x[nargs - 1];
+		for (size_t i = nargs - 1; i-- > 1;)
+			r = iv_add(iv_mul(r, x[0]), x[i]);
+		return IV(r.lo, r.hi, err);
+	}
+	case FUNID(TK_FUN_WSUM):
+	case FUNID(TK_FUN_WMIN):
+	case FUNID(TK_FUN_WMAX):
+	case FUNID(TK_FUN_WAVG):
+	case FUNID(TK_FUN_LAG):
+		// a window of one row, as in fun.h
+		if ((2 != nargs) || (x[1].lo != x[1].hi) || !WINDOW_OK(x[1].lo, FUNID(TK_FUN_LAG) != funid))
+			return IV_EMPTY;
+		if ((FUNID(TK_FUN_LAG) == funid) && (0 != x[1].lo))
+			return IV_EMPTY;
+		return IV(x[0].lo, x[0].hi, err);
+	case FUNID(TK_FUN_LOG):
+		if (2 == nargs)
+			return iv_div(iv_log(x[1]), iv_log(x[0]));
+		break;
+	}
+
+	if (1 != nargs)
+		return IV_EMPTY;
+	const struct ival a = x[0];
+	switch (funid) {
+	case FUNID(TK_FUN_NONE):  return a;
+	case FUNID(TK_FUN_ACOS):  return iv_mono(a, acos, false, -1, 1, false);
+	case FUNID(TK_FUN_ACOSH): return iv_mono(a, acosh, true, 1, INFINITY, false);
+	case FUNID(TK_FUN_ASIN):  return iv_mono(a, asin, true, -1, 1, false);
+	case FUNID(TK_FUN_ASINH): return iv_mono(a, asinh, true, -INFINITY, INFINITY, false);
+	case FUNID(TK_FUN_ATAN):  return iv_mono(a, atan, true, -INFINITY, INFINITY, false);
+	case FUNID(TK_FUN_ATANH): return iv_mono(a, atanh, true, -1, 1, false);
+	case FUNID(TK_FUN_CBRT):  return iv_mono(a, cbrt, true, -INFINITY, INFINITY, false);
+	case FUNID(TK_FUN_CEIL):  return iv_mono(a, ceil, true, -INFINITY, INFINITY, true);
+	case FUNID(TK_FUN_COS):   return iv_trig(a, cos, 0);
+	case FUNID(TK_FUN_COSH):  return iv_cosh(a);
+	case FUNID(TK_FUN_EXP):   return iv_mono(a, exp, true, -INFINITY, INFINITY, false);
+	case FUNID(TK_FUN_FLOOR): return iv_mono(a, floor, true, -INFINITY, INFINITY, true);
+	case FUNID(TK_FUN_LOG):   return iv_log(a);
+	case FUNID(TK_FUN_ROUND): return iv_mono(a, round, true, -INFINITY, INFINITY, true);
+	case FUNID(TK_FUN_SIN):   return iv_trig(a, sin, M_PI / 2);
+	case FUNID(TK_FUN_SINH):  return iv_mono(a, sinh, true, -INFINITY, INFINITY, false);
+	case FUNID(TK_FUN_SQRT):  return iv_mono(a, sqrt, true, 0, INFINITY, false);
+	case FUNID(TK_FUN_TAN):   return iv_tan(a);
+	case FUNID(TK_FUN_TANH):  return iv_mono(a, tanh, true, -INFINITY, INFINITY, false);
+	default:                  return IV_EMPTY;
+	}
+}
+
+static inline struct ival iv_cmp(uint32_t op, struct ival a, struct ival b)
+{
+	const bool err = a.err || b.err;
+	switch (op) {
+	case OP_LT: return IV_BOOL(a.hi < b.lo, a.lo >= b.hi, err);
+	case OP_LE: return IV_BOOL(a.hi <= b.lo, a.lo > b.hi, err);
+	case OP_GT: return IV_BOOL(a.lo > b.hi, a.hi <= b.lo, err);
+	case OP_GE: return IV_BOOL(a.lo >= b.hi, a.hi < b.lo, err);
+	case OP_EQ: return IV_BOOL(iv_point(a) && iv_point(b) && (a.lo == b.lo), (a.hi < b.lo) || (a.lo > b.hi), err);
+	case OP_NE: return IV_BOOL((a.hi < b.lo) || (a.lo > b.hi), iv_point(a) && iv_point(b) && (a.lo == b.lo), err);
+	case OP_AND: return IV_BOOL(iv_true(a) && iv_true(b), iv_false(a) || iv_false(b), err);
+	case OP_OR:  return IV_BOOL(iv_true(a) || iv_true(b), iv_false(a) && iv_false(b), err);
+	default:     return IV_BOOL(iv_false(a), iv_true(a), err);
+	}
+}
+
+/*
+ * evaluate a program with intervals, the variables range from lo to hi, and
+ * argv has room for the arguments of function nodes
+ */
+static inline void prog_run_ival(const struct xpr_prog *const prog, struct ival *const iv, const double *const lo, const double *const hi, void *const argv)
+{
+	const struct node *const nodes = prog_nodes(prog);
+	const uint32_t *const args = prog_args(prog);
+	for (size_t i = 0; i < prog->nnodes; i++) {
+		const struct node *const n = &nodes[i];
+		if (OP_CONST == n->op) {
+			// constant errors are empty
+			iv[i] = isnan(n->data.value) ? IV_EMPTY : IV(n->data.value, n->data.value, false);
+			continue;
+		}
+		if (OP_VAR == n->op) {
+			iv[i] = (lo[n->data.slot] <= hi[n->data.slot]) ? IV(lo[n->data.slot], hi[n->data.slot], false) : IV_EMPTY;
+			continue;
+		}
+		if (OP_FUN == n->op) {
+			// user-defined functions are unbounded
+			if (n->data.arg[1] >= FUN_USER) {
+				iv[i] = IV_ALL(true);
+				continue;
+			}
+			const size_t nargs = n->nargs;
+			struct ival *const x = argv;
+			for (size_t k = 0; k < nargs; k++)
+				x[k] = iv[args[n->data.arg[0] + k]];
+			iv[i] = iv_fun(n->data.arg[1], nargs, x);
+			continue;
+		}
+		const struct ival a = iv[n->data.arg[0]];
+		const struct ival b = (2 == OP_NARGS(n->op)) ? iv[n->data.arg[1]] : a;
+		if (iv_empty(a) || iv_empty(b)) {
+			iv[i] = IV_EMPTY;
+			continue;
+		}
+		switch (n->op) {
+		case OP_NEG: iv[i] = IV(-a.hi, -a.lo, a.err); break;
+		case OP_ADD: iv[i] = iv_add(a, b);            break;
+		case OP_SUB: iv[i] = iv_sub(a, b);            break;
+		case OP_MUL: iv[i] = iv_mul(a, b);            break;
+		case OP_DIV: iv[i] = iv_div(a, b);            break;
+		case OP_POW: iv[i] = iv_pow(a, b);            break;
+		default:     iv[i] = iv_cmp(n->op, a, b);     break;
+		}
+	}
+}
+
+#undef IV
+#undef IV_EMPTY
+#undef IV_ALL
+#undef IV_BOOL
+#undef DOWN
+#undef UP
+#undef DOWN2
+#undef UP2
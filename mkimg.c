@@ -0,0 +1,106 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+/*
+ * mkimg.c
+ *
+ * This tool compiles expressions, one per line of the standard input, and
+ * writes the programs to an image file. The remaining arguments name the
+ * variable slots.
+ *
+ * Usage:
+ * ./mkimg rules.img x y z <rules.txt
+ */
+#ifdef MAIN
+
+#include "xpr.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s image [var...] <exprs\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	struct xpr_var vars[argc - 1];
+	for (int i = 2; i < argc; i++) {
+		vars[i-2].name = argv[i];
+		vars[i-2].value = 0;
+	}
+	vars[argc-2].name = NULL;
+
+	size_t nprogs = 0, cap = 0, lineno = 0;
+	struct xpr_prog **progs = NULL;
+	char *line = NULL;
+	size_t linesz = 0;
+	ssize_t len;
+	while ((len = getline(&line, &linesz, stdin)) > 0) {
+		lineno++;
+		if (line[len-1] == '\n')
+			line[len-1] = '\0';
+		if (nprogs == cap) {
+			cap = cap ? 2 * cap : 64;
+			progs = realloc(progs, cap * sizeof(*progs));
+			if (!progs) {
+				perror("realloc");
+				exit(EXIT_FAILURE);
+			}
+		}
+		progs[nprogs] = xpr_compile(line, vars);
+		if (!progs[nprogs]) {
+			fprintf(stderr, "%zu: %s: %s\n", lineno, line, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		nprogs++;
+	}
+	free(line);
+
+	size_t size = xpr_image_write((const struct xpr_prog *const *) progs, nprogs, NULL, 0);
+	void *buf = size ? malloc(size) : NULL;
+	if (!buf || size != xpr_image_write((const struct xpr_prog *const *) progs, nprogs, buf, size)) {
+		perror("xpr_image_write");
+		exit(EXIT_FAILURE);
+	}
+	FILE *f = fopen(argv[1], "wb");
+	if (!f || 1 != fwrite(buf, size, 1, f) || 0 != fclose(f)) {
+		perror(argv[1]);
+		exit(EXIT_FAILURE);
+	}
+	for (size_t i = 0; i < nprogs; i++)
+		xpr_prog_free(progs[i]);
+	free(progs);
+	free(buf);
+	return 0;
+}
+
+#undef MAIN
+#include "xpr.c"
+
+#endif /* MAIN */
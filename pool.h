@@ -0,0 +1,211 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+
+/*
+ * pool.h
+ *
+ * This file implements the thread pool of xpr_eval_parallel(). The rows of a
+ * batch form chunks of whole blocks, and each worker starts with a contiguous
+ * range of chunks. A worker takes chunks from the front of its own range, and
+ * once the range is empty, it steals chunks from the back of the ranges of
+ * other workers. Each row is computed exactly like in xpr_eval_batch(), so
+ * the results do not depend on the number of threads or the schedule.
+ */
+
+// the largest chunk, in blocks, and the number of chunks per worker for small batches
+#define POOL_CHUNK       16
+#define POOL_SPLIT       4
+
+struct pool_queue {
+	pthread_mutex_t lock;
+	size_t lo;           // the next chunk of the owner
+	size_t hi;           // the end of the range, where thieves take chunks
+};
+
+// the memory of a worker, which remains for later evaluations
+struct pool_scratch {
+	double *blk;         // per node, the values of a block of rows
+	size_t nnodes;       // the number of nodes that blk has room for
+	void *argv;          // room for the arguments of one function node
+	size_t nargs;        // the number of arguments that argv has room for
+};
+
+struct xpr_pool {
+	size_t nthreads;     // the number of workers, including the calling thread
+	pthread_t *threads;
+	struct pool_queue *queues;
+	struct pool_scratch *scratch;  // per worker
+	pthread_mutex_t busy;  // one evaluation at a time
+	pthread_mutex_t lock;  // protects the following fields
+	pthread_cond_t start;
+	pthread_cond_t done;
+	uint64_t gen;        // the number of evaluations so far
+	size_t running;      // the number of threads that still work on the evaluation
+	bool quit;
+	bool failed;
+	// the current evaluation
+	const struct xpr_prog *prog;
+	const double *const *cols;
+	double *const *out;
+	size_t n;
+	size_t chunk;        // the number of rows per chunk
+};
+
+struct pool_arg {
+	struct xpr_pool *pool;
+	size_t id;
+};
+
+static inline bool pool_take(struct pool_queue *const q, bool steal, size_t *const c)
+{
+	bool found = false;
+	pthread_mutex_lock(&q->lock);
+	if (q->lo < q->hi) {
+		*c = steal ? --q->hi : q->lo++;
+		found = true;
+	}
+	pthread_mutex_unlock(&q->lock);
+	return found;
+}
+
+/*
+ * make room for the program in the memory of a worker, which only grows
+ */
+static inline bool pool_reserve(struct pool_scratch *const s, const struct xpr_prog *const prog)
+{
+	const size_t nargs = prog_max_args(prog) + 1;
+	if (s->nnodes < prog->nnodes) {
+		free(s->blk);
+		s->nnodes = 0;
+		if (!(s->blk = malloc(prog->nnodes * BLOCK * sizeof(double))))
+			return false;
+		s->nnodes = prog->nnodes;
+	}
+	if (s->nargs < nargs) {
+		free(s->argv);
+		s->nargs = 0;
+		if (!(s->argv = malloc(nargs * ARGV_SIZE)))
+			return false;
+		s->nargs = nargs;
+	}
+	return true;
+}
+
+/*
+ * evaluate chunks with the memory of the worker, until no chunks remain
+ */
+static inline void pool_work(struct xpr_pool *const pool, size_t id)
+{
+	struct pool_scratch *const s = &pool->scratch[id];
+	if (!pool_reserve(s, pool->prog)) {
+		pthread_mutex_lock(&pool->lock);
+		pool->failed = true;
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+	while (1) {
+		size_t c;
+		bool found = pool_take(&pool->queues[id], false, &c);
+		for (size_t k = 1; !found && (k < pool->nthreads); k++)
+			found = pool_take(&pool->queues[(id + k) % pool->nthreads], true, &c);
+		if (!found)
+			break;
+		const size_t first = c * pool->chunk;
+		const size_t last = (pool->n - first < pool->chunk) ? pool->n : first + pool->chunk;
+		prog_run_rows(pool->prog, s->blk, pool->cols, first, last, pool->out, s->argv);
+	}
+}
+
+static void *pool_thread(void *arg)
+{
+	struct xpr_pool *const pool = ((struct pool_arg *) arg)->pool;
+	const size_t id = ((struct pool_arg *) arg)->id;
+	free(arg);
+	uint64_t seen = 0;
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (!pool->quit && (seen == pool->gen))
+			pthread_cond_wait(&pool->start, &pool->lock);
+		if (pool->quit)
+			break;
+		seen = pool->gen;
+		pthread_mutex_unlock(&pool->lock);
+		pool_work(pool, id);
+		pthread_mutex_lock(&pool->lock);
+		if (0 == --pool->running)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/*
+ * pin a worker to one of the CPUs that the process may run on
+ *
+ * returns:
+ *          0, or the error of pthread_setaffinity_np(), or ENOTSUP where the
+ *          platform lacks it
+ */
+static inline int pool_pin(pthread_t thread, size_t id)
+{
+#ifdef CPU_SET
+	cpu_set_t set;
+	int err = pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err)
+		return err;
+	const size_t ncpus = (size_t) CPU_COUNT(&set);
+	if (0 == ncpus)
+		return EINVAL;
+	size_t cpu = 0;
+	for (size_t k = id % ncpus; !CPU_ISSET(cpu, &set) || (0 != k); cpu++)
+		k -= CPU_ISSET(cpu, &set);
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(thread, sizeof(set), &set);
+#else
+	(void) thread;
+	(void) id;
+	return ENOTSUP;
+#endif
+}
+
+/*
+ * split the batch into chunks, and give each worker a contiguous range
+ */
+static inline void pool_split(struct xpr_pool *const pool, size_t n)
+{
+	const size_t want = n / (pool->nthreads * POOL_SPLIT);
+	const size_t blocks = (want / BLOCK < 1) ? 1 : (want / BLOCK > POOL_CHUNK) ? POOL_CHUNK : want / BLOCK;
+	pool->n = n;
+	pool->chunk = blocks * BLOCK;
+	const size_t nchunks = (n + pool->chunk - 1) / pool->chunk;
+	for (size_t k = 0; k < pool->nthreads; k++) {
+		pool->queues[k].lo = k * nchunks / pool->nthreads;
+		pool->queues[k].hi = (k + 1) * nchunks / pool->nthreads;
+	}
+}
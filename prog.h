@@ -0,0 +1,844 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+/*
+ * prog.h
+ *
+ * This file implements compiled programs. A program is a sequence of nodes in
+ * topological order, i.e., each node only refers to nodes with a lower index.
+ * The evaluation computes the value of each node, in order, and the values of
+ * the root nodes are the results. Errors are NAN values, which propagate
+ * through all operators and functions, exactly like in the xpr() function.
+ *
+ * The nodes form a DAG: the builder never emits two identical nodes, so all
+ * expressions of a program share common subexpressions.
+ *
+ * A program is a single block of memory without internal pointers. The header
+ * is directly followed by these sections:
+ *
+ *  nodes   the node array
+ *  args    the argument lists of all function nodes
+ *  roots   the root node of each expression
+ *  varnode the node of each variable slot, or NONE for unused variables
+ *  depoff  the start of the dependency list of each variable slot
+ *  deps    for each variable slot, all nodes that depend on the variable
+ *
+ * The only external reference is the list of user-defined functions, which
+ * function nodes refer to by index. It is NULL for programs that do not call
+ * user-defined functions.
+ */
+
+#define OP_CONST         0x0
+#define OP_VAR           0x1
+#define OP_POS           0x2  // never emitted, unary plus is a no-op
+#define OP_NEG           0x3
+#define OP_ADD           0x4
+#define OP_SUB           0x5
+#define OP_MUL           0x6
+#define OP_DIV           0x7
+#define OP_POW           0x8
+#define OP_FUN           0x9
+#define OP_LT            0xa
+#define OP_LE            0xb
+#define OP_GT            0xc
+#define OP_GE            0xd
+#define OP_EQ            0xe
+#define OP_NE            0xf
+#define OP_AND           0x10
+#define OP_OR            0x11
+#define OP_NOT           0x12
+
+#define OP_NARGS(op)     (((OP_NEG == (op)) || (OP_NOT == (op))) ? 1 : 2)
+
+#define NONE             UINT32_MAX
+
+// function IDs of user-defined functions start here
+#define FUN_USER         0x100
+
+struct node {
+	uint32_t op;
+	uint32_t nargs;
+	union node_data {
+		double value;      // OP_CONST: the value
+		uint32_t slot;     // OP_VAR: the variable slot
+		uint32_t arg[2];   // operators: the operand nodes
+		                   // OP_FUN: the first argument in args, the function ID,
+		                   // or FUN_USER plus the index of a user-defined function
+	} data;
+};
+
+// the header size must keep the node array aligned
+struct xpr_prog {
+	uint32_t nnodes;
+	uint32_t nargs;
+	uint32_t nvars;
+	uint32_t ndeps;
+	uint32_t nroots;
+	uint32_t reserved;
+	union prog_ext {
+		const struct xpr_fun *funs;
+		uint64_t align;
+	} ext;
+};
+
+#define prog_nodes(p)    ((struct node *) ((p) + 1))
+#define prog_args(p)     ((uint32_t *) (prog_nodes(p) + (p)->nnodes))
+#define prog_roots(p)    (prog_args(p) + (p)->nargs)
+#define prog_varnode(p)  (prog_roots(p) + (p)->nroots)
+#define prog_depoff(p)   (prog_varnode(p) + (p)->nvars)
+#define prog_deps(p)     (prog_depoff(p) + (p)->nvars + 1)
+
+static inline size_t prog_size(size_t nnodes, size_t nargs, size_t nroots, size_t nvars, size_t ndeps)
+{
+	return sizeof(struct xpr_prog) + nnodes * sizeof(struct node) + (nargs + nroots + 2 * nvars + 1 + ndeps) * sizeof(uint32_t);
+}
+
+// the number of rows per block of the batch evaluation
+#define BLOCK            64
+
+struct xpr_ws {
+	const struct xpr_prog *prog;
+	double *blk;         // per node, the values of a block of rows
+	float *blkf;         // the same, for the evaluation in single precision
+	double *blkvar;      // per variable slot, the values of a block of rows, converted to double
+	const double **blkcols;  // per variable slot, the column in blkvar, or NULL
+	int64_t *blki;       // the same as blk, for the exact evaluation with int64 values
+	bool *blkbad;        // per node and row, whether the int64 value is inexact
+	double *blkdot;      // per node and variable, the tangents of a block of rows
+	size_t nwrt;         // the number of variables that blkdot has room for
+	struct ival *ival;   // per node, the range of values for ranges of variables
+	struct win **win;    // per node, the window of a window function in streams
+	size_t nwin;         // the number of nodes, so that freeing win does not need prog
+	void *argv;          // room for the arguments of one function node, see prog_max_args()
+	bool isint;          // whether the program qualifies for int64 values
+	double val[];
+};
+
+#define DIV_OK(l, r)     (0 != (r))
+#define POW_OK(l, r)     (!isnan(l) && !isnan(r) && ((0 <= (l)) || (round(r) == (r))))
+
+// comparisons and logical operators result in 1 or 0, without branches, and errors propagate
+#define CMP(l, r, op)    ((isnan(l) | isnan(r)) ? XPR_ERR : ((l) op (r)))
+#define LOGIC(l, r, op)  ((isnan(l) | isnan(r)) ? XPR_ERR : (((l) != 0) op ((r) != 0)))
+#define NOT(x)           (isnan(x) ? XPR_ERR : ((x) == 0))
+
+/*
+ * user-defined functions always take double arguments, which dv has room for
+ */
+static inline float user_callf(const struct xpr_fun *const f, size_t nargs, const float *const av, double *const dv)
+{
+	for (size_t i = 0; i < nargs; i++)
+		dv[i] = av[i];
+	return f->fun(f->arg, nargs, dv);
+}
+
+// the evaluation in double precision
+#define RUN(name)         name
+#define REAL              double
+#define MATH(name)        name
+#define PFUN(name)        pfun_##name
+#define USER(f, n, av, dv) ((void) (dv), (f)->fun((f)->arg, (n), (av)))
+#define BATCH             1
+#include "run.h"
+
+// the batch evaluation in single precision
+#define RUN(name)         name##f
+#define REAL              float
+#define MATH(name)        name##f
+#define PFUN(name)        pfunf_##name
+#define USER(f, n, av, dv) user_callf((f), (n), (av), (dv))
+#define BATCH             0
+#include "run.h"
+
+static inline uint32_t node_arg(const struct node *const n, const uint32_t *const args, size_t i)
+{
+	return (OP_FUN == n->op) ? args[n->data.arg[0] + i] : n->data.arg[i];
+}
+
+/*
+ * get the window size of a window function, which must be a valid constant
+ */
+static inline bool node_window(const struct node *const nodes, const uint32_t *const args, const struct node *const n, size_t *const size)
+{
+	if (2 != n->nargs)
+		return false;
+	const struct node *const s = &nodes[args[n->data.arg[0] + 1]];
+	if ((OP_CONST != s->op) || !WINDOW_OK(s->data.value, FUNID(TK_FUN_LAG) != n->data.arg[1]))
+		return false;
+	*size = s->data.value;
+	return true;
+}
+
+/*
+ * the largest argument list of a function node, which the scratch space of a
+ * workspace must hold, so that the evaluation never allocates memory
+ */
+static inline size_t prog_max_args(const struct xpr_prog *const prog)
+{
+	const struct node *const nodes = prog_nodes(prog);
+	size_t max = 0;
+	for (size_t i = 0; i < prog->nnodes; i++)
+		if ((OP_FUN == nodes[i].op) && (nodes[i].nargs > max))
+			max = nodes[i].nargs;
+	return max;
+}
+
+static inline double node_fun(const struct node *const n, const uint32_t *const args, const double *const val, const struct xpr_fun *const funs, void *const argv)
+{
+	// gather the arguments in the scratch space
+	const size_t nargs = n->nargs;
+	double *const av = argv;
+	for (size_t i = 0; i < nargs; i++)
+		av[i] = val[args[n->data.arg[0] + i]];
+	return fun_call(funs, n->data.arg[1], nargs, av, NULL);
+}
+
+/*
+ * compute the value of a node, except for variables, where argv has room for
+ * the arguments of function nodes
+ */
+static inline double node_eval(const struct node *const n, const uint32_t *const args, const double *const val, const struct xpr_fun *const funs, void *const argv)
+{
+#	define A(i) (val[n->data.arg[i]])
+	switch (n->op) {
+	case OP_CONST: return n->data.value;
+	case OP_NEG:   return -A(0);
+	case OP_ADD:   return A(0) + A(1);
+	case OP_SUB:   return A(0) - A(1);
+	case OP_MUL:   return A(0) * A(1);
+	case OP_DIV:   return DIV_OK(A(0), A(1)) ? A(0) / A(1) : XPR_ERR;
+	case OP_POW:   return POW_OK(A(0), A(1)) ? pow(A(0), A(1)) : XPR_ERR;
+	case OP_FUN:   return node_fun(n, args, val, funs, argv);
+	case OP_LT:    return CMP(A(0), A(1), <);
+	case OP_LE:    return CMP(A(0), A(1), <=);
+	case OP_GT:    return CMP(A(0), A(1), >);
+	case OP_GE:    return CMP(A(0), A(1), >=);
+	case OP_EQ:    return CMP(A(0), A(1), ==);
+	case OP_NE:    return CMP(A(0), A(1), !=);
+	case OP_AND:   return LOGIC(A(0), A(1), &);
+	case OP_OR:    return LOGIC(A(0), A(1), |);
+	case OP_NOT:   return NOT(A(0));
+	default:
+		assert(0 || !!! "invalid node");
+		return XPR_ERR;
+	}
+#	undef A
+}
+
+static inline void prog_run(const struct xpr_prog *const prog, double *const val, const double *const values, void *const argv)
+{
+	const struct node *const nodes = prog_nodes(prog);
+	const uint32_t *const args = prog_args(prog);
+	for (size_t i = 0; i < prog->nnodes; i++) {
+		if (OP_VAR == nodes[i].op)
+			val[i] = values ? values[nodes[i].data.slot] : XPR_ERR;
+		else
+			val[i] = node_eval(&nodes[i], args, val, prog->ext.funs, argv);
+	}
+}
+
+/*
+ * set the values of a new workspace, where all variables are undefined
+ *
+ * The nodes that depend on user-defined functions are undefined as well, since
+ * the callbacks may be impure and must only run when the caller evaluates the
+ * program. The array user has room for a flag per node.
+ */
+static inline void prog_init(const struct xpr_prog *const prog, double *const val, bool *const user, void *const argv)
+{
+	const struct node *const nodes = prog_nodes(prog);
+	const uint32_t *const args = prog_args(prog);
+	for (size_t i = 0; i < prog->nnodes; i++) {
+		const struct node *const n = &nodes[i];
+		user[i] = (OP_FUN == n->op) && (n->data.arg[1] >= FUN_USER);
+		for (size_t k = 0; k < n->nargs; k++)
+			user[i] |= user[node_arg(n, args, k)];
+		if ((OP_VAR == n->op) || user[i])
+			val[i] = XPR_ERR;
+		else
+			val[i] = node_eval(n, args, val, prog->ext.funs, argv);
+	}
+}
+
+/*
+ * evaluate the rows from first to last, with room for a block per node in blk
+ */
+static inline void prog_run_rows(const struct xpr_prog *const prog, double *const blk, const double *const *const cols, size_t first, size_t last, double *const *const out, void *const argv)
+{
+	for (; first < last; first += BLOCK) {
+		const size_t rows = (last - first < BLOCK) ? last - first : BLOCK;
+		prog_run_block(prog, blk, cols, first, rows, argv);
+		for (size_t r = 0; r < prog->nroots; r++) {
+			const double *const res = &blk[prog_roots(prog)[r] * (size_t) BLOCK];
+			for (size_t j = 0; j < rows; j++)
+				out[r][first + j] = isnan(res[j]) ? XPR_ERR : res[j];
+		}
+	}
+}
+
+/*
+ * a named definition of a program, i.e., <name> = <expr>
+ */
+struct def {
+	const char *name;
+	size_t len;
+	const char *expr;
+	uint32_t node;       // the root node of expr, or NONE until compiled
+};
+
+/*
+ * a hash table of the names of definitions
+ */
+struct def_index {
+	struct def *defs;
+	size_t ndefs;
+	uint32_t *slot;      // the index of a definition, or NONE
+	size_t cap;          // a power of two
+};
+
+static inline uint64_t name_hash(const char *name, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ (unsigned char) name[i]) * 0x100000001b3ULL;
+	return h ^ (h >> 32);
+}
+
+static inline bool def_index_init(struct def_index *const ix, struct def *const defs)
+{
+	ix->defs = defs;
+	ix->ndefs = 0;
+	ix->cap = 16;
+	if (!(ix->slot = malloc(ix->cap * sizeof(uint32_t))))
+		return false;
+	memset(ix->slot, 0xff, ix->cap * sizeof(uint32_t));
+	return true;
+}
+
+static inline uint32_t *def_index_slot(const struct def_index *const ix, const char *name, size_t len)
+{
+	size_t k = name_hash(name, len) & (ix->cap - 1);
+	for (; NONE != ix->slot[k]; k = (k + 1) & (ix->cap - 1)) {
+		const struct def *const d = &ix->defs[ix->slot[k]];
+		if ((d->len == len) && (0 == memcmp(d->name, name, len)))
+			break;
+	}
+	return &ix->slot[k];
+}
+
+static inline struct def *def_index_find(const struct def_index *const ix, const char *name, size_t len)
+{
+	const uint32_t i = ix ? *def_index_slot(ix, name, len) : NONE;
+	return (NONE == i) ? NULL : &ix->defs[i];
+}
+
+/*
+ * add the next definition of the array, returns false for a duplicate name
+ * and sets *failed without memory
+ */
+static inline bool def_index_add(struct def_index *const ix, bool *const failed)
+{
+	if (2 * (ix->ndefs + 1) > ix->cap) {
+		uint32_t *old = ix->slot;
+		const size_t oldcap = ix->cap;
+		if (!(ix->slot = malloc(2 * oldcap * sizeof(uint32_t)))) {
+			ix->slot = old;
+			*failed = true;
+			return false;
+		}
+		ix->cap = 2 * oldcap;
+		memset(ix->slot, 0xff, ix->cap * sizeof(uint32_t));
+		for (size_t k = 0; k < oldcap; k++)
+			if (NONE != old[k])
+				*def_index_slot(ix, ix->defs[old[k]].name, ix->defs[old[k]].len) = old[k];
+		free(old);
+	}
+	const struct def *const d = &ix->defs[ix->ndefs];
+	uint32_t *const slot = def_index_slot(ix, d->name, d->len);
+	if (NONE != *slot)
+		return false;
+	*slot = ix->ndefs++;
+	return true;
+}
+
+/*
+ * the program builder
+ *
+ * The parser emits nodes to the builder. Nodes with constant operands are
+ * evaluated immediately, and each variable slot has at most one node. A hash
+ * table of all other nodes finds existing nodes with the same operation and
+ * the same operands, so the builder never emits duplicates.
+ */
+struct build {
+	struct node *nodes;
+	double *val;         // the value of constant nodes
+	size_t nnodes;
+	size_t nodecap;
+	uint32_t *args;
+	size_t nargs;
+	size_t argcap;
+	uint32_t *varnode;
+	size_t nvars;
+	const struct def_index *defs;  // the definitions of the program, or NULL
+	const struct xpr_fun *funs;
+	uint32_t *hash;
+	size_t hashcap;      // a power of two, or 0
+	double *argv;        // the arguments of folded function calls
+	size_t argvcap;
+	size_t nhashed;
+	bool poly;           // whether to rewrite power series into poly()
+	bool failed;
+};
+
+static inline void build_init(struct build *const bld, const var *const vars, const struct xpr_fun *const funs)
+{
+	memset(bld, 0, sizeof(*bld));
+	bld->funs = funs;
+	size_t nvars = 0;
+	while (vars && vars[nvars].name)
+		nvars++;
+	bld->nvars = nvars;
+	bld->varnode = malloc((nvars + 1) * sizeof(uint32_t));
+	if (!bld->varnode || nvars >= NONE) {
+		bld->failed = true;
+		return;
+	}
+	for (size_t i = 0; i < nvars; i++)
+		bld->varnode[i] = NONE;
+}
+
+static inline void build_free(struct build *const bld)
+{
+	free(bld->nodes);
+	free(bld->val);
+	free(bld->args);
+	free(bld->varnode);
+	free(bld->hash);
+	free(bld->argv);
+}
+
+static inline bool build_grow(void **const arr, size_t *const cap, size_t need, size_t elemsz)
+{
+	if (need <= *cap)
+		return true;
+	size_t newcap = *cap ? *cap : 16;
+	while (newcap < need)
+		newcap *= 2;
+	if (newcap >= NONE || newcap > SIZE_MAX / elemsz)
+		return false;
+	void *p = realloc(*arr, newcap * elemsz);
+	if (!p)
+		return false;
+	*arr = p;
+	*cap = newcap;
+	return true;
+}
+
+static inline uint32_t build_push(struct build *const bld, const struct node *const n, double value)
+{
+	if (bld->failed)
+		return 0;
+	size_t cap = bld->nodecap;
+	if (!build_grow((void **) &bld->nodes, &bld->nodecap, bld->nnodes + 1, sizeof(struct node))
+	 || !build_grow((void **) &bld->val, &cap, bld->nnodes + 1, sizeof(double))) {
+		bld->failed = true;
+		return 0;
+	}
+	bld->nodes[bld->nnodes] = *n;
+	bld->val[bld->nnodes] = value;
+	return bld->nnodes++;
+}
+
+static inline uint64_t node_hash(const struct node *const n, const uint32_t *const args)
+{
+#	define MIX(h, v) (((h) ^ (v)) * 0xff51afd7ed558ccdULL)
+	uint64_t h = MIX(n->op, n->nargs);
+	if (OP_CONST == n->op) {
+		uint64_t bits;
+		memcpy(&bits, &n->data.value, sizeof(bits));
+		h = MIX(h, bits);
+	} else if (OP_FUN == n->op) {
+		h = MIX(h, n->data.arg[1]);
+	}
+	for (size_t i = 0; i < n->nargs; i++)
+		h = MIX(h, node_arg(n, args, i));
+	return h ^ (h >> 32);
+#	undef MIX
+}
+
+static inline bool node_same(const struct node *const a, const struct node *const b, const uint32_t *const args)
+{
+	if ((a->op != b->op) || (a->nargs != b->nargs))
+		return false;
+	if (OP_CONST == a->op)
+		return 0 == memcmp(&a->data.value, &b->data.value, sizeof(double));
+	if ((OP_FUN == a->op) && (a->data.arg[1] != b->data.arg[1]))
+		return false;
+	for (size_t i = 0; i < a->nargs; i++)
+		if (node_arg(a, args, i) != node_arg(b, args, i))
+			return false;
+	return true;
+}
+
+static inline bool build_rehash(struct build *const bld)
+{
+	size_t cap = bld->hashcap ? 2 * bld->hashcap : 64;
+	uint32_t *hash = malloc(cap * sizeof(uint32_t));
+	if (!hash)
+		return false;
+	for (size_t i = 0; i < cap; i++)
+		hash[i] = NONE;
+	for (size_t i = 0; i < bld->hashcap; i++) {
+		uint32_t id = bld->hash[i];
+		if (NONE == id)
+			continue;
+		size_t k = node_hash(&bld->nodes[id], bld->args) & (cap - 1);
+		while (NONE != hash[k])
+			k = (k + 1) & (cap - 1);
+		hash[k] = id;
+	}
+	free(bld->hash);
+	bld->hash = hash;
+	bld->hashcap = cap;
+	return true;
+}
+
+/*
+ * emit a node, unless an identical node exists
+ *
+ * For function nodes, the arguments are the last entries in bld->args.
+ */
+static inline uint32_t build_intern(struct build *const bld, const struct node *const n, double value)
+{
+	if (bld->failed)
+		return 0;
+	if ((2 * (bld->nhashed + 1) > bld->hashcap) && !build_rehash(bld)) {
+		bld->failed = true;
+		return 0;
+	}
+	size_t k = node_hash(n, bld->args) & (bld->hashcap - 1);
+	for (; NONE != bld->hash[k]; k = (k + 1) & (bld->hashcap - 1)) {
+		uint32_t id = bld->hash[k];
+		if (node_same(&bld->nodes[id], n, bld->args)) {
+			if (OP_FUN == n->op)
+				bld->nargs -= n->nargs;
+			return id;
+		}
+	}
+	uint32_t id = build_push(bld, n, value);
+	if (!bld->failed) {
+		bld->hash[k] = id;
+		bld->nhashed++;
+	}
+	return id;
+}
+
+static inline uint32_t build_const(struct build *const bld, double value)
+{
+	struct node n = { .op = OP_CONST, .nargs = 0, .data.value = value };
+	return build_intern(bld, &n, value);
+}
+
+static inline uint32_t build_var(struct build *const bld, uint32_t slot)
+{
+	if (NONE == bld->varnode[slot]) {
+		struct node n = { .op = OP_VAR, .nargs = 0, .data.slot = slot };
+		bld->varnode[slot] = build_push(bld, &n, XPR_ERR);
+	}
+	return bld->varnode[slot];
+}
+
+/*
+ * emit a node, or a constant when all operands are constant
+ *
+ * Calls of impure functions always need a separate node.
+ */
+static inline uint32_t build_fold(struct build *const bld, const struct node *const n)
+{
+	if (bld->failed)
+		return 0;
+	if ((OP_FUN == n->op) && (n->data.arg[1] >= FUN_USER) && !(bld->funs[n->data.arg[1] - FUN_USER].flags & XPR_FUN_PURE))
+		return build_push(bld, n, XPR_ERR);
+	// in streams, window functions of constants are not constant
+	if ((OP_FUN == n->op) && IS_WINDOW(n->data.arg[1]))
+		return build_intern(bld, n, XPR_ERR);
+	for (size_t i = 0; i < n->nargs; i++)
+		if (OP_CONST != bld->nodes[node_arg(n, bld->args, i)].op)
+			return build_intern(bld, n, XPR_ERR);
+	if (!build_grow((void **) &bld->argv, &bld->argvcap, n->nargs + 1, sizeof(double))) {
+		bld->failed = true;
+		return 0;
+	}
+	double value = node_eval(n, bld->args, bld->val, bld->funs, bld->argv);
+	if (OP_FUN == n->op)
+		bld->nargs -= n->nargs;
+	return build_const(bld, value);
+}
+
+// the highest degree of power series, and the nesting of sums within a term
+#define POLY_MAX         32
+#define POLY_DEPTH       16
+
+/*
+ * get a monomial x^k, where x is not a constant
+ */
+static inline void build_mono(const struct build *const bld, uint32_t id, uint32_t *const x, size_t *const k)
+{
+	const struct node *const n = &bld->nodes[id];
+	*x = id;
+	*k = 1;
+	if ((OP_POW == n->op) && (OP_CONST == bld->nodes[n->data.arg[1]].op)) {
+		const double e = bld->nodes[n->data.arg[1]].data.value;
+		if ((e >= 2) && (e <= POLY_MAX) && (e == (size_t) e)) {
+			*x = n->data.arg[0];
+			*k = e;
+		}
+	}
+}
+
+/*
+ * add the terms of node id, times sign, to the coefficients of a power series
+ *   in x, where x is NONE until the first monomial
+ */
+static inline bool build_terms(const struct build *const bld, uint32_t id, double sign, uint32_t *const x, double *const c, int depth)
+{
+	const struct node *const n = &bld->nodes[id];
+	const uint32_t *const a = n->data.arg;
+	uint32_t base;
+	size_t k;
+	double coef = sign;
+	switch (n->op) {
+	case OP_CONST:
+		c[0] += sign * n->data.value;
+		return true;
+	case OP_NEG:
+		return depth && build_terms(bld, a[0], -sign, x, c, depth - 1);
+	case OP_ADD:
+	case OP_SUB:
+		return depth && build_terms(bld, a[0], sign, x, c, depth - 1)
+		             && build_terms(bld, a[1], (OP_SUB == n->op) ? -sign : sign, x, c, depth - 1);
+	case OP_FUN:
+		if ((FUNID(TK_FUN_POLY) != a[1]) || (n->nargs < 2) || (n->nargs > POLY_MAX + 2))
+			break;
+		base = bld->args[a[0]];
+		if ((NONE != *x) && (*x != base))
+			return false;
+		for (size_t i = 1; i < n->nargs; i++)
+			if (OP_CONST != bld->nodes[bld->args[a[0] + i]].op)
+				return false;
+		*x = base;
+		for (size_t i = 1; i < n->nargs; i++)
+			c[i - 1] += sign * bld->nodes[bld->args[a[0] + i]].data.value;
+		return true;
+	case OP_MUL:
+		// a constant times a monomial
+		if (OP_CONST == bld->nodes[a[0]].op) {
+			coef *= bld->nodes[a[0]].data.value;
+			id = a[1];
+		} else if (OP_CONST == bld->nodes[a[1]].op) {
+			coef *= bld->nodes[a[1]].data.value;
+			id = a[0];
+		}
+		break;
+	}
+	build_mono(bld, id, &base, &k);
+	if ((NONE != *x) && (*x != base))
+		return false;
+	*x = base;
+	c[k] += coef;
+	return true;
+}
+
+/*
+ * rewrite a sum of a power series into poly(), or NONE
+ */
+static inline uint32_t build_poly(struct build *const bld, uint32_t op, uint32_t l, uint32_t r)
+{
+	double c[POLY_MAX + 1] = { 0 };
+	uint32_t x = NONE;
+	if (!build_terms(bld, l, 1, &x, c, POLY_DEPTH) || !build_terms(bld, r, (OP_SUB == op) ? -1 : 1, &x, c, POLY_DEPTH))
+		return NONE;
+	size_t deg = POLY_MAX;
+	while (deg && (0 == c[deg]))
+		deg--;
+	if ((deg < 2) || (NONE == x))
+		return NONE;
+	uint32_t coef[POLY_MAX + 1];
+	for (size_t i = 0; i <= deg; i++)
+		coef[i] = build_const(bld, c[i]);
+	if (bld->failed || !build_grow((void **) &bld->args, &bld->argcap, bld->nargs + deg + 2, sizeof(uint32_t))) {
+		bld->failed = true;
+		return 0;
+	}
+	struct node n = { .op = OP_FUN, .nargs = deg + 2, .data.arg = { bld->nargs, FUNID(TK_FUN_POLY) } };
+	bld->args[bld->nargs++] = x;
+	for (size_t i = 0; i <= deg; i++)
+		bld->args[bld->nargs++] = coef[i];
+	return build_fold(bld, &n);
+}
+
+static inline uint32_t build_op(struct build *const bld, uint32_t op, uint32_t l, uint32_t r)
+{
+	if (OP_POS == op)
+		return l;
+	if (bld->poly && ((OP_ADD == op) || (OP_SUB == op))) {
+		const uint32_t p = build_poly(bld, op, l, r);
+		if (NONE != p)
+			return p;
+	}
+	// the order of operands does not matter for commutative operators
+	const bool commutative = (OP_ADD == op) || (OP_MUL == op) || (OP_EQ == op) || (OP_NE == op) || (OP_AND == op) || (OP_OR == op);
+	if (commutative && (r < l)) {
+		uint32_t tmp = l;
+		l = r;
+		r = tmp;
+	}
+	struct node n = { .op = op, .nargs = OP_NARGS(op), .data.arg = { l, r } };
+	return build_fold(bld, &n);
+}
+
+static inline uint32_t build_fun(struct build *const bld, int funid, size_t nargs, const tok *const ap)
+{
+	// braces around a single value do not need a node
+	if ((FUNID(TK_FUN_NONE) == funid) && (1 == nargs))
+		return ap[0].data.node;
+	if (bld->failed || !build_grow((void **) &bld->args, &bld->argcap, bld->nargs + nargs, sizeof(uint32_t))) {
+		bld->failed = true;
+		return 0;
+	}
+	struct node n = { .op = OP_FUN, .nargs = nargs, .data.arg = { bld->nargs, funid } };
+	for (size_t i = 0; i < nargs; i++)
+		bld->args[bld->nargs++] = ap[2*i].data.node;
+	return build_fold(bld, &n);
+}
+
+/*
+ * create the program from the nodes that the roots depend on
+ */
+static inline struct xpr_prog *build_prog(struct build *const bld, const uint32_t *const roots, size_t nroots)
+{
+	const size_t nnodes = bld->nnodes;
+	struct xpr_prog *prog = NULL;
+	uint32_t *map = malloc((nnodes + 1) * sizeof(uint32_t));
+	uint8_t *mark = malloc(nnodes + 1);
+	uint32_t *deps = NULL;
+	size_t ndeps = 0, depcap = 0;
+	if (!map || !mark)
+		goto out;
+
+	// find the live nodes, and number them in order
+	memset(mark, 0, nnodes);
+	for (size_t r = 0; r < nroots; r++)
+		mark[roots[r]] = 1;
+	for (size_t i = nnodes; i-- > 0;)
+		if (mark[i])
+			for (size_t k = 0; k < bld->nodes[i].nargs; k++)
+				mark[node_arg(&bld->nodes[i], bld->args, k)] = 1;
+	size_t nlive = 0, nargs = 0;
+	for (size_t i = 0; i < nnodes; i++) {
+		map[i] = mark[i] ? nlive++ : NONE;
+		if (mark[i] && (OP_FUN == bld->nodes[i].op))
+			nargs += bld->nodes[i].nargs;
+	}
+
+	// find the nodes that depend on each variable, using the new numbers
+	uint32_t *depoff = malloc((bld->nvars + 1) * sizeof(uint32_t));
+	if (!depoff)
+		goto out;
+	for (size_t slot = 0; slot < bld->nvars; slot++) {
+		depoff[slot] = ndeps;
+		const uint32_t v = bld->varnode[slot];
+		if ((NONE == v) || (NONE == map[v]))
+			continue;
+		memset(mark, 0, nnodes);
+		mark[v] = 1;
+		for (size_t i = v + 1; i < nnodes; i++) {
+			if (NONE == map[i])
+				continue;
+			for (size_t k = 0; k < bld->nodes[i].nargs; k++)
+				mark[i] |= mark[node_arg(&bld->nodes[i], bld->args, k)];
+			if (!mark[i])
+				continue;
+			if (!build_grow((void **) &deps, &depcap, ndeps + 1, sizeof(uint32_t)))
+				goto out_depoff;
+			deps[ndeps++] = map[i];
+		}
+	}
+	depoff[bld->nvars] = ndeps;
+
+	prog = malloc(prog_size(nlive, nargs, nroots, bld->nvars, ndeps));
+	if (!prog)
+		goto out_depoff;
+	prog->nnodes = nlive;
+	prog->nargs = nargs;
+	prog->nvars = bld->nvars;
+	prog->ndeps = ndeps;
+	prog->nroots = nroots;
+	prog->reserved = 0;
+	prog->ext.funs = NULL;
+
+	struct node *nodes = prog_nodes(prog);
+	uint32_t *args = prog_args(prog);
+	size_t a = 0;
+	for (size_t i = 0; i < nnodes; i++) {
+		if (NONE == map[i])
+			continue;
+		struct node n = bld->nodes[i];
+		if (OP_FUN == n.op) {
+			for (size_t k = 0; k < n.nargs; k++)
+				args[a + k] = map[node_arg(&n, bld->args, k)];
+			n.data.arg[0] = a;
+			a += n.nargs;
+			// only programs that call user-defined functions refer to them
+			if (n.data.arg[1] >= FUN_USER)
+				prog->ext.funs = bld->funs;
+		} else if (OP_CONST != n.op && OP_VAR != n.op) {
+			for (size_t k = 0; k < n.nargs; k++)
+				n.data.arg[k] = map[n.data.arg[k]];
+		}
+		nodes[map[i]] = n;
+	}
+	for (size_t r = 0; r < nroots; r++)
+		prog_roots(prog)[r] = map[roots[r]];
+	for (size_t slot = 0; slot < bld->nvars; slot++) {
+		const uint32_t v = bld->varnode[slot];
+		prog_varnode(prog)[slot] = (NONE == v) ? NONE : map[v];
+	}
+	memcpy(prog_depoff(prog), depoff, (bld->nvars + 1) * sizeof(uint32_t));
+	if (ndeps)
+		memcpy(prog_deps(prog), deps, ndeps * sizeof(uint32_t));
+
+out_depoff:
+	free(depoff);
+out:
+	free(deps);
+	free(mark);
+	free(map);
+	if (!prog)
+		bld->failed = true;
+	return prog;
+}
@@ -0,0 +1,253 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+
+/*
+ * rules.h
+ *
+ * This file implements sets of rules, i.e., many expressions for the same
+ * record. Each rule is compiled on its own, and its constants become
+ * parameters, i.e., variables after the variables of the record. Rules with
+ * the same parameterized program form a group, which keeps one program and a
+ * column of values per parameter. A group is evaluated like a batch, with a
+ * row per rule, where the variables of the record are constant columns. The
+ * nodes that do not depend on varying parameters are known at compile time,
+ * and each evaluation computes them once for all rules of the group.
+ */
+
+struct rule_group {
+	struct xpr_prog *prog;   // the parameterized program
+	struct xpr_ws *ws;
+	size_t nparams;
+	double *params;          // while compiling, the parameters of each rule,
+	                         // afterwards, the column of each parameter
+	size_t paramcap;
+	size_t *rules;           // the index of each rule in the set
+	size_t nrules;
+	size_t rulecap;
+	const double **cols;     // the columns of the variables and the parameters
+	uint32_t *order;         // the nodes for all rules, then the nodes per rule
+	size_t nconst;           // the number of nodes for all rules
+};
+
+struct xpr_rules {
+	size_t nrules;
+	size_t nvars;
+	size_t ngroups;
+	struct rule_group *groups;
+};
+
+/*
+ * turn the constants of a program into parameters, except the sizes of windows
+ */
+static inline struct xpr_prog *rule_param(const struct xpr_prog *const prog, double *const params, size_t *const nparams)
+{
+	const struct node *const nodes = prog_nodes(prog);
+	const uint32_t *const args = prog_args(prog);
+	struct xpr_prog *res = NULL;
+	bool *keep = calloc(prog->nnodes + 1, sizeof(bool));
+	if (!keep)
+		return NULL;
+	size_t np = 0;
+	for (size_t i = 0; i < prog->nnodes; i++)
+		if ((OP_FUN == nodes[i].op) && IS_WINDOW(nodes[i].data.arg[1]))
+			keep[node_arg(&nodes[i], args, 1)] = true;
+	for (size_t i = 0; i < prog->nnodes; i++)
+		np += (OP_CONST == nodes[i].op) && !keep[i];
+
+	struct build bld;
+	memset(&bld, 0, sizeof(bld));
+	bld.funs = prog->ext.funs;
+	bld.nvars = prog->nvars + np;
+	bld.nnodes = prog->nnodes;
+	bld.nargs = prog->nargs;
+	bld.varnode = malloc((bld.nvars + 1) * sizeof(uint32_t));
+	bld.nodes = malloc((bld.nnodes + 1) * sizeof(struct node));
+	bld.args = malloc((bld.nargs + 1) * sizeof(uint32_t));
+	if (!bld.varnode || !bld.nodes || !bld.args)
+		goto out;
+	memcpy(bld.varnode, prog_varnode(prog), prog->nvars * sizeof(uint32_t));
+	memcpy(bld.args, args, prog->nargs * sizeof(uint32_t));
+	np = 0;
+	for (size_t i = 0; i < prog->nnodes; i++) {
+		bld.nodes[i] = nodes[i];
+		if ((OP_CONST != nodes[i].op) || keep[i])
+			continue;
+		params[np] = nodes[i].data.value;
+		bld.nodes[i] = (struct node) { .op = OP_VAR, .nargs = 0, .data.slot = prog->nvars + np };
+		bld.varnode[prog->nvars + np++] = i;
+	}
+	if ((res = build_prog(&bld, prog_roots(prog), prog->nroots)))
+		res->ext.funs = prog->ext.funs;
+	*nparams = np;
+out:
+	build_free(&bld);
+	free(keep);
+	return res;
+}
+
+static inline uint64_t rule_hash(const struct xpr_prog *const prog)
+{
+#	define MIX(h, v) (((h) ^ (v)) * 0xff51afd7ed558ccdULL)
+	const struct node *const nodes = prog_nodes(prog);
+	const uint32_t *const args = prog_args(prog);
+	uint64_t h = MIX(prog->nnodes, prog->nvars);
+	for (size_t i = 0; i < prog->nnodes; i++) {
+		const struct node *const n = &nodes[i];
+		h = MIX(h, n->op);
+		if (OP_CONST == n->op) {
+			uint64_t bits;
+			memcpy(&bits, &n->data.value, sizeof(bits));
+			h = MIX(h, bits);
+		} else if (OP_VAR == n->op) {
+			h = MIX(h, n->data.slot);
+		} else if (OP_FUN == n->op) {
+			h = MIX(h, n->data.arg[1]);
+		}
+		for (size_t k = 0; k < n->nargs; k++)
+			h = MIX(h, node_arg(n, args, k));
+	}
+	for (size_t r = 0; r < prog->nroots; r++)
+		h = MIX(h, prog_roots(prog)[r]);
+	return h ^ (h >> 32);
+#	undef MIX
+}
+
+/*
+ * whether two parameterized programs are the same
+ */
+static inline bool rule_same(const struct xpr_prog *const a, const struct xpr_prog *const b)
+{
+	if ((a->nnodes != b->nnodes) || (a->nvars != b->nvars) || (a->nroots != b->nroots) || (a->ext.funs != b->ext.funs))
+		return false;
+	const struct node *const na = prog_nodes(a), *const nb = prog_nodes(b);
+	for (size_t i = 0; i < a->nnodes; i++) {
+		if ((na[i].op != nb[i].op) || (na[i].nargs != nb[i].nargs))
+			return false;
+		if ((OP_CONST == na[i].op) && memcmp(&na[i].data.value, &nb[i].data.value, sizeof(double)))
+			return false;
+		if ((OP_VAR == na[i].op) && (na[i].data.slot != nb[i].data.slot))
+			return false;
+		if ((OP_FUN == na[i].op) && (na[i].data.arg[1] != nb[i].data.arg[1]))
+			return false;
+		for (size_t k = 0; k < na[i].nargs; k++)
+			if (node_arg(&na[i], prog_args(a), k) != node_arg(&nb[i], prog_args(b), k))
+				return false;
+	}
+	return 0 == memcmp(prog_roots(a), prog_roots(b), a->nroots * sizeof(uint32_t));
+}
+
+/*
+ * add a rule to a group, with the parameters of the rule
+ */
+static inline bool rule_add(struct rule_group *const g, size_t rule, const double *const params)
+{
+	if (!build_grow((void **) &g->rules, &g->rulecap, g->nrules + 1, sizeof(size_t))
+	 || !build_grow((void **) &g->params, &g->paramcap, (g->nrules + 1) * g->nparams + 1, sizeof(double)))
+		return false;
+	g->rules[g->nrules] = rule;
+	memcpy(&g->params[g->nrules * g->nparams], params, g->nparams * sizeof(double));
+	g->nrules++;
+	return true;
+}
+
+/*
+ * transpose the parameters into columns, and prepare the evaluation
+ *
+ * A parameter with the same value in all rules is a constant column, and the
+ * nodes that only depend on constant columns are computed once for all rules.
+ */
+static inline bool rule_finish(struct rule_group *const g, size_t nvars)
+{
+	const struct xpr_prog *const prog = g->prog;
+	const size_t m = g->nrules, np = g->nparams;
+	bool ok = false;
+	double *cols = malloc((m * np + 1) * sizeof(double));
+	struct xpr_column *kinds = calloc(nvars + np + 1, sizeof(struct xpr_column));
+	uint32_t *kind = malloc((prog->nnodes + 1) * sizeof(uint32_t));
+	bool *need = malloc(prog->nnodes + 1);
+	g->cols = calloc(nvars + np + 1, sizeof(double *));
+	g->order = malloc((prog->nnodes + 1) * sizeof(uint32_t));
+	g->ws = xpr_ws_new(prog);
+	if (!cols || !kinds || !kind || !need || !g->cols || !g->order || !g->ws
+	 || !(g->ws->blk = malloc(prog->nnodes * BLOCK * sizeof(double)))) {
+		free(cols);
+		goto out;
+	}
+	for (size_t p = 0; p < np; p++) {
+		bool same = true;
+		for (size_t k = 0; k < m; k++) {
+			cols[p * m + k] = g->params[k * np + p];
+			same &= (0 == memcmp(&cols[p * m + k], &cols[p * m], sizeof(double)));
+		}
+		kinds[nvars + p].kind = same ? XPR_COL_CONST : XPR_COL_PLAIN;
+		g->cols[nvars + p] = &cols[p * m];
+	}
+	for (size_t s = 0; s < nvars; s++)
+		kinds[s].kind = XPR_COL_CONST;
+	free(g->params);
+	g->params = cols;
+
+	// without dictionary columns, each node is constant or varies by rule
+	dict_classify(prog, kinds, m, kind, need);
+	for (size_t i = 0; i < prog->nnodes; i++)
+		if (KIND_CONST == kind[i])
+			g->order[g->nconst++] = i;
+	for (size_t i = 0, k = g->nconst; i < prog->nnodes; i++)
+		if (KIND_CONST != kind[i])
+			g->order[k++] = i;
+	ok = true;
+out:
+	free(need);
+	free(kind);
+	free(kinds);
+	return ok;
+}
+
+/*
+ * evaluate the rules of a group, where the columns of the variables of the
+ * record point to their values
+ */
+static inline void rule_run(const struct rule_group *const g, double *const out)
+{
+	const struct xpr_prog *const prog = g->prog;
+	double *const blk = g->ws->blk;
+	const double *const res = &blk[prog_roots(prog)[0] * (size_t) BLOCK];
+	for (size_t k = 0; k < g->nconst; k++) {
+		double *const v = &blk[g->order[k] * (size_t) BLOCK];
+		node_run_block(prog, g->order[k], blk, g->cols, 0, 1, g->ws->argv);
+		for (size_t j = 1; j < BLOCK; j++)
+			v[j] = v[0];
+	}
+	for (size_t first = 0; first < g->nrules; first += BLOCK) {
+		const size_t rows = (g->nrules - first < BLOCK) ? g->nrules - first : BLOCK;
+		for (size_t k = g->nconst; k < prog->nnodes; k++)
+			node_run_block(prog, g->order[k], blk, g->cols, first, rows, g->ws->argv);
+		for (size_t j = 0; j < rows; j++)
+			out[g->rules[first + j]] = isnan(res[j]) ? XPR_ERR : res[j];
+	}
+}
@@ -0,0 +1,202 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+/*
+ * run.h
+ *
+ * This file implements the evaluation of function nodes and the batch
+ * evaluation of programs. It is included once for each precision, and the
+ * including file defines:
+ *
+ *  RUN(name)          the name of a function or table for this precision
+ *  REAL               the type of the values
+ *  MATH(name)         the math library function for REAL
+ *  PFUN(name)         the fun.h implementation of name for REAL
+ *  USER(f, n, av, dv) the call of a user-defined function f, where dv has room
+ *                     for a double copy of the arguments
+ *  BATCH              whether batch variants of user-defined functions apply
+ */
+
+typedef REAL (*RUN(pfun))(size_t nargs, const REAL *args);
+
+static const RUN(pfun) RUN(pfuns)[] = {
+	[FUNID(TK_FUN_NONE)]  = PFUN(identity),
+	[FUNID(TK_FUN_ACOS)]  = PFUN(acos),
+	[FUNID(TK_FUN_ACOSH)] = PFUN(acosh),
+	[FUNID(TK_FUN_ASIN)]  = PFUN(asin),
+	[FUNID(TK_FUN_ASINH)] = PFUN(asinh),
+	[FUNID(TK_FUN_ATAN)]  = PFUN(atan),
+	[FUNID(TK_FUN_ATANH)] = PFUN(atanh),
+	[FUNID(TK_FUN_CBRT)]  = PFUN(cbrt),
+	[FUNID(TK_FUN_CEIL)]  = PFUN(ceil),
+	[FUNID(TK_FUN_COS)]   = PFUN(cos),
+	[FUNID(TK_FUN_COSH)]  = PFUN(cosh),
+	[FUNID(TK_FUN_EXP)]   = PFUN(exp),
+	[FUNID(TK_FUN_FLOOR)] = PFUN(floor),
+	[FUNID(TK_FUN_LOG)]   = PFUN(log),
+	[FUNID(TK_FUN_MAX)]   = PFUN(max),
+	[FUNID(TK_FUN_MIN)]   = PFUN(min),
+	[FUNID(TK_FUN_ROUND)] = PFUN(round),
+	[FUNID(TK_FUN_SCALE)] = PFUN(scale),
+	[FUNID(TK_FUN_SIN)]   = PFUN(sin),
+	[FUNID(TK_FUN_SINH)]  = PFUN(sinh),
+	[FUNID(TK_FUN_SQRT)]  = PFUN(sqrt),
+	[FUNID(TK_FUN_SUM)]   = PFUN(sum),
+	[FUNID(TK_FUN_TAN)]   = PFUN(tan),
+	[FUNID(TK_FUN_TANH)]  = PFUN(tanh),
+	[FUNID(TK_FUN_SELECT)] = PFUN(select),
+	[FUNID(TK_FUN_WSUM)]  = PFUN(wsum),
+	[FUNID(TK_FUN_WMIN)]  = PFUN(wmin),
+	[FUNID(TK_FUN_WMAX)]  = PFUN(wmax),
+	[FUNID(TK_FUN_WAVG)]  = PFUN(wavg),
+	[FUNID(TK_FUN_LAG)]   = PFUN(lag),
+	[FUNID(TK_FUN_POLY)]  = PFUN(poly),
+};
+
+static inline REAL RUN(fun_call)(const struct xpr_fun *const funs, uint32_t funid, size_t nargs, const REAL *const av, double *const dv)
+{
+	if (funid < FUN_USER)
+		return RUN(pfuns)[funid](nargs, av);
+	const struct xpr_fun *const f = &funs[funid - FUN_USER];
+	return USER(f, nargs, av, dv);
+}
+
+/*
+ * compute a function node for a block of rows
+ *
+ * The batch variant of a user-defined function computes all rows at once,
+ * otherwise, each row is a separate call. The arguments are gathered in argv,
+ * the scratch space of the workspace.
+ */
+static inline void RUN(block_fun)(const struct node *const n, const uint32_t *const args, const REAL *const blk, size_t rows, const struct xpr_fun *const funs, REAL *const out, void *const argv)
+{
+	const size_t nargs = n->nargs;
+	const uint32_t *const a = &args[n->data.arg[0]];
+	const uint32_t funid = n->data.arg[1];
+	if ((FUNID(TK_FUN_SELECT) == funid) && (3 == nargs)) {
+		// blend both branches, without branches
+		const REAL *const c = &blk[a[0] * BLOCK];
+		const REAL *const x = &blk[a[1] * BLOCK];
+		const REAL *const y = &blk[a[2] * BLOCK];
+		for (size_t j = 0; j < rows; j++)
+			out[j] = (isnan(c[j]) | isnan(x[j]) | isnan(y[j])) ? XPR_ERR : (0 != c[j]) ? x[j] : y[j];
+		return;
+	}
+	if ((FUNID(TK_FUN_POLY) == funid) && (nargs >= 2)) {
+		// Horner's scheme in each row, where the rows fill the vectors
+		const REAL *const x = &blk[a[0] * BLOCK];
+		const REAL *const c = &blk[a[nargs - 1] * BLOCK];
+		for (size_t j = 0; j < rows; j++)
+			out[j] = c[j];
+		for (size_t i = nargs - 1; i-- > 1;) {
+			const REAL *const ci = &blk[a[i] * BLOCK];
+			for (size_t j = 0; j < rows; j++)
+				out[j] = PFUN(madd)(out[j], x[j], ci[j]);
+		}
+		return;
+	}
+#if BATCH
+	const struct xpr_fun *const f = (funid >= FUN_USER) ? &funs[funid - FUN_USER] : NULL;
+	if (f && f->batch) {
+		const REAL **const av = argv;
+		for (size_t i = 0; i < nargs; i++)
+			av[i] = &blk[a[i] * BLOCK];
+		f->batch(f->arg, nargs, av, rows, out);
+		return;
+	}
+#endif
+	// the double copy for user-defined functions follows the room for the arguments
+	REAL *const av = argv;
+	double *const dv = (double *) argv + nargs;
+	for (size_t j = 0; j < rows; j++) {
+		for (size_t i = 0; i < nargs; i++)
+			av[i] = blk[a[i] * BLOCK + j];
+		out[j] = RUN(fun_call)(funs, funid, nargs, av, dv);
+	}
+}
+
+/*
+ * compute node i for a block of rows, starting at the given row
+ *
+ * Each node has BLOCK entries in blk, and the loops over the rows of a block
+ * are simple enough for the compiler to vectorize them.
+ */
+static inline void RUN(node_run_block)(const struct xpr_prog *const prog, size_t i, REAL *const blk, const REAL *const *const cols, size_t first, size_t rows, void *const argv)
+{
+	const struct node *const n = &prog_nodes(prog)[i];
+	REAL *const v = &blk[i * BLOCK];
+#	define ROWS(expr) for (size_t j = 0; j < rows; j++) v[j] = (expr)
+#	define l (blk[n->data.arg[0] * (size_t) BLOCK + j])
+#	define r (blk[n->data.arg[1] * (size_t) BLOCK + j])
+	switch (n->op) {
+	case OP_CONST: ROWS(n->data.value);                                                break;
+	case OP_NEG:   ROWS(-l);                                                           break;
+	case OP_ADD:   ROWS(l + r);                                                        break;
+	case OP_SUB:   ROWS(l - r);                                                        break;
+	case OP_MUL:   ROWS(l * r);                                                        break;
+	case OP_DIV:   ROWS(DIV_OK(l, r) ? l / r : XPR_ERR);                               break;
+	case OP_POW:   ROWS(POW_OK(l, r) ? MATH(pow)(l, r) : XPR_ERR);                     break;
+	case OP_FUN:   RUN(block_fun)(n, prog_args(prog), blk, rows, prog->ext.funs, v, argv); break;
+	case OP_LT:    ROWS(CMP(l, r, <));                                                 break;
+	case OP_LE:    ROWS(CMP(l, r, <=));                                                break;
+	case OP_GT:    ROWS(CMP(l, r, >));                                                 break;
+	case OP_GE:    ROWS(CMP(l, r, >=));                                                break;
+	case OP_EQ:    ROWS(CMP(l, r, ==));                                                break;
+	case OP_NE:    ROWS(CMP(l, r, !=));                                                break;
+	case OP_AND:   ROWS(LOGIC(l, r, &));                                               break;
+	case OP_OR:    ROWS(LOGIC(l, r, |));                                               break;
+	case OP_NOT:   ROWS(NOT(l));                                                       break;
+	case OP_VAR:
+		if (cols[n->data.slot])
+			memcpy(v, &cols[n->data.slot][first], rows * sizeof(REAL));
+		else
+			ROWS(XPR_ERR);
+		break;
+	default:
+		assert(0 || !!! "invalid node");
+		ROWS(XPR_ERR);
+	}
+#	undef ROWS
+#	undef l
+#	undef r
+}
+
+/*
+ * evaluate a block of rows, starting at the given row
+ */
+static inline void RUN(prog_run_block)(const struct xpr_prog *const prog, REAL *const blk, const REAL *const *const cols, size_t first, size_t rows, void *const argv)
+{
+	for (size_t i = 0; i < prog->nnodes; i++)
+		RUN(node_run_block)(prog, i, blk, cols, first, rows, argv);
+}
+
+#undef RUN
+#undef REAL
+#undef MATH
+#undef PFUN
+#undef USER
+#undef BATCH
@@ -28,7 +28,9 @@
 /*
  * tst.c
  *
- * This tool runs test cases for xpr
+ * This tool runs test cases for xpr. Each test case also runs as a compiled
+ * program, which must compute the same result as the xpr() function. The test
+ * cases can call the user-defined functions clamp, lerp, mean, hypot, and tick.
  *
  * Usage:
  * valgrind ./tst <test.in
@@ -39,19 +41,30 @@
  *  vardef  ::= <name> ':' <value> ';'
  *  name    ::= any variable name, not containing ':' or ';'
  *  value   ::= floating-point number parsed by strtod
- *  tail    ::= '!' <failure> | <success> '=' <value> | <success> '~' <value>
+ *  tail    ::= '!' <failure> | '?' <exceeded> | <success> '=' <value> | <success> '~' <value>
  *  failure ::= any illegal xpr expression
- *  success ::= any legal xpr expression
+ *  exceeded::= any xpr expression that exceeds an evaluation limit
+ *  success ::= any legal xpr expression or program
  *
  */
 #ifdef MAIN
 
+// the same feature test macros as xpr.c, which this file includes
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "xpr.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
+#include <inttypes.h>
 
 static bool verbose;
 
@@ -61,6 +74,774 @@ static void die(const char *msg)
 	exit(EXIT_FAILURE);
 }
 
+static bool same(double a, double b)
+{
+	return (isnan(a) && isnan(b)) || (a == b);
+}
+
+static double fun_clamp(void *arg, size_t nargs, const double *args)
+{
+	(void) arg;
+	(void) nargs;
+	if (!(args[1] <= args[2]))
+		return NAN;
+	return (args[0] < args[1]) ? args[1] : (args[0] > args[2]) ? args[2] : args[0];
+}
+
+static void batch_clamp(void *arg, size_t nargs, const double *const *args, size_t n, double *out)
+{
+	for (size_t i = 0; i < n; i++)
+		out[i] = fun_clamp(arg, nargs, (double[]) { args[0][i], args[1][i], args[2][i] });
+}
+
+static double fun_lerp(void *arg, size_t nargs, const double *args)
+{
+	(void) arg;
+	(void) nargs;
+	return args[0] + (args[1] - args[0]) * args[2];
+}
+
+static double fun_mean(void *arg, size_t nargs, const double *args)
+{
+	double sum = 0;
+	(void) arg;
+	for (size_t i = 0; i < nargs; i++)
+		sum += args[i];
+	return sum / nargs;
+}
+
+static void batch_mean(void *arg, size_t nargs, const double *const *args, size_t n, double *out)
+{
+	(void) arg;
+	for (size_t i = 0; i < n; i++) {
+		double sum = 0;
+		for (size_t k = 0; k < nargs; k++)
+			sum += args[k][i];
+		out[i] = sum / nargs;
+	}
+}
+
+static double fun_hypot(void *arg, size_t nargs, const double *args)
+{
+	(void) arg;
+	(void) nargs;
+	return hypot(args[0], args[1]);
+}
+
+static void batch_hypot(void *arg, size_t nargs, const double *const *args, size_t n, double *out)
+{
+	(void) arg;
+	(void) nargs;
+	for (size_t i = 0; i < n; i++)
+		out[i] = hypot(args[0][i], args[1][i]);
+}
+
+// an impure function, which counts its calls
+static double fun_tick(void *arg, size_t nargs, const double *args)
+{
+	(void) nargs;
+	// parallel evaluations call it concurrently
+	__atomic_fetch_add((unsigned long long *) arg, 1, __ATOMIC_RELAXED);
+	return args[0];
+}
+
+static unsigned long long ticks;
+
+// a small table, and a large table of squares
+static const double curve_x[] = { 0, 1, 3, 4 };
+static const double curve_y[] = { 0, 10, 20, 0 };
+static struct xpr_table curve = { curve_x, curve_y, 4 };
+static const double ramp_x[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23 };
+static const double ramp_y[] = { 0, 1, 4, 9, 16, 25, 36, 49, 64, 81, 100, 121, 144, 169, 196, 225, 256, 289, 324, 361, 400, 441, 484, 529 };
+static struct xpr_table ramp = { ramp_x, ramp_y, 24 };
+static struct xpr_table empty = { NULL, NULL, 0 };
+
+static const struct xpr_fun funs[] = {
+	{ "clamp", fun_clamp,  batch_clamp,      NULL,   3, 3,        XPR_FUN_PURE },
+	{ "lerp",  fun_lerp,   NULL,             NULL,   3, 3,        XPR_FUN_PURE },
+	{ "mean",  fun_mean,   batch_mean,       NULL,   1, SIZE_MAX, XPR_FUN_PURE },
+	{ "hypot", fun_hypot,  batch_hypot,      NULL,   2, 2,        XPR_FUN_PURE },
+	{ "tick",  fun_tick,   NULL,             &ticks, 1, 1,        0 },
+	{ "curve", xpr_interp, xpr_interp_batch, &curve, 1, 1,        XPR_FUN_PURE },
+	{ "stair", xpr_step,   xpr_step_batch,   &curve, 1, 1,        XPR_FUN_PURE },
+	{ "ramp",  xpr_interp, NULL,             &ramp,  1, 1,        XPR_FUN_PURE },
+	{ "steps", xpr_step,   xpr_step_batch,   &ramp,  1, 1,        XPR_FUN_PURE },
+	{ "empty", xpr_interp, xpr_interp_batch, &empty, 1, 1,        XPR_FUN_PURE },
+	{ NULL,    NULL,       NULL,             NULL,   0, 0,        0 }
+};
+
+struct ident {
+	const char *name;
+	bool found;
+};
+
+static int find_ident(void *arg, const char *name, size_t len, int kind)
+{
+	struct ident *ident = arg;
+	if ((XPR_IDENT_DEF != kind) && (strlen(ident->name) == len) && (0 == memcmp(ident->name, name, len)))
+		ident->found = true;
+	return 0;
+}
+
+// a program uses a variable iff the expression contains its name, unless an earlier variable has the same name
+static void test_vars_used(const char *expr, unsigned long long lineno, struct xpr_var *vars, size_t nvars, const struct xpr_prog *prog)
+{
+	size_t slots[nvars + 1];
+	size_t nused = xpr_vars_used(prog, slots);
+	if (nused != xpr_vars_used(prog, NULL))
+		fprintf(stderr, "%llu: %s: inconsistent number of used variables\n", lineno, expr);
+	size_t k = 0;
+	for (size_t i = 0; i < nvars; i++) {
+		struct ident ident = { vars[i].name, false };
+		for (size_t j = 0; j < i; j++)
+			if (0 == strcmp(vars[i].name, vars[j].name))
+				ident.name = "";
+		if (*ident.name && xpr_list_idents(expr, find_ident, &ident) < 0)
+			fprintf(stderr, "%llu: %s: cannot list identifiers\n", lineno, expr);
+		bool used = (k < nused) && (slots[k] == i);
+		if (used)
+			k++;
+		if (used != ident.found)
+			fprintf(stderr, "%llu: %s: variable %s %s\n", lineno, expr, vars[i].name, used ? "is used but not found" : "is found but not used");
+	}
+}
+
+struct resolver {
+	const double *values;
+	size_t *calls;
+};
+
+static double resolve(void *arg, size_t slot)
+{
+	struct resolver *r = arg;
+	r->calls[slot]++;
+	return r->values[slot];
+}
+
+// the callback resolves each used variable exactly once, even in untaken branches, and no other variable
+static void test_resolve(const char *expr, unsigned long long lineno, const struct xpr_prog *prog, struct xpr_ws *ws, const double *values, size_t nvars, double expect)
+{
+	size_t calls[nvars + 1], slots[nvars + 1];
+	struct resolver r = { values, calls };
+	memset(calls, 0, sizeof(calls));
+	const double is = xpr_eval_resolve(ws, resolve, &r);
+	if (!same(is, expect))
+		fprintf(stderr, "%llu: %s=%lf with resolved variables, expected=%lf\n", lineno, expr, is, expect);
+	const size_t nused = xpr_vars_used(prog, slots);
+	for (size_t i = 0, k = 0; i < nvars; i++) {
+		const size_t want = (k < nused) && (slots[k] == i);
+		k += want;
+		if (calls[i] != want)
+			fprintf(stderr, "%llu: %s resolves slot %zu %zu times, expected %zu\n", lineno, expr, i, calls[i], want);
+	}
+}
+
+// a program from an image must compute the same result, and corrupt images must not load
+static void test_image(const char *expr, unsigned long long lineno, const struct xpr_prog *prog, const double *values, double expect)
+{
+	size_t size = xpr_image_write(&prog, 1, NULL, 0);
+	if (0 == size)
+		return;  // programs with user-defined functions
+	uint64_t *buf = malloc(size);
+	if (!buf || (size != xpr_image_write(&prog, 1, buf, size)))
+		die("xpr_image_write");
+	struct xpr_image *img = xpr_image_load(buf, size);
+	struct xpr_ws *ws = img ? xpr_ws_new(xpr_image_prog(img, 0)) : NULL;
+	if (!ws) {
+		fprintf(stderr, "%llu: %s does not load from an image: %s\n", lineno, expr, strerror(errno));
+	} else if (!same(xpr_eval(ws, values), expect)) {
+		fprintf(stderr, "%llu: %s=%lf from an image, expected=%lf\n", lineno, expr, xpr_eval(ws, values), expect);
+	}
+	xpr_ws_free(ws);
+	xpr_image_close(img);
+
+	// the version follows the magic, and a newer version is not a corrupt image
+	((uint32_t *) buf)[1]++;
+	img = xpr_image_load(buf, size);
+	if (img || (ENOTSUP != errno))
+		fprintf(stderr, "%llu: %s loads from an image of a newer version\n", lineno, expr);
+	xpr_image_close(img);
+	((uint32_t *) buf)[1]--;
+
+	((unsigned char *) buf)[lineno % size] ^= 0x10;
+	img = xpr_image_load(buf, size);
+	if (img || ((EINVAL != errno) && (ENOTSUP != errno)))
+		fprintf(stderr, "%llu: %s loads from a corrupt image\n", lineno, expr);
+	xpr_image_close(img);
+	free(buf);
+}
+
+static bool close_float(float is, double exp)
+{
+	if (isnan(exp))
+		return isnan(is);
+	if (fabs(exp) > FLT_MAX / 2)
+		return true;
+	return fabs(is - exp) <= 1e-3 * (1 + fabs(exp));
+}
+
+static bool is_int64(double d)
+{
+	return (d >= -0x1p63) && (d < 0x1p63) && (d == (double) (int64_t) d);
+}
+
+// with integral values, the int64 evaluation must be exact, or fall back to double precision
+static void test_int(const char *expr, unsigned long long lineno, struct xpr_ws *ws, struct xpr_ws *ref, const double *values, size_t nvars, double expect, const char *exact)
+{
+	int64_t ivalues[nvars + 1];
+	for (size_t i = 0; i < nvars; i++) {
+		if (!is_int64(values[i]))
+			return;
+		ivalues[i] = (int64_t) values[i];
+	}
+
+	// an integral expected value beyond 2^53 is only exact in int64
+	char *end;
+	errno = 0;
+	long long iexp = exact ? strtoll(exact, &end, 10) : 0;
+	bool hasiexp = exact && *exact && !*end && !errno;
+	int64_t out;
+	int rc = xpr_eval_int(ws, ivalues, &out);
+	if (rc < 0)
+		die("xpr_eval_int");
+	if (0 == rc) {
+		if (hasiexp ? (out != iexp) : !same((double) out, expect))
+			fprintf(stderr, "%llu: %s=%"PRId64" as int64, expected=%s\n", lineno, expr, out, exact ? exact : "NAN");
+	} else {
+		double is;
+		xpr_results(ws, &is);
+		if (!same(is, expect))
+			fprintf(stderr, "%llu: %s=%lf after int64 fallback, expected=%lf\n", lineno, expr, is, expect);
+		if (hasiexp && (iexp > (1LL << 53) || iexp < -(1LL << 53)))
+			fprintf(stderr, "%llu: %s is not exact as int64\n", lineno, expr);
+	}
+
+	// the batch evaluation must agree with the evaluation in double precision
+	const size_t nrows = 150;
+	int64_t *cols[nvars + 1];
+	int64_t res[nrows];
+	double fallback[nrows];
+	for (size_t i = 0; i < nvars; i++) {
+		if (!(cols[i] = malloc(nrows * sizeof(int64_t))))
+			die("malloc");
+		for (size_t k = 0; k < nrows; k++)
+			cols[i][k] = ivalues[i] - (int64_t) (k % 7) * ((ivalues[i] < 0) ? -1 : 1);
+	}
+	rc = xpr_eval_batch_int(ws, (const int64_t *const *) cols, nrows, (int64_t *[]) { res }, (double *[]) { fallback });
+	if (rc < 0)
+		die("xpr_eval_batch_int");
+	for (size_t k = 0; k < nrows; k++) {
+		double row[nvars + 1];
+		for (size_t i = 0; i < nvars; i++)
+			row[i] = cols[i][k];
+		double exp = xpr_eval(ref, row);
+		double is = rc ? fallback[k] : (double) res[k];
+		if ((rc || (fabs(exp) < 0x1p53)) && !same(is, exp)) {
+			fprintf(stderr, "%llu: %s=%lf in row %zu of int64 batch, expected=%lf\n", lineno, expr, is, k, exp);
+			break;
+		}
+	}
+	for (size_t i = 0; i < nvars; i++)
+		free(cols[i]);
+}
+
+// the gradient must match central differences, unless the expression is not smooth
+static void test_grad(const char *expr, unsigned long long lineno, struct xpr_ws *ws, struct xpr_ws *ref, const struct xpr_var *vars, double *values, size_t nvars, double *const *cols, size_t nrows)
+{
+	size_t wrt[nvars + 1];
+	double grad[nvars + 1], out;
+	for (size_t i = 0; i < nvars; i++)
+		wrt[i] = i;
+	if (xpr_eval_grad(ws, values, wrt, nvars, &out, grad))
+		die("xpr_eval_grad");
+	const double is = xpr_eval(ref, values);
+	if (!same(out, is))
+		fprintf(stderr, "%llu: %s=%lf with gradient, expected=%lf\n", lineno, expr, out, is);
+	// large values leave too few digits for the differences
+	for (size_t i = 0; (fabs(is) < 0x1p32) && (i < nvars); i++) {
+		const double x = values[i];
+		const double h = 1e-6 * ((fabs(x) > 1) ? fabs(x) : 1);
+		values[i] = x + h;
+		const double hi = xpr_eval(ref, values);
+		values[i] = x - h;
+		const double lo = xpr_eval(ref, values);
+		values[i] = x;
+		const double fwd = (hi - is) / h, bwd = (is - lo) / h, cen = (hi - lo) / (2 * h);
+		// skip kinks, steps, and points where the differences are not accurate
+		if (!isfinite(fwd) || !isfinite(bwd) || (fabs(fwd - bwd) > 1e-3 * (1 + fabs(cen))))
+			continue;
+		if (!(fabs(grad[i] - cen) <= 1e-3 * (1 + fabs(cen))))
+			fprintf(stderr, "%llu: %s has derivative %lf for %s, expected=%lf\n", lineno, expr, grad[i], vars[i].name, cen);
+	}
+
+	// the batch evaluation must match the evaluation row by row
+	double *gcols[nvars + 1];
+	double res[nrows];
+	for (size_t i = 0; i < nvars; i++)
+		if (!(gcols[i] = malloc(nrows * sizeof(double))))
+			die("malloc");
+	if (xpr_eval_batch_grad(ws, (const double *const *) cols, nrows, wrt, nvars, (double *[]) { res }, gcols))
+		die("xpr_eval_batch_grad");
+	for (size_t k = 0; k < nrows; k++) {
+		double row[nvars + 1];
+		for (size_t i = 0; i < nvars; i++)
+			row[i] = cols[i][k];
+		if (xpr_eval_grad(ws, row, wrt, nvars, &out, grad))
+			die("xpr_eval_grad");
+		bool ok = same(res[k], out);
+		for (size_t i = 0; i < nvars; i++)
+			ok &= same(gcols[i][k], grad[i]);
+		if (!ok) {
+			fprintf(stderr, "%llu: %s has a different gradient in row %zu of batch\n", lineno, expr, k);
+			break;
+		}
+	}
+	for (size_t i = 0; i < nvars; i++)
+		free(gcols[i]);
+}
+
+// the bounds must enclose the results of all values within the ranges
+static void test_ival(const char *expr, unsigned long long lineno, struct xpr_ws *ws, struct xpr_ws *ref, const double *values, size_t nvars, double *const *cols, const double *res, size_t nrows)
+{
+	const double is = xpr_eval(ref, values);
+	double lo, hi;
+	int rc = xpr_eval_interval(ws, values, values, &lo, &hi);
+	if (rc < 0)
+		die("xpr_eval_interval");
+	if (isnan(is) ? !rc : !((lo <= is) && (is <= hi)))
+		fprintf(stderr, "%llu: %s=%lf is not within [%lf, %lf]%s\n", lineno, expr, is, lo, hi, rc ? "" : " without errors");
+	else if (isfinite(is) && !rc && (!isfinite(lo) || !isfinite(hi)))
+		fprintf(stderr, "%llu: %s=%lf has unbounded [%lf, %lf]\n", lineno, expr, is, lo, hi);
+
+	double rlo[nvars + 1], rhi[nvars + 1];
+	for (size_t i = 0; i < nvars; i++) {
+		rlo[i] = rhi[i] = cols[i][0];
+		for (size_t k = 1; k < nrows; k++) {
+			rlo[i] = (cols[i][k] < rlo[i]) ? cols[i][k] : rlo[i];
+			rhi[i] = (cols[i][k] > rhi[i]) ? cols[i][k] : rhi[i];
+		}
+	}
+	if ((rc = xpr_eval_interval(ws, rlo, rhi, &lo, &hi)) < 0)
+		die("xpr_eval_interval");
+	for (size_t k = 0; k < nrows; k++) {
+		if (isnan(res[k]) ? !rc : !((lo <= res[k]) && (res[k] <= hi))) {
+			fprintf(stderr, "%llu: %s=%lf in row %zu is not within [%lf, %lf]%s\n", lineno, expr, res[k], k, lo, hi, rc ? "" : " without errors");
+			break;
+		}
+	}
+}
+
+static void release_schema(struct ArrowSchema *s)
+{
+	s->release = NULL;
+}
+
+static void release_array(struct ArrowArray *a)
+{
+	a->release = NULL;
+}
+
+// Arrow columns of all types, with an offset and nulls, must match the batch evaluation
+static void test_arrow(const char *expr, unsigned long long lineno, struct xpr_ws *ws, const struct xpr_prog *prog, size_t nvars, double *const *cols, size_t nrows)
+{
+	static const char *const formats[] = { "g", "f", "l" };
+	struct ArrowSchema schemas[nvars + 1];
+	struct ArrowArray arrays[nvars + 1];
+	const struct ArrowSchema *sp[nvars + 1];
+	const struct ArrowArray *ap[nvars + 1];
+	const void *buffers[nvars + 1][2];
+	uint8_t bits[nvars + 1][(nrows + 8) / 8];
+	double *conv[nvars + 1];
+	void *data[nvars + 1];
+	for (size_t i = 0; i < nvars; i++) {
+		const char format = formats[i % 3][0];
+		if (!(conv[i] = malloc(nrows * sizeof(double))) || !(data[i] = malloc((nrows + 1) * 8)))
+			die("malloc");
+		memset(bits[i], 0, sizeof(bits[i]));
+		for (size_t k = 0; k < nrows; k++) {
+			switch (format) {
+			case 'g': conv[i][k] = ((double *) data[i])[k + 1] = cols[i][k]; break;
+			case 'f': conv[i][k] = ((float *) data[i])[k + 1] = cols[i][k];  break;
+			case 'l': conv[i][k] = ((int64_t *) data[i])[k + 1] = (fabs(cols[i][k]) < 0x1p62) ? (int64_t) cols[i][k] : 0; break;
+			}
+			if ((k + i) % 11)
+				bits[i][(k + 1) / 8] |= 1 << ((k + 1) % 8);
+		}
+		buffers[i][0] = bits[i];
+		buffers[i][1] = data[i];
+		schemas[i] = (struct ArrowSchema) { .format = formats[i % 3], .release = release_schema };
+		arrays[i] = (struct ArrowArray) { .length = nrows, .null_count = -1, .offset = 1, .n_buffers = 2, .buffers = buffers[i], .release = release_array };
+		sp[i] = &schemas[i];
+		ap[i] = &arrays[i];
+	}
+	double res[nrows];
+	if (xpr_eval_batch(ws, (const double *const *) conv, nrows, (double *[]) { res }))
+		die("xpr_eval_batch");
+	struct ArrowSchema os;
+	struct ArrowArray oa;
+	if (xpr_eval_arrow(ws, sp, ap, &os, &oa))
+		die("xpr_eval_arrow");
+	size_t used[nvars + 1];
+	const size_t nused = xpr_vars_used(prog, used);
+	const uint8_t *const obits = oa.buffers[0];
+	const double *const ovals = oa.buffers[1];
+	int64_t nulls = 0;
+	// without columns, there are no rows
+	nrows = nvars ? nrows : 0;
+	for (size_t k = 0; k < nrows; k++) {
+		bool valid = true;
+		for (size_t u = 0; u < nused; u++)
+			valid &= (0 != (k + used[u]) % 11);
+		nulls += !valid;
+		const bool isvalid = !obits || (obits[k / 8] >> (k % 8) & 1);
+		if ((valid != isvalid) || (valid && !same(ovals[k], res[k]))) {
+			fprintf(stderr, "%llu: %s=%lf in row %zu of Arrow column, expected=%lf\n", lineno, expr, ovals[k], k, valid ? res[k] : NAN);
+			break;
+		}
+	}
+	if ((oa.length != (int64_t) nrows) || (oa.null_count != nulls) || strcmp(os.format, "g"))
+		fprintf(stderr, "%llu: %s has an invalid Arrow column\n", lineno, expr);
+	os.release(&os);
+	oa.release(&oa);
+	for (size_t i = 0; i < nvars; i++) {
+		free(conv[i]);
+		free(data[i]);
+	}
+}
+
+// records with fields of all types, at unaligned offsets, must match the batch evaluation
+static void test_strided(const char *expr, unsigned long long lineno, struct xpr_ws *ws, size_t nvars, double *const *cols, size_t nrows)
+{
+	// each field takes 8 bytes after a 1-byte tag, the results follow the fields
+	const size_t stride = 8 * nvars + 1 + 8 + 4;
+	char *recs = malloc(nrows * stride);
+	struct xpr_field fields[nvars + 1];
+	double *conv[nvars + 1];
+	if (!recs)
+		die("malloc");
+	for (size_t i = 0; i < nvars; i++) {
+		fields[i] = (struct xpr_field) { recs, 1 + 8 * i, stride, (int) (i % 4) };
+		if (!(conv[i] = malloc(nrows * sizeof(double))))
+			die("malloc");
+		for (size_t k = 0; k < nrows; k++) {
+			char *const p = recs + k * stride + fields[i].offset;
+			const double d = cols[i][k];
+			// out of range integers become 0
+			const bool inrange = fabs(d) < 0x1p31;
+			const float f = d;
+			const int64_t l = inrange ? (int64_t) d : 0;
+			const int32_t w = inrange ? (int32_t) d : 0;
+			switch (fields[i].type) {
+			case XPR_TYPE_DOUBLE: memcpy(p, &d, sizeof(d)); conv[i][k] = d; break;
+			case XPR_TYPE_FLOAT:  memcpy(p, &f, sizeof(f)); conv[i][k] = f; break;
+			case XPR_TYPE_INT64:  memcpy(p, &l, sizeof(l)); conv[i][k] = l; break;
+			case XPR_TYPE_INT32:  memcpy(p, &w, sizeof(w)); conv[i][k] = w; break;
+			}
+		}
+	}
+	double res[nrows];
+	if (xpr_eval_batch(ws, (const double *const *) conv, nrows, (double *[]) { res }))
+		die("xpr_eval_batch");
+	const struct xpr_out_field outd = { recs, 1 + 8 * nvars, stride, XPR_TYPE_DOUBLE };
+	const struct xpr_out_field outf = { recs, 1 + 8 * nvars + 8, stride, XPR_TYPE_FLOAT };
+	if (xpr_eval_strided(ws, fields, nrows, &outd) || xpr_eval_strided(ws, fields, nrows, &outf))
+		die("xpr_eval_strided");
+	for (size_t k = 0; k < nrows; k++) {
+		double d;
+		float f;
+		memcpy(&d, recs + k * stride + outd.offset, sizeof(d));
+		memcpy(&f, recs + k * stride + outf.offset, sizeof(f));
+		if (!same(d, res[k]) || !same(f, (float) res[k])) {
+			fprintf(stderr, "%llu: %s=%lf in record %zu, expected=%lf\n", lineno, expr, d, k, res[k]);
+			break;
+		}
+	}
+	for (size_t i = 0; i < nvars; i++)
+		free(conv[i]);
+	free(recs);
+}
+
+// plain, dictionary-encoded and constant columns must match the batch evaluation, with as many impure calls
+static void test_columns(const char *expr, unsigned long long lineno, struct xpr_ws *ws, size_t nvars, double *const *cols, size_t nrows)
+{
+	// the rows repeat the first 7 values of each column
+	struct xpr_column ccols[nvars + 1];
+	double *conv[nvars + 1];
+	uint32_t index[nrows];
+	for (size_t k = 0; k < nrows; k++)
+		index[k] = k % 7;
+	for (size_t i = 0; i < nvars; i++) {
+		const int kind = (int) (i % 3);
+		ccols[i] = (struct xpr_column) { kind, cols[i], index, 7 };
+		if (!(conv[i] = malloc(nrows * sizeof(double))))
+			die("malloc");
+		for (size_t k = 0; k < nrows; k++)
+			conv[i][k] = (XPR_COL_CONST == kind) ? cols[i][0] : (XPR_COL_DICT == kind) ? cols[i][k % 7] : cols[i][k];
+	}
+	double res[nrows], out[nrows];
+	unsigned long long calls = ticks;
+	if (xpr_eval_batch(ws, (const double *const *) conv, nrows, (double *[]) { res }))
+		die("xpr_eval_batch");
+	calls = ticks - calls;
+	unsigned long long ccalls = ticks;
+	if (xpr_eval_columns(ws, ccols, nrows, (double *[]) { out }))
+		die("xpr_eval_columns");
+	ccalls = ticks - ccalls;
+	for (size_t k = 0; k < nrows; k++) {
+		if (!same(out[k], res[k])) {
+			fprintf(stderr, "%llu: %s=%lf in row %zu of encoded columns, expected=%lf\n", lineno, expr, out[k], k, res[k]);
+			break;
+		}
+	}
+	if (ccalls != calls)
+		fprintf(stderr, "%llu: %s makes %llu impure calls for encoded columns, expected=%llu\n", lineno, expr, ccalls, calls);
+	for (size_t i = 0; i < nvars; i++)
+		free(conv[i]);
+}
+
+// the first row of a stream has windows of one row, and the rows must not depend on how the calls split them
+static void test_stream(const char *expr, unsigned long long lineno, struct xpr_ws *ws, size_t nvars, double *const *cols, const double *res, size_t nrows)
+{
+	double all[nrows], part[nrows];
+	const size_t cuts[] = { 0, 1, 2, 65, nrows };
+	xpr_stream_reset(ws);
+	if (xpr_eval_stream(ws, (const double *const *) cols, nrows, (double *[]) { all }))
+		die("xpr_eval_stream");
+	xpr_stream_reset(ws);
+	for (size_t c = 0; c + 1 < sizeof(cuts) / sizeof(cuts[0]); c++) {
+		const double *sub[nvars + 1];
+		for (size_t i = 0; i < nvars; i++)
+			sub[i] = &cols[i][cuts[c]];
+		if (xpr_eval_stream(ws, sub, cuts[c + 1] - cuts[c], (double *[]) { &part[cuts[c]] }))
+			die("xpr_eval_stream");
+	}
+	if (!same(all[0], res[0]))
+		fprintf(stderr, "%llu: %s=%lf in row 0 of stream, expected=%lf\n", lineno, expr, all[0], res[0]);
+	for (size_t k = 0; k < nrows; k++) {
+		if (!same(part[k], all[k])) {
+			fprintf(stderr, "%llu: %s=%lf in row %zu of split stream, expected=%lf\n", lineno, expr, part[k], k, all[k]);
+			break;
+		}
+	}
+}
+
+// the fused aggregates must match the batch results, and the sum must be close to the plain sum
+static void test_agg(const char *expr, unsigned long long lineno, struct xpr_ws *ws, double *const *cols, const double *res, size_t nrows)
+{
+	double sum = 0, abs = 0, min = INFINITY, max = -INFINITY;
+	size_t count = 0;
+	for (size_t k = 0; k < nrows; k++) {
+		if (isnan(res[k]))
+			continue;
+		sum += res[k];
+		abs += fabs(res[k]);
+		min = fmin(min, res[k]);
+		max = fmax(max, res[k]);
+		count++;
+	}
+	if (!count)
+		min = max = XPR_ERR;
+	for (int flags = 0; flags <= XPR_AGG_KAHAN; flags++) {
+		struct xpr_agg agg;
+		if (xpr_eval_agg(ws, (const double *const *) cols, nrows, flags, &agg))
+			die("xpr_eval_agg");
+		if ((agg.count != count) || (agg.nerr != nrows - count) || !same(agg.min, min) || !same(agg.max, max))
+			fprintf(stderr, "%llu: %s aggregates count=%zu min=%lf max=%lf, expected count=%zu min=%lf max=%lf\n", lineno, expr, agg.count, agg.min, agg.max, count, min, max);
+		if (isfinite(sum) && !(fabs(agg.sum - sum) <= 1e-12 * abs))
+			fprintf(stderr, "%llu: %s aggregates sum=%lf, expected=%lf\n", lineno, expr, agg.sum, sum);
+	}
+
+	// the bins split the range of the results, and the largest result is out of range
+	if (!count || !(min < max) || !isfinite(max - min))
+		return;
+	uint64_t bins[5], exp[5] = { 0 };
+	if (xpr_eval_hist(ws, (const double *const *) cols, nrows, min, max, 5, bins))
+		die("xpr_eval_hist");
+	for (size_t k = 0; k < nrows; k++) {
+		if (res[k] < max) {
+			const size_t b = (size_t) ((res[k] - min) * (5 / (max - min)));
+			exp[(b < 5) ? b : 4]++;
+		}
+	}
+	if (memcmp(bins, exp, sizeof(bins)))
+		fprintf(stderr, "%llu: %s wrong histogram\n", lineno, expr);
+}
+
+// rules that only differ in constants share a group, and each rule keeps its own result
+static void test_rules(const char *expr, unsigned long long lineno, struct xpr_var *vars, const double *values, double expect)
+{
+	const bool hasvar = vars && vars[0].name && ('$' != vars[0].name[0]);
+	const char *name = hasvar ? vars[0].name : "0";
+	const double x = hasvar ? values[0] : 0;
+	char lin[2][strlen(name) + 8];
+	snprintf(lin[0], sizeof(lin[0]), "%s*3+1", name);
+	snprintf(lin[1], sizeof(lin[1]), "%s*4+2", name);
+	const char *rules[] = { expr, "1", lin[0], expr, "2", lin[1] };
+	const double exp[] = { expect, 1, x * 3 + 1, expect, 2, x * 4 + 2 };
+	double out[6];
+	struct xpr_rules *set = xpr_rules_compile(rules, 6, vars, funs);
+	// the linear rules may exceed the limits of $maxlen and the like
+	if (!set && (E2BIG == errno))
+		return;
+	if (!set || xpr_rules_eval(set, values, out))
+		die("xpr_rules");
+	for (size_t i = 0; i < 6; i++)
+		if (!same(out[i], exp[i]))
+			fprintf(stderr, "%llu: %s=%lf as rule %zu, expected=%lf\n", lineno, rules[i], out[i], i, exp[i]);
+	if (xpr_rules_groups(set) > 3)
+		fprintf(stderr, "%llu: %s has %zu groups of rules\n", lineno, expr, xpr_rules_groups(set));
+	xpr_rules_free(set);
+}
+
+static struct xpr_pool *pool;
+
+// parallel evaluation must match the batch evaluation, with and without a pool
+static void test_parallel(const char *expr, unsigned long long lineno, const struct xpr_prog *prog, double *const *cols, const double *res, size_t nrows)
+{
+	double out[nrows], seq[nrows];
+	if (xpr_eval_parallel(pool, prog, (const double *const *) cols, nrows, (double *[]) { out })
+	 || xpr_eval_parallel(NULL, prog, (const double *const *) cols, nrows, (double *[]) { seq }))
+		die("xpr_eval_parallel");
+	for (size_t k = 0; k < nrows; k++) {
+		if (!same(out[k], res[k]) || !same(seq[k], res[k])) {
+			fprintf(stderr, "%llu: %s=%lf in row %zu of parallel batch, expected=%lf\n", lineno, expr, out[k], k, res[k]);
+			break;
+		}
+	}
+}
+
+static void test_prog(const char *expr, unsigned long long lineno, struct xpr_var *vars, double expect, const char *exact)
+{
+	struct xpr_prog *prog = xpr_compile_ext(&expr, 1, vars, funs);
+	if (!prog) {
+		if (!isnan(expect) || (XPR_IS_LIMIT(expect) && (E2BIG != errno)))
+			fprintf(stderr, "%llu: %s does not compile: %s\n", lineno, expr, strerror(errno));
+		return;
+	}
+	if (XPR_IS_LIMIT(expect))
+		fprintf(stderr, "%llu: %s compiles but should exceed a limit\n", lineno, expr);
+
+	size_t nvars = 0;
+	while (vars && vars[nvars].name)
+		nvars++;
+	double values[nvars + 1];
+	for (size_t i = 0; i < nvars; i++)
+		values[i] = vars[i].value;
+	test_vars_used(expr, lineno, vars, nvars, prog);
+
+	struct xpr_ws *ws = xpr_ws_new(prog);
+	struct xpr_ws *ref = xpr_ws_new(prog);
+	if (!ws || !ref)
+		die("xpr_ws_new");
+	double is = xpr_eval(ws, values);
+	if (!same(is, expect))
+		fprintf(stderr, "%llu: %s=%lf as program, expected=%lf\n", lineno, expr, is, expect);
+	test_resolve(expr, lineno, prog, ref, values, nvars, expect);
+
+	// incremental evaluation must match full evaluation
+	for (size_t i = 0; i < nvars; i++) {
+		double old = values[i];
+		values[i] = old + 1;
+		is = xpr_update(ws, i, values[i]);
+		double exp = xpr_eval(ref, values);
+		if (!same(is, exp))
+			fprintf(stderr, "%llu: %s=%lf after update of %s, expected=%lf\n", lineno, expr, is, vars[i].name, exp);
+		values[i] = old;
+		xpr_update(ws, i, old);
+	}
+
+	// batch evaluation must match evaluation row by row, across several blocks
+	const size_t nrows = 150;
+	double *cols[nvars + 1];
+	double res[nrows];
+	for (size_t i = 0; i < nvars; i++) {
+		if (!(cols[i] = malloc(nrows * sizeof(double))))
+			die("malloc");
+		for (size_t k = 0; k < nrows; k++)
+			cols[i][k] = values[i] + (double) (k % 7) / 4;
+	}
+	if (xpr_eval_batch(ws, (const double *const *) cols, nrows, (double *[]) { res }))
+		die("xpr_eval_batch");
+	for (size_t k = 0; k < nrows; k++) {
+		double row[nvars + 1];
+		for (size_t i = 0; i < nvars; i++)
+			row[i] = cols[i][k];
+		double exp = xpr_eval(ref, row);
+		if (!same(res[k], exp)) {
+			fprintf(stderr, "%llu: %s=%lf in row %zu of batch, expected=%lf\n", lineno, expr, res[k], k, exp);
+			break;
+		}
+	}
+
+	// the filter selects the rows with a nonzero result
+	uint64_t bitmap[(nrows + 63) / 64];
+	size_t index[nrows];
+	const size_t nsel = xpr_filter(ws, (const double *const *) cols, nrows, bitmap, index);
+	if (SIZE_MAX == nsel)
+		die("xpr_filter");
+	for (size_t k = 0, m = 0; k < nrows; k++) {
+		const bool sel = !isnan(res[k]) && (0 != res[k]);
+		const bool bit = (bitmap[k / 64] >> (k % 64)) & 1;
+		if ((sel != bit) || (sel && ((m >= nsel) || (index[m++] != k)))) {
+			fprintf(stderr, "%llu: %s wrong filter in row %zu\n", lineno, expr, k);
+			break;
+		}
+		if ((k == nrows - 1) && (m != nsel))
+			fprintf(stderr, "%llu: %s filter selects %zu rows, expected=%zu\n", lineno, expr, nsel, m);
+	}
+	if (nsel != xpr_filter(ws, (const double *const *) cols, nrows, NULL, NULL))
+		fprintf(stderr, "%llu: %s filter count differs without outputs\n", lineno, expr);
+
+	// single precision must be close to double precision, unless float overflows
+	float *colsf[nvars + 1];
+	float resf[nrows];
+	for (size_t i = 0; i < nvars; i++) {
+		if (!(colsf[i] = malloc(nrows * sizeof(float))))
+			die("malloc");
+		for (size_t k = 0; k < nrows; k++)
+			colsf[i][k] = cols[i][k];
+	}
+	if (xpr_eval_batchf(ws, (const float *const *) colsf, nrows, (float *[]) { resf }))
+		die("xpr_eval_batchf");
+	for (size_t k = 0; k < nrows; k++) {
+		if (!close_float(resf[k], res[k])) {
+			fprintf(stderr, "%llu: %s=%f in row %zu of float batch, expected=%lf\n", lineno, expr, resf[k], k, res[k]);
+			break;
+		}
+	}
+	test_grad(expr, lineno, ws, ref, vars, values, nvars, cols, nrows);
+	test_ival(expr, lineno, ws, ref, values, nvars, cols, res, nrows);
+	test_arrow(expr, lineno, ws, prog, nvars, cols, nrows);
+	test_strided(expr, lineno, ws, nvars, cols, nrows);
+	test_columns(expr, lineno, ws, nvars, cols, nrows);
+	test_stream(expr, lineno, ws, nvars, cols, res, nrows);
+	test_agg(expr, lineno, ws, cols, res, nrows);
+	test_parallel(expr, lineno, prog, cols, res, nrows);
+	for (size_t i = 0; i < nvars; i++) {
+		free(cols[i]);
+		free(colsf[i]);
+	}
+
+	test_int(expr, lineno, ws, ref, values, nvars, expect, exact);
+	xpr_ws_free(ref);
+	xpr_ws_free(ws);
+	test_image(expr, lineno, prog, values, expect);
+	test_rules(expr, lineno, vars, values, expect);
+	xpr_prog_free(prog);
+
+	// in a set, the expression shares all nodes with its copy
+	const char *set[] = { expr, "1", expr };
+	double out[3];
+	prog = xpr_compile_ext(set, 3, vars, funs);
+	if (!prog || !(ws = xpr_ws_new(prog)))
+		die("xpr_compile_set");
+	xpr_eval_set(ws, values, out);
+	if (!same(out[0], expect) || (1 != out[1]) || !same(out[2], expect))
+		fprintf(stderr, "%llu: %s={%lf,%lf,%lf} as set, expected=%lf\n", lineno, expr, out[0], out[1], out[2], expect);
+	xpr_ws_free(ws);
+	xpr_prog_free(prog);
+}
+
 static void test_fail(char *line, unsigned long long lineno, struct xpr_var *vars)
 {
 	char *realline = strtok(line, "\n");
@@ -68,9 +849,85 @@ static void test_fail(char *line, unsigned long long lineno, struct xpr_var *var
 		realline = "";
 	if (verbose)
 		fprintf(stderr, "[-] %s\n", realline);
-	double is = xpr(realline, vars);
+	double is = xpr_ext(realline, vars, funs);
 	if (!isnan(is))
 		fprintf(stderr, "%llu: %s=%lf but should fail\n", lineno, realline, is);
+	test_prog(realline, lineno, vars, is, NULL);
+}
+
+static void test_limit(char *line, unsigned long long lineno, struct xpr_var *vars)
+{
+	char *realline = strtok(line, "\n");
+	if (!realline)
+		realline = "";
+	if (verbose)
+		fprintf(stderr, "[?] %s\n", realline);
+	double is = xpr_ext(realline, vars, funs);
+	if (!XPR_IS_LIMIT(is))
+		fprintf(stderr, "%llu: %s=%lf but should exceed a limit\n", lineno, realline, is);
+	test_prog(realline, lineno, vars, is, NULL);
+}
+
+// the expected results of a stream, where the variables of row k are their values plus k
+static void test_series_run(const char *expr, unsigned long long lineno, struct xpr_var *vars, const double *expect, size_t nrows)
+{
+	struct xpr_prog *prog = xpr_compile_ext(&expr, 1, vars, funs);
+	struct xpr_ws *ws = prog ? xpr_ws_new(prog) : NULL;
+	if (!ws) {
+		fprintf(stderr, "%llu: %s does not compile: %s\n", lineno, expr, strerror(errno));
+		xpr_prog_free(prog);
+		return;
+	}
+	size_t nvars = 0;
+	while (vars && vars[nvars].name)
+		nvars++;
+	double *cols[nvars + 1];
+	for (size_t i = 0; i < nvars; i++) {
+		if (!(cols[i] = malloc(nrows * sizeof(double))))
+			die("malloc");
+		for (size_t k = 0; k < nrows; k++)
+			cols[i][k] = vars[i].value + k;
+	}
+	double res[nrows];
+	if (xpr_eval_stream(ws, (const double *const *) cols, nrows, (double *[]) { res }))
+		die("xpr_eval_stream");
+	for (size_t k = 0; k < nrows; k++) {
+		if (!same(res[k], expect[k])) {
+			fprintf(stderr, "%llu: %s=%lf in row %zu of stream, expected=%lf\n", lineno, expr, res[k], k, expect[k]);
+			break;
+		}
+	}
+	for (size_t i = 0; i < nvars; i++)
+		free(cols[i]);
+	// the windows are live, and the workspace must not need the program to release them
+	xpr_prog_free(prog);
+	xpr_ws_free(ws);
+}
+
+static void test_series(char *line, unsigned long long lineno, struct xpr_var *vars)
+{
+	char *realline = strtok(line, "\n");
+	if (!realline || !strrchr(realline, '='))
+		goto syntax_error;
+	if (verbose)
+		fprintf(stderr, "[@] %s\n", realline);
+	char *list = strrchr(realline, '=');
+	*list++ = '\0';
+	double expect[64];
+	size_t nrows = 0;
+	for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+		char *end;
+		if (nrows >= sizeof(expect) / sizeof(expect[0]))
+			goto syntax_error;
+		expect[nrows++] = strtod(tok, &end);
+		if (end && *end)
+			goto syntax_error;
+	}
+	test_series_run(realline, lineno, vars, expect, nrows);
+	return;
+
+	syntax_error:
+	fprintf(stderr, "%llu: syntax error. skip.\n", lineno);
 }
 
 #define EPS (1.0/(1<<20))
@@ -99,10 +956,10 @@ static bool equal_enough(double is, double exp, bool exact)
 
 static void test_success(char *line, unsigned long long lineno, struct xpr_var *vars)
 {
-	char *sep = "=";
+	char sep = '=';
 	bool exact = true;
 	if (strchr(line, '~')) {
-		sep = "~";
+		sep = '~';
 		exact = false;
 	}
 	char *realline = strtok(line, "\n");
@@ -110,26 +967,74 @@ static void test_success(char *line, unsigned long long lineno, struct xpr_var *
 		goto syntax_error;
 	if (verbose)
 		fprintf(stderr, "[%c] %s\n", exact ? '+' : '~', realline);
-	char *expr = strtok(realline, sep);
-	char *expect = strtok(NULL, sep);
-	if (!expr || !expect)
+	// programs contain '=', so the expected value follows the last one
+	char *expr = realline;
+	char *expect = strrchr(realline, sep);
+	if (!expect || expect == expr)
 		goto syntax_error;
+	*expect++ = '\0';
 	char *end;
 	double exp = strtod(expect, &end);
 	if (end && *end)
 		goto syntax_error;
-	double is = xpr(expr, vars);
+	double is = xpr_ext(expr, vars, funs);
 	if (!equal_enough(is, exp, exact))
 		fprintf(stderr, "%llu: %s=%lf expected=%lf [%la %s %la]\n", lineno, expr, is, exp, is, exact ? "!=" : "!~", exp);
+	test_prog(expr, lineno, vars, is, expect);
 	return;
 
 	syntax_error:
 	fprintf(stderr, "%llu: syntax error. skip.\n", lineno);
 }
 
+// impure callbacks run once per call and row of an evaluation, and never for creating workspaces
+static void test_calls(void)
+{
+	const char *expr = "tick(x)+1";
+	const struct xpr_var vars[] = { { "x", 2 }, { NULL, 0 } };
+	struct xpr_prog *prog = xpr_compile_ext(&expr, 1, vars, funs);
+	if (!prog)
+		die("xpr_compile_ext");
+	unsigned long long calls = ticks;
+	struct xpr_ws *ws = xpr_ws_new(prog);
+	if (!ws)
+		die("xpr_ws_new");
+	if (ticks != calls)
+		fprintf(stderr, "%s: xpr_ws_new() makes %llu calls, expected=0\n", expr, ticks - calls);
+	calls = ticks;
+	xpr_eval(ws, (const double[]) { 2 });
+	if (ticks != calls + 1)
+		fprintf(stderr, "%s: xpr_eval() makes %llu calls, expected=1\n", expr, ticks - calls);
+	double col[1000], out[1000];
+	for (size_t k = 0; k < 1000; k++)
+		col[k] = k;
+	calls = ticks;
+	if (xpr_eval_parallel(pool, prog, (const double *const[]) { col }, 1000, (double *[]) { out }))
+		die("xpr_eval_parallel");
+	if (ticks != calls + 1000)
+		fprintf(stderr, "%s: xpr_eval_parallel() makes %llu calls for 1000 rows\n", expr, ticks - calls);
+	xpr_ws_free(ws);
+	xpr_prog_free(prog);
+
+	expr = "a=tick(x);a*a";
+	calls = ticks;
+	if (4 != xpr_ext(expr, vars, funs))
+		fprintf(stderr, "%s=%lf, expected=4\n", expr, xpr_ext(expr, vars, funs));
+	else if (ticks != calls + 1)
+		fprintf(stderr, "%s: xpr_ext() makes %llu calls, expected=1\n", expr, ticks - calls);
+}
+
 int main(void)
 {
 	verbose = !!getenv("VERBOSE");
+	if (!(pool = xpr_pool_new(4, 0)))
+		die("xpr_pool_new");
+	// Linux pins threads
+	struct xpr_pool *pinned = xpr_pool_new(2, XPR_POOL_PIN);
+	if (!pinned)
+		perror("xpr_pool_new(XPR_POOL_PIN)");
+	xpr_pool_free(pinned);
+	test_calls();
 	char *line = NULL;
 	size_t linesz = 0;
 	unsigned long long lineno = 0;
@@ -141,11 +1046,12 @@ int main(void)
 		if (line[0] == '#' || line[0] == '\n')
 			continue;
 
-		// find variable definitions
+		// find variable definitions, the remaining statements belong to the program
 		struct xpr_var *vars = NULL;
 		size_t varsz = 0;
 		char *tail = line;
-		while (strchr(tail, ';')) {
+		char *semi;
+		while ((semi = strchr(tail, ';')) && memchr(tail, ':', semi - tail)) {
 			//fprintf(stderr, "!var: line=%s\n", tail);
 			char *vardef = strtok(tail, ";");
 			tail += strlen(vardef)+1;
@@ -169,6 +1075,10 @@ int main(void)
 
 		if (tail[0] == '!')
 			test_fail(tail + 1, lineno, vars);
+		else if (tail[0] == '?')
+			test_limit(tail + 1, lineno, vars);
+		else if (tail[0] == '@')
+			test_series(tail + 1, lineno, vars);
 		else
 			test_success(tail, lineno, vars);
 
@@ -176,6 +1086,7 @@ int main(void)
 	}
 	if (ferror(stdin))
 		die("getline");
+	xpr_pool_free(pool);
 	free(line);
 	exit(EXIT_SUCCESS);
 }
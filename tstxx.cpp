@@ -0,0 +1,290 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+/*
+ * tstxx.cpp
+ *
+ * This tool runs test cases for the C++ wrappers. Each expression that is
+ * parsed at compile time must compute the same result as the xpr() function,
+ * and so must the same expression as xpr::program.
+ *
+ * Usage:
+ * ./tstxx
+ */
+#include "xpr.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static int failures;
+
+// the compiler may compute library functions with constant arguments more exactly
+static bool same(double a, double b)
+{
+	return (std::isnan(a) && std::isnan(b)) || (a == b) || (std::fabs(a - b) <= 1e-15 * std::fabs(b));
+}
+
+static const xpr::xpr_var vars[] = {
+	{ "x", 1.5 },
+	{ "y", -2 },
+	{ "z", 0 },
+	{ "big", 1e300 },
+	{ NULL, 0 }
+};
+
+static void test_program(int line, const char *str, double exp)
+{
+	std::vector<const char *> names;
+	std::vector<double> values;
+	for (const xpr::xpr_var *v = vars; v->name; v++) {
+		names.push_back(v->name);
+		values.push_back(v->value);
+	}
+	try {
+		xpr::program p(std::span<const char *const>(&str, 1), names);
+		// moving the program keeps its internal workspace
+		xpr::program q = std::move(p);
+		if (!same(q.eval(values), exp)) {
+			fprintf(stderr, "%d: %s=%lf as program, expected=%lf\n", line, str, q.eval(values), exp);
+			failures++;
+		}
+
+		// each column has the same value in all rows
+		const std::size_t rows = 100;
+		std::vector<std::vector<double>> cols;
+		std::vector<const double *> colp;
+		for (double v : values)
+			cols.emplace_back(rows, v);
+		for (const std::vector<double> &c : cols)
+			colp.push_back(c.data());
+		std::vector<double> out(rows);
+		xpr::workspace ws(q);
+		ws.eval_batch(colp, out);
+		for (double d : out) {
+			if (!same(d, exp)) {
+				fprintf(stderr, "%d: %s=%lf in batch, expected=%lf\n", line, str, d, exp);
+				failures++;
+				break;
+			}
+		}
+	} catch (const std::system_error &e) {
+		if (!std::isnan(exp)) {
+			fprintf(stderr, "%d: %s does not compile: %s\n", line, str, e.what());
+			failures++;
+		}
+	}
+}
+
+template <xpr::fixed_string S>
+static void test(int line)
+{
+	constexpr xpr::expr<S> e;
+	std::array<double, e.nvars> values {};
+	for (std::size_t i = 0; i < e.nvars; i++)
+		for (const xpr::xpr_var *v = vars; v->name; v++)
+			if (e.names[i] == v->name)
+				values[i] = v->value;
+	const double is = e.eval(values);
+	const double exp = xpr::xpr(S.str, vars);
+	if (!same(is, exp)) {
+		fprintf(stderr, "%d: %s=%lf at compile time, expected=%lf\n", line, S.str, is, exp);
+		failures++;
+	}
+	test_program(line, S.str, exp);
+}
+
+#define TEST(str) test<str>(__LINE__)
+
+// expressions that xpr::expr<> accepts, the others are compile errors
+template <xpr::fixed_string S>
+concept parses = requires { typename std::integral_constant<std::size_t, xpr::detail::parse<S>().nnodes>; };
+
+// numbers within the correctly rounded range must be identical to strtod()
+template <xpr::fixed_string S>
+static void test_exact(int line)
+{
+	constexpr xpr::expr<S> e;
+	const double is = e.eval({});
+	const double exp = xpr::xpr(S.str, NULL);
+	if (0 != memcmp(&is, &exp, sizeof(double))) {
+		fprintf(stderr, "%d: %s=%a at compile time, expected=%a\n", line, S.str, is, exp);
+		failures++;
+	}
+}
+
+#define TEST_EXACT(str) test_exact<str>(__LINE__)
+
+int main(void)
+{
+	// numbers
+	TEST("0");
+	TEST("1.25");
+	TEST(".5");
+	TEST("1.");
+	TEST("00012");
+	TEST("1e3");
+	TEST("1.5E-3");
+	TEST("2e+2");
+	TEST("0.1");
+	TEST("0.3");
+	TEST("123456789012345678");
+	TEST("3.14159265358979323846");
+	TEST("1e22");
+	TEST("0x10");
+	TEST("0x.8");
+	TEST("0X1P-1");
+	TEST("0x1.8p1");
+	TEST_EXACT("9007199254740992e22");
+	TEST_EXACT("9007199254740992e-22");
+	TEST_EXACT("1e-22");
+	TEST_EXACT("0.1");
+	TEST_EXACT("123.456e-5");
+
+	// operators
+	TEST("1+2*3");
+	TEST("(1+2)*3");
+	TEST("1-2-3");
+	TEST("8/4/2");
+	TEST("2^3^2");
+	TEST("-2^2");
+	TEST("2^-1");
+	TEST("2^-2^2");
+	TEST("2*-3");
+	TEST("--1");
+	TEST("1--1");
+	TEST("+-+1");
+	TEST("-(1)");
+	TEST("-sin(1)^2");
+	TEST(" 1 + ( 2 ) * 3 ");
+	TEST("1/0");
+	TEST("0/0");
+	TEST("(-8)^(1/3)");
+	TEST("(-8)^3");
+	TEST("0^0");
+
+	// constants and functions
+	TEST("e+pi+phi");
+	TEST("acos(0.5)+acosh(2)+asin(0.5)+asinh(2)+atan(2)+atanh(0.5)");
+	TEST("cbrt(27)+ceil(1.5)+cos(1)+cosh(1)+exp(1)+floor(1.5)");
+	TEST("log(8)+log(2,8)+round(2.5)+sin(1)+sinh(1)+sqrt(2)+tan(1)+tanh(1)");
+	TEST("max(1,5,3)+min(4,2,6)+sum()+sum(1,2,3,4)");
+	TEST("scale(10,100,5)+scale(0,10,0,100,5)");
+	TEST("log(0)");
+	TEST("log(1,8)");
+	TEST("sqrt(-1)");
+	TEST("acos(2)");
+	TEST("scale(0,1,5)");
+	TEST("sin (0)");
+	TEST("((((1))))");
+
+	// variables
+	TEST("x");
+	TEST("x*y+z");
+	TEST("sqrt(x^2+y^2)");
+	TEST("y^x");
+	TEST("y^2");
+	TEST("x/z");
+	TEST("big*big");
+	TEST("big*big-big*big");
+	TEST("max(x,y,z)-min(x,y,z)");
+	TEST("scale(x,y,0,1,z)");
+
+	// the grammar beyond the arithmetic subset
+	static_assert(parses<"and1+order+notice">);
+	static_assert(!parses<"a<b">);
+	static_assert(!parses<"(a>=b)">);
+	static_assert(!parses<"a==b">);
+	static_assert(!parses<"a!=b">);
+	static_assert(!parses<"a and b">);
+	static_assert(!parses<"(a or b)">);
+	static_assert(!parses<"not a">);
+	static_assert(!parses<"x=1;x">);
+	static_assert(!parses<"select(a,1,2)">);
+	static_assert(!parses<"poly(a,1,2)">);
+	static_assert(!parses<"wsum(a,3)">);
+	static_assert(!parses<"lag(a,1)">);
+
+	// named variable binding
+	constexpr xpr::expr<"a*b + sin(c)"> e;
+	static_assert(3 == e.nvars);
+	static_assert(("a" == e.names[0]) && ("b" == e.names[1]) && ("c" == e.names[2]));
+	if (e(1.0, 2.0, 3.0) != e(xpr::var<"c"> = 3.0, xpr::var<"a"> = 1, xpr::var<"b"> = 2.0)) {
+		fprintf(stderr, "%d: named binding differs from positional binding\n", __LINE__);
+		failures++;
+	}
+
+	// programs are move-only
+	static_assert(!std::is_copy_constructible_v<xpr::program>);
+	static_assert(std::is_nothrow_move_constructible_v<xpr::program>);
+	static_assert(std::is_nothrow_move_assignable_v<xpr::program>);
+
+	// moving over a live program releases its workspace before the program
+	xpr::program m("x+1", { "x" });
+	m = xpr::program("x*2", { "x" });
+	if (4 != m.eval(std::array { 2.0 })) {
+		fprintf(stderr, "%d: wrong result after move assignment\n", __LINE__);
+		failures++;
+	}
+
+	// sets of expressions, with one block of results per expression
+	const char *exprs[] = { "x+y", "x*y" };
+	const char *names[] = { "x", "y" };
+	xpr::program p(exprs, names);
+	const double xs[] = { 1, 2, 3 };
+	const double ys[] = { 4, 5, 6 };
+	const double *cols[] = { xs, ys };
+	double out[6];
+	double res[2];
+	p.eval_batch(cols, out);
+	p.eval(std::array { 2.0, 5.0 }, res);
+	if ((out[0] != 5) || (out[2] != 9) || (out[3] != 4) || (out[5] != 18) || (res[0] != 7) || (res[1] != 10) || (p.update(1, 6.0) != 8)) {
+		fprintf(stderr, "%d: wrong results of a set of expressions\n", __LINE__);
+		failures++;
+	}
+
+	// invalid expressions and missing values are exceptions
+	bool thrown = false;
+	try {
+		xpr::program bad("1+", { "x" });
+	} catch (const std::system_error &e) {
+		thrown = (EINVAL == e.code().value());
+	}
+	try {
+		xpr::program q("x+y", { "x", "y" });
+		q.eval(std::array { 1.0 });
+		thrown = false;
+	} catch (const std::invalid_argument &) {
+	}
+	if (!thrown) {
+		fprintf(stderr, "%d: errors are not exceptions\n", __LINE__);
+		failures++;
+	}
+
+	exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,181 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+
+/*
+ * win.h
+ *
+ * This file implements the window functions of streams, where the rows of
+ * consecutive evaluations form a time series. Each window function node keeps
+ * the last values of its argument in a ring buffer, so each row costs O(1):
+ *
+ *  wsum, wavg  a running sum of the values, and a count of errors
+ *  wmin, wmax  a monotonic deque of the candidates for the extremum
+ *  lag         the value of the row that is k rows back
+ *
+ * At the start of a stream, the windows cover the rows so far, and lag() is an
+ * error until there are enough rows.
+ */
+
+struct win {
+	uint32_t funid;
+	size_t n;            // the window size, or the distance of lag()
+	size_t cap;          // the size of the ring buffer
+	uint64_t seq;        // the number of rows so far
+	double sum;          // the sum of the values in the window, except errors
+	size_t nerr;         // the number of errors in the window
+	size_t head;         // the first entry of the deque
+	size_t len;          // the number of entries of the deque
+	uint64_t *dseq;      // per deque entry, the row number
+	double *dval;        // per deque entry, the value
+	double ring[];       // the last values, by row number modulo cap
+};
+
+static inline struct win *win_new(uint32_t funid, size_t n)
+{
+	const bool deque = (FUNID(TK_FUN_WMIN) == funid) || (FUNID(TK_FUN_WMAX) == funid);
+	const size_t cap = (FUNID(TK_FUN_LAG) == funid) ? n + 1 : n;
+	const size_t nd = deque ? n : 0;
+	struct win *const w = malloc(sizeof(struct win) + (cap + 2 * nd) * sizeof(double));
+	if (!w)
+		return NULL;
+	w->funid = funid;
+	w->n = n;
+	w->cap = cap;
+	w->dval = &w->ring[cap];
+	w->dseq = (uint64_t *) &w->ring[cap + nd];
+	w->seq = 0;
+	w->sum = 0;
+	w->nerr = 0;
+	w->head = 0;
+	w->len = 0;
+	return w;
+}
+
+static inline void win_reset(struct win *const w)
+{
+	w->seq = 0;
+	w->sum = 0;
+	w->nerr = 0;
+	w->head = 0;
+	w->len = 0;
+}
+
+/*
+ * append the value of the next row, and get the result of that row
+ */
+static inline double win_push(struct win *const w, double x)
+{
+	const size_t pos = w->seq % w->cap;
+	const bool full = w->seq >= w->cap;
+	const double old = full ? w->ring[pos] : 0;
+	w->ring[pos] = x;
+	w->seq++;
+	if (FUNID(TK_FUN_LAG) == w->funid)
+		return (w->seq > w->n) ? w->ring[w->seq % w->cap] : XPR_ERR;
+
+	if (full)
+		w->nerr -= isnan(old);
+	w->nerr += isnan(x);
+	if ((FUNID(TK_FUN_WMIN) == w->funid) || (FUNID(TK_FUN_WMAX) == w->funid)) {
+		const bool max = (FUNID(TK_FUN_WMAX) == w->funid);
+		// at most one entry leaves the window per row
+		if (w->len && (w->dseq[w->head] + w->n <= w->seq)) {
+			w->head = (w->head + 1) % w->n;
+			w->len--;
+		}
+		if (!isnan(x)) {
+			while (w->len) {
+				const double back = w->dval[(w->head + w->len - 1) % w->n];
+				if (max ? (back > x) : (back < x))
+					break;
+				w->len--;
+			}
+			const size_t k = (w->head + w->len++) % w->n;
+			w->dval[k] = x;
+			w->dseq[k] = w->seq;
+		}
+		return w->nerr ? XPR_ERR : w->dval[w->head];
+	}
+
+	// the rounding errors of subtraction accumulate, and infinities do not
+	// cancel, so the sum starts over once per window
+	if ((0 == pos) || (full && isinf(old))) {
+		const size_t m = full ? w->cap : w->seq;
+		w->sum = 0;
+		for (size_t k = 0; k < m; k++)
+			if (!isnan(w->ring[k]))
+				w->sum += w->ring[k];
+	} else {
+		if (full && !isnan(old))
+			w->sum -= old;
+		if (!isnan(x))
+			w->sum += x;
+	}
+	if (w->nerr)
+		return XPR_ERR;
+	if (FUNID(TK_FUN_WAVG) == w->funid)
+		return w->sum / (double) (full ? w->n : w->seq);
+	return w->sum;
+}
+
+static inline void win_free(struct win **const win, size_t nnodes)
+{
+	for (size_t i = 0; win && (i < nnodes); i++)
+		free(win[i]);
+	free(win);
+}
+
+/*
+ * get the windows of all window function nodes, and NULL for other nodes
+ */
+static inline struct win **win_all(const struct xpr_prog *const prog)
+{
+	const struct node *const nodes = prog_nodes(prog);
+	const uint32_t *const args = prog_args(prog);
+	struct win **const win = calloc(prog->nnodes + 1, sizeof(struct win *));
+	if (!win)
+		return NULL;
+	for (size_t i = 0; i < prog->nnodes; i++) {
+		size_t n;
+		if ((OP_FUN != nodes[i].op) || !IS_WINDOW(nodes[i].data.arg[1]))
+			continue;
+		if (!node_window(nodes, args, &nodes[i], &n)) {
+			errno = EINVAL;
+			goto error;
+		}
+		if (!(win[i] = win_new(nodes[i].data.arg[1], n))) {
+			errno = ENOMEM;
+			goto error;
+		}
+	}
+	return win;
+
+error:
+	win_free(win, prog->nnodes);
+	return NULL;
+}
@@ -54,7 +54,17 @@
  * function token ahead of TK_OPEN. The absence of a function token represents
  * the identity function.
  *
+ * The same parser also compiles expressions to programs (see prog.h). In this
+ * case, value tokens refer to program nodes, and instead of computing values,
+ * the reduce operation emits nodes.
+ *
  */
+
+// pthread_setaffinity_np() for XPR_POOL_PIN, before the first system header
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include "xpr.h"
 #include "config.h"
 
@@ -68,6 +78,15 @@
 #include <alloca.h>
 #include <limits.h>
 #include <stdint.h>
+#include <time.h>
+#include <float.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
 
 /*
  * the tok.tag value is a bit field:
@@ -76,16 +95,16 @@
  *  -> NONE
  *     tokens space, eof, error
  *  -> VALUE (only TK_NUM)
- *     bs        = val & 0xf000
+ *     bs        = val & 0xf0000
  *  -> OP
- *     id        = val & 0x00f0
- *     can unary = val & 0x0100
- *     is unary  = val & 0x0200
- *     left as   = val & 0x0400
- *     right as  = val & 0x0800
- *     bs        = val & 0xf000
+ *     id        = val & 0x00ff0
+ *     can unary = val & 0x01000
+ *     is unary  = val & 0x02000
+ *     left as   = val & 0x04000
+ *     right as  = val & 0x08000
+ *     bs        = val & 0xf0000
  *  -> FUNC
- *     id        = val & 0x0ff0
+ *     id        = val & 0x00ff0
  */
 
 #define CLASS_NONE       0x0000
@@ -98,38 +117,53 @@
 #define TK_FUN_BY_ID(id) ((id) << 4 | CLASS_FUNC)
 #define FUNID(tk)        ((tk) >> 4 & 0xff)
 
-#define TK_OP_CAN_UNARY  0x0100
-#define TK_OP_IS_UNARY   0x0200
+#define TK_OP_CAN_UNARY  0x1000
+#define TK_OP_IS_UNARY   0x2000
 
-#define AS_LEFT          0x0400
-#define AS_RIGHT         0x0800
+#define AS_LEFT          0x4000
+#define AS_RIGHT         0x8000
 #define AS_GET(tk)       ((tk) & (AS_LEFT | AS_RIGHT))
 #define AS_SET(as, tk)   ((as) | ((tk) & ~(AS_LEFT | AS_RIGHT)))
 
 #define BS_NONE          0
 #define BS_OPEN          1
-#define BS_PLUS          2
-#define BS_MUL           3
-#define BS_EXP           4
-#define BS_UNARY         5
+#define BS_OR            2
+#define BS_AND           3
+#define BS_NOT           4
+#define BS_CMP           5
+#define BS_PLUS          6
+#define BS_MUL           7
+#define BS_EXP           8
+#define BS_UNARY         9
 
-#define BS_SET(bs, tk)   (((bs) << 12) | ((tk) & 0xfff))
-#define BS_GET(tk)       (((tk) >> 12) & 0xf)
-#define BS_IGN(tk)       ((tk) & 0xfff)
+#define BS_SET(bs, tk)   (((bs) << 16) | ((tk) & 0xffff))
+#define BS_GET(tk)       (((tk) >> 16) & 0xf)
+#define BS_IGN(tk)       ((tk) & 0xffff)
 
 #define TK_NUM           CLASS_VALUE
+#define TK_VAR           (0x10 | CLASS_VALUE)
+#define TK_DEF           (0x20 | CLASS_VALUE)
 #define TK_SPACE         (0x10 | CLASS_NONE)
 #define TK_EOF           (0x20 | CLASS_NONE)
 #define TK_ERR           (0x30 | CLASS_NONE)
 
-#define TK_PLUS          BS_SET(BS_PLUS,  TK_OP_BY_ID(0x1) | AS_LEFT | TK_OP_CAN_UNARY)
-#define TK_MINUS         BS_SET(BS_PLUS,  TK_OP_BY_ID(0x2) | AS_LEFT | TK_OP_CAN_UNARY)
-#define TK_MUL           BS_SET(BS_MUL,   TK_OP_BY_ID(0x3) | AS_LEFT)
-#define TK_DIV           BS_SET(BS_MUL,   TK_OP_BY_ID(0x4) | AS_LEFT)
-#define TK_EXP           BS_SET(BS_EXP,   TK_OP_BY_ID(0x5) | AS_LEFT)
-#define TK_OPEN          BS_SET(BS_OPEN,  TK_OP_BY_ID(0x6) | AS_LEFT)
-#define TK_COMMA         BS_SET(BS_OPEN,  TK_OP_BY_ID(0x7) | AS_LEFT)
-#define TK_CLOSE         BS_SET(BS_NONE,  TK_OP_BY_ID(0x8) | AS_RIGHT)
+#define TK_PLUS          BS_SET(BS_PLUS,  TK_OP_BY_ID(0x01) | AS_LEFT | TK_OP_CAN_UNARY)
+#define TK_MINUS         BS_SET(BS_PLUS,  TK_OP_BY_ID(0x02) | AS_LEFT | TK_OP_CAN_UNARY)
+#define TK_MUL           BS_SET(BS_MUL,   TK_OP_BY_ID(0x03) | AS_LEFT)
+#define TK_DIV           BS_SET(BS_MUL,   TK_OP_BY_ID(0x04) | AS_LEFT)
+#define TK_EXP           BS_SET(BS_EXP,   TK_OP_BY_ID(0x05) | AS_LEFT)
+#define TK_OPEN          BS_SET(BS_OPEN,  TK_OP_BY_ID(0x06) | AS_LEFT)
+#define TK_COMMA         BS_SET(BS_OPEN,  TK_OP_BY_ID(0x07) | AS_LEFT)
+#define TK_CLOSE         BS_SET(BS_NONE,  TK_OP_BY_ID(0x08) | AS_RIGHT)
+#define TK_OR            BS_SET(BS_OR,    TK_OP_BY_ID(0x09) | AS_LEFT)
+#define TK_AND           BS_SET(BS_AND,   TK_OP_BY_ID(0x0a) | AS_LEFT)
+#define TK_NOT           BS_SET(BS_NOT,   TK_OP_BY_ID(0x0b) | AS_RIGHT | TK_OP_IS_UNARY)
+#define TK_LT            BS_SET(BS_CMP,   TK_OP_BY_ID(0x0c) | AS_LEFT)
+#define TK_LE            BS_SET(BS_CMP,   TK_OP_BY_ID(0x0d) | AS_LEFT)
+#define TK_GT            BS_SET(BS_CMP,   TK_OP_BY_ID(0x0e) | AS_LEFT)
+#define TK_GE            BS_SET(BS_CMP,   TK_OP_BY_ID(0x0f) | AS_LEFT)
+#define TK_EQ            BS_SET(BS_CMP,   TK_OP_BY_ID(0x10) | AS_LEFT)
+#define TK_NE            BS_SET(BS_CMP,   TK_OP_BY_ID(0x11) | AS_LEFT)
 
 #define TK_TO_UNARY(tk)  BS_SET(BS_UNARY, AS_SET(AS_RIGHT, (tk) | TK_OP_IS_UNARY))
 #define TK_UMINUS        TK_TO_UNARY(TK_MINUS)
@@ -160,12 +194,23 @@
 #define TK_FUN_SUM       TK_FUN_BY_ID(0x15)
 #define TK_FUN_TAN       TK_FUN_BY_ID(0x16)
 #define TK_FUN_TANH      TK_FUN_BY_ID(0x17)
+#define TK_FUN_SELECT    TK_FUN_BY_ID(0x18)
+#define TK_FUN_WSUM      TK_FUN_BY_ID(0x19)
+#define TK_FUN_WMIN      TK_FUN_BY_ID(0x1a)
+#define TK_FUN_WMAX      TK_FUN_BY_ID(0x1b)
+#define TK_FUN_WAVG      TK_FUN_BY_ID(0x1c)
+#define TK_FUN_LAG       TK_FUN_BY_ID(0x1d)
+#define TK_FUN_POLY      TK_FUN_BY_ID(0x1e)
+#define IS_WINDOW(funid) (((funid) >= FUNID(TK_FUN_WSUM)) && ((funid) <= FUNID(TK_FUN_LAG)))
+#define TK_FUN_USER      TK_FUN_BY_ID(0xff)  // data.fun is the function
 
 
 typedef struct token {
 	int tag;
 	union token_data {
 		double value;
+		uint32_t node;
+		const struct xpr_fun *fun;
 	} data;
 } tok;
 
@@ -173,8 +218,39 @@ typedef double (*fun)(int nargs, const tok *args);
 typedef struct xpr_var var;
 
 #include "dbg.h"
+
+// functions on the parser stack, where TK_COMMA tokens separate the arguments
+#define FUN(name) fun_##name
+#define ARGS tok
+#define ARG(ap, n) (ap[2*(n)].data.value)
+#include "fun.h"
+
+// functions on compiled programs, with contiguous arguments
+#define FUN(name) pfun_##name
+#define ARGS double
+#define ARG(ap, n) (ap[n])
+#include "fun.h"
+
+// functions on compiled programs, in single precision
+#define FUN(name) pfunf_##name
+#define ARGS float
+#define ARG(ap, n) (ap[n])
+#define REAL float
+#define MATH(name) name##f
 #include "fun.h"
 
+#include "prog.h"
+#include "img.h"
+#include "int.h"
+#include "dual.h"
+#include "ival.h"
+#include "arrow.h"
+#include "dict.h"
+#include "win.h"
+#include "interp.h"
+#include "pool.h"
+#include "rules.h"
+
 static inline void next_num(const char **const strp, tok *const out)
 {
 	const char *start = *strp;
@@ -202,7 +278,101 @@ static inline const var *var_find(const var *const vars, const char *name, size_
 
 #define var_conf(v, name) var_find((v), (name), sizeof(name)-1)
 
-static inline void next_ident(const char **const strp, tok *const out, const var *const vars)
+/*
+ * evaluation budget
+ *
+ * The ops limit is a remaining amount, which each operator consumes, and all
+ * other limits are maxima. SIZE_MAX means unlimited. When the evaluation
+ * exceeds a limit, the exceeded flag distinguishes the resulting error from
+ * all other errors.
+ */
+struct budget {
+	size_t len;
+	size_t depth;
+	size_t tokens;
+	size_t args;
+	size_t ops;
+	bool timed;
+	bool exceeded;
+	struct timespec deadline;
+};
+
+#define LIMIT(n) ((n) ? (size_t)(n) : SIZE_MAX)
+
+// longer timeouts, in seconds, are unlimited, so the deadline cannot overflow
+#define TIMEOUT_MAX      (365 * 86400.0)
+
+static inline size_t limit_conf(const var *const v, size_t limit)
+{
+	if (!v || isnan(v->value) || v->value < 0)
+		return limit;
+	if (0 == v->value || v->value >= (double) SIZE_MAX)
+		return SIZE_MAX;
+	return (size_t) v->value;
+}
+
+static inline void budget_init(struct budget *const b, const var *const vars)
+{
+	double timeout = CONFIG_LIMIT_TIMEOUT;
+	b->len    = LIMIT(CONFIG_LIMIT_LEN);
+	b->depth  = LIMIT(CONFIG_LIMIT_DEPTH);
+	b->tokens = LIMIT(CONFIG_LIMIT_TOKENS);
+	b->args   = LIMIT(CONFIG_LIMIT_ARGS);
+	b->ops    = LIMIT(CONFIG_LIMIT_OPS);
+#if CONFIG_DYNAMIC_LIMITS
+	if (vars) {
+		b->len    = limit_conf(var_conf(vars, "$maxlen"),    b->len);
+		b->depth  = limit_conf(var_conf(vars, "$maxdepth"),  b->depth);
+		b->tokens = limit_conf(var_conf(vars, "$maxtokens"), b->tokens);
+		b->args   = limit_conf(var_conf(vars, "$maxargs"),   b->args);
+		b->ops    = limit_conf(var_conf(vars, "$maxops"),    b->ops);
+		const var *dyn_timeout = var_conf(vars, "$timeout");
+		if (dyn_timeout && !isnan(dyn_timeout->value) && dyn_timeout->value >= 0)
+			timeout = dyn_timeout->value;
+	}
+#else
+	(void) vars;
+#endif
+	b->exceeded = false;
+	b->timed = (0 < timeout) && (timeout <= TIMEOUT_MAX);
+	if (b->timed) {
+		clock_gettime(CLOCK_MONOTONIC, &b->deadline);
+		double sec = floor(timeout);
+		b->deadline.tv_sec += (time_t) sec;
+		b->deadline.tv_nsec += (long) ((timeout - sec) * 1e9);
+		if (b->deadline.tv_nsec >= 1000000000L) {
+			b->deadline.tv_sec++;
+			b->deadline.tv_nsec -= 1000000000L;
+		}
+	}
+}
+
+static inline bool budget_exceed(struct budget *const b)
+{
+	b->exceeded = true;
+	return false;
+}
+
+/*
+ * consume one unit of a budget limit, returns false if the limit is exceeded
+ */
+#define budget_take(b, limit) ((0 != (b)->limit--) || budget_exceed(b))
+
+static inline bool budget_op(struct budget *const b)
+{
+	if (!budget_take(b, ops))
+		return false;
+	// reading the clock is expensive, so check the deadline only occasionally
+	if (b->timed && (0 == (b->ops & 0xff))) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((now.tv_sec > b->deadline.tv_sec) || ((now.tv_sec == b->deadline.tv_sec) && (now.tv_nsec >= b->deadline.tv_nsec)))
+			return budget_exceed(b);
+	}
+	return true;
+}
+
+static inline void next_ident(const char **const strp, tok *const out, const var *const vars, const struct xpr_fun *const funs, const struct build *const bld)
 {
 	const char *s = *strp;
 	size_t len = 1;
@@ -210,19 +380,42 @@ static inline void next_ident(const char **const strp, tok *const out, const var
 		len++;
 	*strp = s + len;
 
+	// search identifier in the definitions of the program
+	const struct def *const def = bld ? def_index_find(bld->defs, s, len) : NULL;
+	if (def) {
+		out->tag = TK_DEF;
+		out->data.node = def->node;
+		return;
+	}
+
 	// search identifier in variable list
 	if (NULL != vars) {
 		const var *v = vars;
 		while (NULL != v->name) {
 			if ((strlen(v->name) == len) && (0 == memcmp(v->name, s, len))) {
-				out->tag = TK_NUM;
-				out->data.value = v->value;
+				if (bld) {
+					// the value is unknown until evaluation
+					out->tag = TK_VAR;
+					out->data.node = v - vars;
+				} else {
+					out->tag = TK_NUM;
+					out->data.value = v->value;
+				}
 				return;
 			}
 			v++;
 		}
 	}
 
+	// search identifier in function list
+	for (const struct xpr_fun *f = funs; f && f->name; f++) {
+		if ((strlen(f->name) == len) && (0 == memcmp(f->name, s, len))) {
+			out->tag = TK_FUN_USER;
+			out->data.fun = f;
+			return;
+		}
+	}
+
 	// unknown identifier means error
 	out->tag = TK_ERR;
 
@@ -234,14 +427,18 @@ static inline void next_ident(const char **const strp, tok *const out, const var
 		CNST("e", M_E)
 		break;
 	case 2:
+		CASE("or", TK_OR)
 		CNST("pi", M_PI)
 		break;
 	case 3:
+		CASE("and", TK_AND)
 		CASE("cos", TK_FUN_COS)
 		CASE("exp", TK_FUN_EXP)
+		CASE("lag", TK_FUN_LAG)
 		CASE("log", TK_FUN_LOG)
 		CASE("max", TK_FUN_MAX)
 		CASE("min", TK_FUN_MIN)
+		CASE("not", TK_NOT)
 		CNST("phi", 1.61803398874989484820458683436563811772030917980576)
 		CASE("sin", TK_FUN_SIN)
 		CASE("sum", TK_FUN_SUM)
@@ -254,9 +451,14 @@ static inline void next_ident(const char **const strp, tok *const out, const var
 		CASE("cbrt", TK_FUN_CBRT)
 		CASE("ceil", TK_FUN_CEIL)
 		CASE("cosh", TK_FUN_COSH)
+		CASE("poly", TK_FUN_POLY)
 		CASE("sinh", TK_FUN_SINH)
 		CASE("sqrt", TK_FUN_SQRT)
 		CASE("tanh", TK_FUN_TANH)
+		CASE("wavg", TK_FUN_WAVG)
+		CASE("wmax", TK_FUN_WMAX)
+		CASE("wmin", TK_FUN_WMIN)
+		CASE("wsum", TK_FUN_WSUM)
 		break;
 	case 5:
 		CASE("acosh", TK_FUN_ACOSH)
@@ -266,6 +468,9 @@ static inline void next_ident(const char **const strp, tok *const out, const var
 		CASE("round", TK_FUN_ROUND)
 		CASE("scale", TK_FUN_SCALE)
 		break;
+	case 6:
+		CASE("select", TK_FUN_SELECT)
+		break;
 #	undef CASE
 #	undef CNST
 	}
@@ -284,6 +489,12 @@ static inline void next_operator(const char **const strp, tok *const out)
 	case '(': out->tag = TK_OPEN;  break;
 	case ')': out->tag = TK_CLOSE; break;
 	case ',': out->tag = TK_COMMA; break;
+#	define PAIR(c, tk2, tk1) if ((c) == s[1]) { *strp = s + 2; out->tag = (tk2); } else { out->tag = (tk1); } break;
+	case '<': PAIR('=', TK_LE, TK_LT)
+	case '>': PAIR('=', TK_GE, TK_GT)
+	case '=': PAIR('=', TK_EQ, TK_ERR)
+	case '!': PAIR('=', TK_NE, TK_ERR)
+#	undef PAIR
 	default:  out->tag = TK_ERR;
 	}
 }
@@ -297,7 +508,7 @@ static inline void next_space(const char **const strp, tok *const out)
 	out->tag = TK_SPACE;
 }
 
-static inline void next(const char **const strp, tok *const out, const var *const vars)
+static inline void next(const char **const strp, tok *const out, const var *const vars, const struct xpr_fun *const funs, const struct build *const bld)
 {
 	const char first = **strp;
 	if ('\0' == first)
@@ -305,7 +516,7 @@ static inline void next(const char **const strp, tok *const out, const var *cons
 	else if (('.' == first) || isdigit(first))
 		next_num(strp, out);
 	else if (isalpha(first))
-		next_ident(strp, out, vars);
+		next_ident(strp, out, vars, funs, bld);
 	else if (isspace(first))
 		next_space(strp, out);
 	else
@@ -319,7 +530,15 @@ static inline size_t checkstack(size_t stacksz, size_t sp, size_t i)
 	return sp - i;
 }
 
-static inline size_t reduce_fun(tok *const stack, const size_t stacksz, const size_t sp)
+static inline double fun_user(const struct xpr_fun *const f, size_t nargs, const tok *const ap, double *const av)
+{
+	// the callback expects contiguous arguments
+	for (size_t i = 0; i < nargs; i++)
+		av[i] = ap[2*i].data.value;
+	return f->fun(f->arg, nargs, av);
+}
+
+static inline size_t reduce_fun(tok *const stack, const size_t stacksz, const size_t sp, double *const argv, struct budget *const b, struct build *const bld)
 {
 #	define get(i) (stack[checkstack(stacksz,sp,i)])
 	checkstack(stacksz,sp,0);
@@ -335,6 +554,10 @@ static inline size_t reduce_fun(tok *const stack, const size_t stacksz, const si
 			if (expect_val) {
 				if (CLASS_VALUE != CLASS_GET(get(ntoks).tag))
 					goto error;
+				if (nargs == b->args) {
+					budget_exceed(b);
+					goto error;
+				}
 				nargs++;
 			} else {
 				if (TK_COMMA != get(ntoks).tag)
@@ -357,6 +580,7 @@ static inline size_t reduce_fun(tok *const stack, const size_t stacksz, const si
 
 	// search function token
 	int funid = FUNID(TK_FUN_NONE);
+	const struct xpr_fun *user = NULL;
 	if ((ntoks < sp) && (CLASS_FUNC == CLASS_GET(get(ntoks + 1).tag))) {
 		// skip function token as well
 		ntoks++;
@@ -365,6 +589,31 @@ static inline size_t reduce_fun(tok *const stack, const size_t stacksz, const si
 
 	dbg("fcall funid=%d ntoks=%zu nargs=%zu\n", (int) funid, ntoks, nargs);
 
+	// user-defined functions declare the valid number of arguments
+	if (FUNID(TK_FUN_USER) == funid) {
+		user = get(ntoks).data.fun;
+		if ((nargs < user->minargs) || (nargs > user->maxargs))
+			goto error;
+	}
+
+	// streams keep a window of a constant size for each window function
+	if (bld && IS_WINDOW(funid)) {
+		const struct node *const size = (2 == nargs) ? &bld->nodes[firstarg[2].data.node] : NULL;
+		if (!size || (OP_CONST != size->op) || !WINDOW_OK(size->data.value, FUNID(TK_FUN_LAG) != funid))
+			goto error;
+	}
+
+	if (bld) {
+		if (user)
+			funid = FUN_USER + (user - bld->funs);
+		uint32_t node = build_fun(bld, funid, nargs, firstarg);
+		if (bld->failed)
+			goto error;
+		get(ntoks).tag = BS_SET(bs, TK_NUM);
+		get(ntoks).data.node = node;
+		return ntoks - 1;
+	}
+
 	double val;
 	switch (funid) {
 #	define CASE(tok, fun) case FUNID(tok): val = (fun) (nargs, firstarg); break;
@@ -392,6 +641,14 @@ static inline size_t reduce_fun(tok *const stack, const size_t stacksz, const si
 	CASE(TK_FUN_SQRT,  fun_sqrt)
 	CASE(TK_FUN_TAN,   fun_tan)
 	CASE(TK_FUN_TANH,  fun_tanh)
+	CASE(TK_FUN_SELECT, fun_select)
+	CASE(TK_FUN_WSUM,  fun_wsum)
+	CASE(TK_FUN_WMIN,  fun_wmin)
+	CASE(TK_FUN_WMAX,  fun_wmax)
+	CASE(TK_FUN_WAVG,  fun_wavg)
+	CASE(TK_FUN_LAG,   fun_lag)
+	CASE(TK_FUN_POLY,  fun_poly)
+	case FUNID(TK_FUN_USER): val = fun_user(user, nargs, firstarg, argv); break;
 	default:
 		assert(0 || !!! "unknown function ID");
 		goto error;
@@ -410,15 +667,18 @@ error:
 #	undef get
 }
 
-static inline size_t reduce_step(tok *const stack, const size_t stacksz, const size_t sp)
+static inline size_t reduce_step(tok *const stack, const size_t stacksz, const size_t sp, struct build *const bld)
 {
 #	define get(i) (stack[checkstack(stacksz,sp,i)])
 
-#	define UNARY_REDUCE(tk, op) \
+#	define UNARY_REDUCE(tk, opcode, op) \
 		if ((tk) == get(1).tag) { \
 			if (CLASS_VALUE != CLASS_GET(get(0).tag)) \
 				goto error; \
-			get(1).data.value = op(get(0).data.value); \
+			if (!bld) \
+				get(1).data.value = op(get(0).data.value); \
+			else if (get(1).data.node = build_op(bld, (opcode), get(0).data.node, 0), bld->failed) \
+				goto error; \
 			if (2 > sp) \
 				get(1).tag = BS_SET(BS_NONE, TK_NUM); \
 			else if (BS_IGN(TK_OPEN) == BS_IGN(get(2).tag)) \
@@ -428,10 +688,16 @@ static inline size_t reduce_step(tok *const stack, const size_t stacksz, const s
 			return 1; \
 		}
 
-#	define BINARY_REDUCE_COND(tk, cond, expr) \
+#	define BINARY_REDUCE_COND(tk, opcode, cond, expr) \
 		if ((tk) == get(1).tag) { \
 			if ((CLASS_VALUE != CLASS_GET(get(0).tag)) || (CLASS_VALUE != CLASS_GET(get(2).tag))) \
 				goto error; \
+			if (bld) { \
+				get(2).data.node = build_op(bld, (opcode), get(2).data.node, get(0).data.node); \
+				if (bld->failed) \
+					goto error; \
+				return 2; \
+			} \
 			double l = get(2).data.value; \
 			double r = get(0).data.value; \
 			if (!(cond)) \
@@ -440,25 +706,34 @@ static inline size_t reduce_step(tok *const stack, const size_t stacksz, const s
 			return 2; \
 		}
 
-#	define BINARY_REDUCE(tk, expr) BINARY_REDUCE_COND(tk, true, expr)
+#	define BINARY_REDUCE(tk, opcode, expr) BINARY_REDUCE_COND(tk, opcode, true, expr)
 
 	assert(0 != sp || !!! "cannot reduce an empty stack");
 
 	// check for unary operators
 	if ((1 <= sp) && (CLASS_OP == CLASS_GET(get(1).tag)) && (TK_OP_IS_UNARY & get(1).tag)) {
-		UNARY_REDUCE(TK_UMINUS, -)
-		UNARY_REDUCE(TK_UPLUS,  +)
+		UNARY_REDUCE(TK_UMINUS, OP_NEG, -)
+		UNARY_REDUCE(TK_UPLUS,  OP_POS, +)
+		UNARY_REDUCE(TK_NOT,    OP_NOT, NOT)
 		assert(0 || !!! "unknown unary operator");
 		goto error;
 	}
 
 	// check for binary operators
 	if ((2 <= sp) && (CLASS_OP == CLASS_GET(get(1).tag))) {
-		BINARY_REDUCE(TK_PLUS, l + r)
-		BINARY_REDUCE(TK_MINUS, l - r)
-		BINARY_REDUCE(TK_MUL, l * r)
-		BINARY_REDUCE_COND(TK_DIV, 0 != r, l / r)
-		BINARY_REDUCE_COND(TK_EXP, !isnan(l) && !isnan(r) && ((0 <= l) || (round(r) == r)), pow(l, r))
+		BINARY_REDUCE(TK_PLUS, OP_ADD, l + r)
+		BINARY_REDUCE(TK_MINUS, OP_SUB, l - r)
+		BINARY_REDUCE(TK_MUL, OP_MUL, l * r)
+		BINARY_REDUCE_COND(TK_DIV, OP_DIV, DIV_OK(l, r), l / r)
+		BINARY_REDUCE_COND(TK_EXP, OP_POW, POW_OK(l, r), pow(l, r))
+		BINARY_REDUCE(TK_LT, OP_LT, CMP(l, r, <))
+		BINARY_REDUCE(TK_LE, OP_LE, CMP(l, r, <=))
+		BINARY_REDUCE(TK_GT, OP_GT, CMP(l, r, >))
+		BINARY_REDUCE(TK_GE, OP_GE, CMP(l, r, >=))
+		BINARY_REDUCE(TK_EQ, OP_EQ, CMP(l, r, ==))
+		BINARY_REDUCE(TK_NE, OP_NE, CMP(l, r, !=))
+		BINARY_REDUCE(TK_AND, OP_AND, LOGIC(l, r, &))
+		BINARY_REDUCE(TK_OR, OP_OR, LOGIC(l, r, |))
 		// reachable if stack looks like [ ..., {TK_OPEN or TK_COMMA}, <value> ]
 		goto error;
 	}
@@ -474,11 +749,15 @@ error:
 #	undef get
 }
 
-static inline size_t reduce(tok *const stack, const size_t stacksz, const size_t sp, const int bs)
+static inline size_t reduce(tok *const stack, const size_t stacksz, const size_t sp, const int bs, struct budget *const b, struct build *const bld)
 {
 	size_t delta = 0;
 	while ((delta < sp) && (BS_GET(stack[sp - delta].tag) > bs)) {
-		delta += reduce_step(stack, stacksz, sp - delta);
+		if (!budget_op(b)) {
+			stack[sp].tag = TK_ERR;
+			return 0;
+		}
+		delta += reduce_step(stack, stacksz, sp - delta, bld);
 		assert(delta <= sp || !!! "attempt to make stack more than empty");
 		if ((TK_ERR == stack[sp - delta].tag)) {
 			stack[sp].tag = TK_ERR;
@@ -489,60 +768,33 @@ static inline size_t reduce(tok *const stack, const size_t stacksz, const size_t
 	return delta;
 }
 
-double xpr(const char *str, const var *const vars)
+/*
+ * parse an expression, using the given stack
+ *
+ * When bld is NULL, this function evaluates the expression, and the resulting
+ * token contains its value. Otherwise, this function emits program nodes to
+ * bld, and the resulting token refers to the root node.
+ */
+static inline bool parse(const char *str, const var *const vars, const struct xpr_fun *const funs, tok *const stack, const size_t stacksz, double *const argv, struct budget *const b, struct build *const bld, tok *const res)
 {
-	const size_t len = strlen(str);
-
-	// at most, each character produces a token, and the trailing 0-byte produces an EOF token
-	if (len >= SIZE_MAX / sizeof(tok) - 1)
-		return XPR_ERR;
-	const size_t capacity = sizeof(tok) * (len + 1);
-
 	/*
 	 * This parser iterates over the input string exactly once, from left to
 	 * right. It contains a stack of tokens that represent the already-parsed
 	 * input string.
 	 */
-	tok *stack;
-
-
-#if CONFIG_STACK_LIMIT == 0
-	bool use_malloc = false;
-#elif CONFIG_STACK_LIMIT == 1
-	bool use_malloc = true;
-#else
-	bool use_malloc = ((size_t)(CONFIG_STACK_LIMIT) - 1) <= len;
-#endif
-
-#if CONFIG_DYNAMIC_STACK_LIMIT
-	const struct xpr_var *dyn_malloc = var_conf(vars, "$malloc");
-	if (dyn_malloc) {
-		if (!isinf(dyn_malloc->value) && !isnan(dyn_malloc->value) && dyn_malloc->value >= 0)
-			use_malloc = ((size_t)(dyn_malloc->value) - 1) <= len;
-	}
-#endif
-
-
-	if (use_malloc)
-		stack = malloc(capacity);
-	else
-		stack = alloca(capacity);
-
-	if (!stack)
-		goto error;
-
-	double result = 0;
-
-	const size_t stacksz = len + 1;
 	size_t sp = 0;
+	size_t depth = 0;
 #	define get(i) (stack[checkstack(stacksz,sp,i)])
 #	define cur get(0)
 	int bs = BS_NONE;
 	while (1) {
 		dbg("sp=%zu { ", sp); for (size_t i = 0; i < sp; i++) dbg_dump_tok(NULL, &stack[i], " "); dbg("}, bs=%d\n", bs);
-		next(&str, &cur, vars);
+		next(&str, &cur, vars, funs, bld);
 		dbg_dump_tok("next", &cur, "\n");
 
+		if ((TK_SPACE != cur.tag) && (TK_EOF != cur.tag) && !budget_take(b, tokens))
+			goto error;
+
 		if (TK_ERR == cur.tag) {
 			goto error;
 		} else if (TK_SPACE == cur.tag) {
@@ -553,15 +805,25 @@ double xpr(const char *str, const var *const vars)
 			if (0 == sp)
 				goto error;
 			sp--; // pop EOF token
-			sp -= reduce(stack, stacksz, sp, BS_NONE);
+			sp -= reduce(stack, stacksz, sp, BS_NONE, b, bld);
 			// reduction to BS_NONE enforces evaluation of all operators,
 			// leaving only one value token on the stack.
-			if ((0 == sp) && (CLASS_VALUE == CLASS_GET(cur.tag))) {
-				result = cur.data.value;
-				goto out;
+			if ((0 == sp) && (CLASS_VALUE == CLASS_GET(cur.tag)) && (bld || !isnan(cur.data.value))) {
+				*res = cur;
+				return true;
 			}
 			goto error;
 		} else if (CLASS_VALUE == CLASS_GET(cur.tag)) {
+			if (bld) {
+				// definitions already refer to a node
+				if (TK_VAR == cur.tag)
+					cur.data.node = build_var(bld, cur.data.node);
+				else if (TK_NUM == cur.tag)
+					cur.data.node = build_const(bld, cur.data.value);
+				cur.tag = TK_NUM;
+				if (bld->failed)
+					goto error;
+			}
 			// store the current BS in the value token
 			cur.tag = BS_SET(bs, cur.tag);
 			sp++;
@@ -574,27 +836,32 @@ double xpr(const char *str, const var *const vars)
 			cur.tag = BS_SET(bs, cur.tag);
 			sp++;
 			bs = BS_OPEN;
+			if (depth++ == b->depth) {
+				budget_exceed(b);
+				goto error;
+			}
 		} else if (TK_CLOSE == cur.tag) {
 			// TK_CLOSE must not be the first token
 			if (0 == sp)
 				goto error;
 			// reduce last function argument
 			if ((BS_IGN(TK_OPEN) != BS_IGN(get(1).tag))) {
-				sp -= reduce(stack, stacksz, sp - 1, BS_OPEN);
+				sp -= reduce(stack, stacksz, sp - 1, BS_OPEN, b, bld);
 				if (TK_ERR == cur.tag)
 					goto error;
 			}
 			// reduce the function call
-			size_t delta = reduce_fun(stack, stacksz, sp);
+			size_t delta = reduce_fun(stack, stacksz, sp, argv, b, bld);
 			sp -= delta;
 			if (TK_ERR == cur.tag)
 				goto error;
+			depth--;
 		} else if (TK_COMMA == cur.tag) {
 			// TK_COMMA must not be the first token
 			if (0 == sp)
 				goto error;
 			// reduce argument before comma
-			size_t delta = reduce(stack, stacksz, sp - 1, BS_OPEN);
+			size_t delta = reduce(stack, stacksz, sp - 1, BS_OPEN, b, bld);
 			if (delta)
 				get(delta) = cur;
 			sp -= delta;
@@ -609,14 +876,20 @@ double xpr(const char *str, const var *const vars)
 				// get(1) can be either a value, or TK_OPEN, or any other operator
 				if ((0 == sp) || (CLASS_OP == CLASS_GET(get(1).tag)))
 					cur.tag = TK_TO_UNARY(cur.tag); // update IS_UNARY, BS, and AS
+			} else if (cur.tag & TK_OP_IS_UNARY) {
+				// prefix operators only follow operators that bind less tightly
+				if ((0 != sp) && (BS_IGN(TK_OPEN) != BS_IGN(get(1).tag)) && (TK_COMMA != get(1).tag)
+						&& ((CLASS_OP != CLASS_GET(get(1).tag)) || (BS_GET(get(1).tag) > BS_GET(cur.tag))))
+					goto error;
 			} else if (0 == sp) {
 				goto error;
 			}
 
-			if (0 != sp) {
+			// there is nothing to reduce before a prefix operator
+			if ((0 != sp) && !(cur.tag & TK_OP_IS_UNARY)) {
 				// when left-associative, also reduce values with same bs
 				bool left_assoc = (AS_LEFT == AS_GET(cur.tag));
-				size_t delta = reduce(stack, stacksz, sp - 1, BS_GET(cur.tag) - (left_assoc ? 1 : 0));
+				size_t delta = reduce(stack, stacksz, sp - 1, BS_GET(cur.tag) - (left_assoc ? 1 : 0), b, bld);
 				if (delta) {
 					get(delta) = cur;
 				}
@@ -634,13 +907,1488 @@ double xpr(const char *str, const var *const vars)
 #	undef get
 
 error:
-	result = XPR_ERR;
-out:
+	return false;
+}
+
+/*
+ * get the number of tokens that the parser stack must hold, or 0 on error
+ */
+static inline size_t stack_size(const char *str, struct budget *const b)
+{
+	// do not read beyond the length limit
+	const size_t len = (SIZE_MAX == b->len) ? strlen(str) : strnlen(str, b->len + 1);
+	if (len > b->len)
+		return budget_exceed(b);
+
+	// at most, each character produces a token, and the trailing 0-byte produces an EOF token,
+	// and the stack has room for the arguments of a function call as well
+	if (len >= SIZE_MAX / (sizeof(tok) + sizeof(double)) - 1)
+		return 0;
+	// the token limit bounds the stack size as well
+	return ((len < b->tokens) ? len : b->tokens) + 1;
+}
+
+static double xpr_program(const char *str, const var *const vars, const struct xpr_fun *const funs);
+
+double xpr_ext(const char *str, const var *const vars, const struct xpr_fun *const funs)
+{
+	struct budget b;
+	budget_init(&b, vars);
+
+	const size_t stacksz = stack_size(str, &b);
+	if (0 == stacksz)
+		return b.exceeded ? XPR_ERR_LIMIT : XPR_ERR;
+	const size_t ntoks = stacksz - 1;
+	// the arguments of user-defined functions follow the stack, each one takes at least two tokens
+	const size_t capacity = sizeof(tok) * stacksz + sizeof(double) * (stacksz / 2 + 1);
+
+	// programs with definitions need the compiler
+	if (strchr(str, ';'))
+		return xpr_program(str, vars, funs);
+
+	tok *stack;
+
+#if CONFIG_STACK_LIMIT == 0
+	bool use_malloc = false;
+#elif CONFIG_STACK_LIMIT == 1
+	bool use_malloc = true;
+#else
+	bool use_malloc = ((size_t)(CONFIG_STACK_LIMIT) - 1) <= ntoks;
+#endif
+
+#if CONFIG_DYNAMIC_STACK_LIMIT
+	const struct xpr_var *dyn_malloc = var_conf(vars, "$malloc");
+	if (dyn_malloc) {
+		if (!isinf(dyn_malloc->value) && !isnan(dyn_malloc->value) && dyn_malloc->value >= 0)
+			use_malloc = ((size_t)(dyn_malloc->value) - 1) <= ntoks;
+	}
+#endif
+
+
+	if (use_malloc)
+		stack = malloc(capacity);
+	else
+		stack = alloca(capacity);
+
+	if (!stack)
+		return XPR_ERR;
+
+	double result;
+	tok res;
+	if (parse(str, vars, funs, stack, stacksz, (double *) (stack + stacksz), &b, NULL, &res))
+		result = res.data.value;
+	else
+		result = b.exceeded ? XPR_ERR_LIMIT : XPR_ERR;
+
 	if (use_malloc)
 		free(stack);
 	return result;
 }
 
+double xpr(const char *str, const var *const vars)
+{
+	return xpr_ext(str, vars, NULL);
+}
+
+double xpr_interp(void *arg, size_t nargs, const double *args)
+{
+	return (1 == nargs) ? interp_eval(arg, args[0], true) : XPR_ERR;
+}
+
+void xpr_interp_batch(void *arg, size_t nargs, const double *const *args, size_t n, double *out)
+{
+	for (size_t i = 0; i < n; i++)
+		out[i] = (1 == nargs) ? interp_eval(arg, args[0][i], true) : XPR_ERR;
+}
+
+double xpr_step(void *arg, size_t nargs, const double *args)
+{
+	return (1 == nargs) ? interp_eval(arg, args[0], false) : XPR_ERR;
+}
+
+void xpr_step_batch(void *arg, size_t nargs, const double *const *args, size_t n, double *out)
+{
+	for (size_t i = 0; i < n; i++)
+		out[i] = (1 == nargs) ? interp_eval(arg, args[0][i], false) : XPR_ERR;
+}
+
+/*
+ * check whether a statement is a definition, i.e., <name> = <expr>
+ */
+static inline bool stmt_def(const char *stmt, struct def *const def)
+{
+	while (isspace(*stmt))
+		stmt++;
+	if (!isalpha(*stmt))
+		return false;
+	def->name = stmt;
+	while (isalnum(*stmt))
+		stmt++;
+	def->len = stmt - def->name;
+	while (isspace(*stmt))
+		stmt++;
+	if (('=' != stmt[0]) || ('=' == stmt[1]))
+		return false;
+	def->expr = stmt + 1;
+	def->node = NONE;
+	return true;
+}
+
+struct def_deps {
+	const struct def_index *ix;
+	size_t ndefs;
+	uint32_t *deps;
+	size_t ndeps;
+	size_t depcap;
+	bool failed;
+};
+
+static int def_dep(void *arg, const char *name, size_t len, int kind)
+{
+	struct def_deps *dd = arg;
+	const struct def *def = def_index_find(dd->ix, name, len);
+	(void) kind;
+	if (!def)
+		return 0;
+	if (!build_grow((void **) &dd->deps, &dd->depcap, dd->ndeps + 1, sizeof(uint32_t))) {
+		dd->failed = true;
+		return 1;
+	}
+	dd->deps[dd->ndeps++] = def - dd->ix->defs;
+	return 0;
+}
+
+/*
+ * sort definitions such that each definition follows all definitions it
+ * refers to, returns false for cyclic definitions
+ */
+static inline bool def_sort(struct def_deps *const dd, uint32_t *const order)
+{
+	const size_t ndefs = dd->ndefs;
+	uint32_t *off = malloc((ndefs + 1) * sizeof(uint32_t));
+	uint32_t *pos = malloc((ndefs + 1) * sizeof(uint32_t));
+	uint32_t *stack = malloc((ndefs + 1) * sizeof(uint32_t));
+	uint8_t *state = calloc(ndefs + 1, 1);  // 0: new, 1: active, 2: done
+	bool ok = false;
+	if (!off || !pos || !stack || !state) {
+		dd->failed = true;
+		goto out;
+	}
+
+	// collect the definitions that each definition refers to
+	for (size_t i = 0; i < ndefs; i++) {
+		off[i] = dd->ndeps;
+		xpr_list_idents(dd->ix->defs[i].expr, def_dep, dd);
+		if (dd->failed)
+			goto out;
+	}
+	off[ndefs] = dd->ndeps;
+
+	// depth-first search, emitting each definition after its dependencies
+	size_t n = 0;
+	for (size_t i = 0; i < ndefs; i++) {
+		if (state[i])
+			continue;
+		size_t sp = 0;
+		stack[sp++] = i;
+		state[i] = 1;
+		pos[i] = off[i];
+		while (sp) {
+			const uint32_t t = stack[sp - 1];
+			if (pos[t] == off[t + 1]) {
+				state[t] = 2;
+				order[n++] = t;
+				sp--;
+				continue;
+			}
+			const uint32_t u = dd->deps[pos[t]++];
+			if (1 == state[u])
+				goto out;
+			if (0 == state[u]) {
+				state[u] = 1;
+				pos[u] = off[u];
+				stack[sp++] = u;
+			}
+		}
+	}
+	ok = true;
+out:
+	free(state);
+	free(stack);
+	free(pos);
+	free(off);
+	return ok;
+}
+
+/*
+ * compile a program with definitions, which has the form
+ *   <name> = <expr> ; ... ; <name> = <expr> ; <expr>
+ *
+ * The definitions can appear in any order, and each definition can refer to
+ * all other definitions, unless the references form a cycle. The last
+ * expression is the result.
+ */
+static inline bool compile_defs(struct build *const bld, const char *str, const var *const vars, tok *const stack, const size_t stacksz, struct budget *const b, uint32_t *const root)
+{
+	// split the program into null-terminated statements
+	char *buf = strdup(str);
+	size_t nstmts = 1;
+	for (const char *p = str; *p; p++)
+		nstmts += (';' == *p);
+	struct def *defs = malloc(nstmts * sizeof(struct def));
+	uint32_t *order = malloc(nstmts * sizeof(uint32_t));
+	struct def_index ix = { .slot = NULL };
+	struct def_deps dd = { .ix = &ix, .ndefs = nstmts - 1 };
+	const char *result = NULL;
+	bool ok = false;
+	if (!buf || !defs || !order || !def_index_init(&ix, defs)) {
+		bld->failed = true;
+		goto out;
+	}
+	char *stmt = buf;
+	for (size_t i = 0; i < nstmts; i++) {
+		char *end = strchr(stmt, ';');
+		if (end)
+			*end = '\0';
+		if (i + 1 < nstmts) {
+			if (!stmt_def(stmt, &defs[i]) || !def_index_add(&ix, &bld->failed))
+				goto out;
+		} else {
+			result = stmt;
+		}
+		if (end)
+			stmt = end + 1;
+	}
+
+	if (!def_sort(&dd, order)) {
+		bld->failed = dd.failed;
+		goto out;
+	}
+
+	// definitions are visible to the lexer, and have a node once compiled
+	bld->defs = &ix;
+	tok res;
+	for (size_t i = 0; i < dd.ndefs; i++) {
+		if (!parse(defs[order[i]].expr, vars, bld->funs, stack, stacksz, NULL, b, bld, &res))
+			goto out;
+		defs[order[i]].node = res.data.node;
+	}
+	if (!parse(result, vars, bld->funs, stack, stacksz, NULL, b, bld, &res))
+		goto out;
+	*root = res.data.node;
+	ok = true;
+
+out:
+	bld->defs = NULL;
+	free(ix.slot);
+	free(dd.deps);
+	free(order);
+	free(defs);
+	free(buf);
+	return ok;
+}
+
+/*
+ * compile an expression or a program to the builder, and get its root node
+ */
+static inline bool compile(struct build *const bld, const char *str, const var *const vars, uint32_t *const root)
+{
+	struct budget b;
+	budget_init(&b, vars);
+
+	const size_t stacksz = stack_size(str, &b);
+	if (0 == stacksz) {
+		errno = b.exceeded ? E2BIG : EINVAL;
+		return false;
+	}
+
+	tok *stack = malloc(sizeof(tok) * stacksz);
+	tok res;
+	bool ok = false;
+	if (!stack)
+		bld->failed = true;
+	else if (bld->failed)
+		;
+	else if (strchr(str, ';'))
+		ok = compile_defs(bld, str, vars, stack, stacksz, &b, root);
+	else if ((ok = parse(str, vars, bld->funs, stack, stacksz, NULL, &b, bld, &res)))
+		*root = res.data.node;
+	free(stack);
+
+	if (!ok)
+		errno = bld->failed ? ENOMEM : b.exceeded ? E2BIG : EINVAL;
+	return ok;
+}
+
+struct xpr_prog *xpr_compile_ext(const char *const *exprs, size_t nexprs, const var *const vars, const struct xpr_fun *const funs)
+{
+	struct xpr_prog *prog = NULL;
+	uint32_t *roots = malloc((nexprs + 1) * sizeof(uint32_t));
+	struct build bld;
+	build_init(&bld, vars, funs);
+	bld.poly = CONFIG_POLY;
+#if CONFIG_DYNAMIC_POLY
+	const var *dyn_poly = var_conf(vars, "$poly");
+	if (dyn_poly && !isnan(dyn_poly->value))
+		bld.poly = (0 != dyn_poly->value);
+#endif
+	if (!roots || bld.failed) {
+		errno = ENOMEM;
+		goto out;
+	}
+	if ((0 == nexprs) || (nexprs >= NONE)) {
+		errno = EINVAL;
+		goto out;
+	}
+	for (size_t i = 0; i < nexprs; i++)
+		if (!compile(&bld, exprs[i], vars, &roots[i]))
+			goto out;
+	prog = build_prog(&bld, roots, nexprs);
+	if (!prog)
+		errno = ENOMEM;
+out:
+	build_free(&bld);
+	free(roots);
+	return prog;
+}
+
+struct xpr_prog *xpr_compile_set(const char *const *exprs, size_t nexprs, const var *const vars)
+{
+	return xpr_compile_ext(exprs, nexprs, vars, NULL);
+}
+
+struct xpr_prog *xpr_compile(const char *str, const var *const vars)
+{
+	return xpr_compile_ext(&str, 1, vars, NULL);
+}
+
+void xpr_prog_free(struct xpr_prog *prog)
+{
+	free(prog);
+}
+
+struct xpr_ws *xpr_ws_new(const struct xpr_prog *prog)
+{
+	struct xpr_ws *ws = malloc(sizeof(struct xpr_ws) + prog->nnodes * sizeof(double));
+	void *argv = malloc((prog_max_args(prog) + 1) * ARGV_SIZE);
+	bool *user = malloc(prog->nnodes + 1);
+	if (!ws || !argv || !user) {
+		free(ws);
+		free(argv);
+		free(user);
+		return NULL;
+	}
+	ws->prog = prog;
+	ws->blk = NULL;
+	ws->blkf = NULL;
+	ws->blkvar = NULL;
+	ws->blkcols = NULL;
+	ws->blki = NULL;
+	ws->blkbad = NULL;
+	ws->blkdot = NULL;
+	ws->nwrt = 0;
+	ws->ival = NULL;
+	ws->win = NULL;
+	ws->nwin = prog->nnodes;
+	ws->argv = argv;
+	ws->isint = prog_is_int(prog);
+	// all variables are undefined until the first evaluation, without calling user-defined functions
+	prog_init(prog, ws->val, user, ws->argv);
+	free(user);
+	return ws;
+}
+
+void xpr_ws_free(struct xpr_ws *ws)
+{
+	if (ws) {
+		free(ws->blk);
+		free(ws->blkf);
+		free(ws->blkvar);
+		free(ws->blkcols);
+		free(ws->blki);
+		free(ws->blkbad);
+		free(ws->blkdot);
+		free(ws->ival);
+		free(ws->argv);
+		win_free(ws->win, ws->nwin);
+	}
+	free(ws);
+}
+
+static inline double ws_result(const struct xpr_ws *const ws, size_t i)
+{
+	const double result = ws->val[prog_roots(ws->prog)[i]];
+	return isnan(result) ? XPR_ERR : result;
+}
+
+double xpr_eval(struct xpr_ws *ws, const double *values)
+{
+	prog_run(ws->prog, ws->val, values, ws->argv);
+	return ws_result(ws, 0);
+}
+
+void xpr_results(const struct xpr_ws *ws, double *out)
+{
+	for (size_t i = 0; i < ws->prog->nroots; i++)
+		out[i] = ws_result(ws, i);
+}
+
+void xpr_eval_set(struct xpr_ws *ws, const double *values, double *out)
+{
+	prog_run(ws->prog, ws->val, values, ws->argv);
+	xpr_results(ws, out);
+}
+
+double xpr_eval_resolve(struct xpr_ws *ws, xpr_resolve_cb cb, void *arg)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	const struct node *const nodes = prog_nodes(prog);
+	const uint32_t *const args = prog_args(prog);
+	// each live slot has exactly one node, so the callback runs once per slot
+	for (size_t i = 0; i < prog->nnodes; i++) {
+		if (OP_VAR == nodes[i].op)
+			ws->val[i] = cb(arg, nodes[i].data.slot);
+		else
+			ws->val[i] = node_eval(&nodes[i], args, ws->val, prog->ext.funs, ws->argv);
+	}
+	return ws_result(ws, 0);
+}
+
+int xpr_eval_batch(struct xpr_ws *ws, const double *const *cols, size_t n, double *const *out)
+{
+	if (!ws->blk && !(ws->blk = malloc(ws->prog->nnodes * BLOCK * sizeof(double))))
+		return -1;
+	prog_run_rows(ws->prog, ws->blk, cols, 0, n, out, ws->argv);
+	return 0;
+}
+
+size_t xpr_filter(struct xpr_ws *ws, const double *const *cols, size_t n, uint64_t *bitmap, size_t *index)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	if (!ws->blk && !(ws->blk = malloc(prog->nnodes * BLOCK * sizeof(double)))) {
+		errno = ENOMEM;
+		return SIZE_MAX;
+	}
+	size_t count = 0;
+	const double *const res = &ws->blk[prog_roots(prog)[0] * (size_t) BLOCK];
+	for (size_t first = 0; first < n; first += BLOCK) {
+		const size_t rows = (n - first < BLOCK) ? n - first : BLOCK;
+		prog_run_block(prog, ws->blk, cols, first, rows, ws->argv);
+		// branchless compaction, the index entry is overwritten unless selected
+		uint64_t word = 0;
+		for (size_t j = 0; j < rows; j++) {
+			const bool sel = !isnan(res[j]) && (0 != res[j]);
+			word |= (uint64_t) sel << j;
+			if (index)
+				index[count] = first + j;
+			count += sel;
+		}
+		// BLOCK is 64, so each block fills one word
+		if (bitmap)
+			bitmap[first / BLOCK] = word;
+	}
+	return count;
+}
+
+/*
+ * the sum of a block of results, except errors, by pairwise summation
+ */
+static inline double block_sum(const double *const res, size_t rows)
+{
+	double t[BLOCK];
+	for (size_t j = 0; j < rows; j++)
+		t[j] = isnan(res[j]) ? 0 : res[j];
+	for (size_t w = rows; w > 1; w = (w + 1) / 2) {
+		for (size_t j = 0; j < w / 2; j++)
+			t[j] = t[2 * j] + t[2 * j + 1];
+		if (w % 2)
+			t[w / 2] = t[w - 1];
+	}
+	return rows ? t[0] : 0;
+}
+
+int xpr_eval_agg(struct xpr_ws *ws, const double *const *cols, size_t n, int flags, struct xpr_agg *agg)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	if (!ws->blk && !(ws->blk = malloc(prog->nnodes * BLOCK * sizeof(double))))
+		return -1;
+	// the compensations, on the heap, because programs may have many expressions
+	double *const comp = (flags & XPR_AGG_KAHAN) ? calloc(prog->nroots, sizeof(double)) : NULL;
+	if ((flags & XPR_AGG_KAHAN) && !comp)
+		return -1;
+	for (size_t r = 0; r < prog->nroots; r++)
+		agg[r] = (struct xpr_agg) { 0, INFINITY, -INFINITY, 0, 0 };
+	for (size_t first = 0; first < n; first += BLOCK) {
+		const size_t rows = (n - first < BLOCK) ? n - first : BLOCK;
+		prog_run_block(prog, ws->blk, cols, first, rows, ws->argv);
+		for (size_t r = 0; r < prog->nroots; r++) {
+			const double *const res = &ws->blk[prog_roots(prog)[r] * (size_t) BLOCK];
+			struct xpr_agg *const a = &agg[r];
+			size_t nerr = 0;
+			for (size_t j = 0; j < rows; j++) {
+				nerr += isnan(res[j]);
+				// comparisons with errors are false
+				a->min = (res[j] < a->min) ? res[j] : a->min;
+				a->max = (res[j] > a->max) ? res[j] : a->max;
+			}
+			a->count += rows - nerr;
+			a->nerr += nerr;
+			const double s = block_sum(res, rows);
+			if (flags & XPR_AGG_KAHAN) {
+				// Neumaier's variant of compensated summation
+				const double t = a->sum + s;
+				if (isfinite(t))
+					comp[r] += (fabs(a->sum) >= fabs(s)) ? (a->sum - t) + s : (s - t) + a->sum;
+				a->sum = t;
+			} else {
+				a->sum += s;
+			}
+		}
+	}
+	for (size_t r = 0; r < prog->nroots; r++) {
+		agg[r].sum += comp ? comp[r] : 0;
+		if (0 == agg[r].count)
+			agg[r].min = agg[r].max = XPR_ERR;
+	}
+	free(comp);
+	return 0;
+}
+
+int xpr_eval_hist(struct xpr_ws *ws, const double *const *cols, size_t n, double lo, double hi, size_t nbins, uint64_t *bins)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	if (!(lo < hi) || isinf(hi - lo) || (0 == nbins)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!ws->blk && !(ws->blk = malloc(prog->nnodes * BLOCK * sizeof(double)))) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(bins, 0, nbins * sizeof(uint64_t));
+	const double scale = nbins / (hi - lo);
+	const double *const res = &ws->blk[prog_roots(prog)[0] * (size_t) BLOCK];
+	for (size_t first = 0; first < n; first += BLOCK) {
+		const size_t rows = (n - first < BLOCK) ? n - first : BLOCK;
+		prog_run_block(prog, ws->blk, cols, first, rows, ws->argv);
+		for (size_t j = 0; j < rows; j++) {
+			// errors and values out of range fail the comparison
+			if (!((res[j] >= lo) && (res[j] < hi)))
+				continue;
+			const size_t k = (size_t) ((res[j] - lo) * scale);
+			bins[(k < nbins) ? k : nbins - 1]++;
+		}
+	}
+	return 0;
+}
+
+void xpr_rules_free(struct xpr_rules *rules)
+{
+	if (!rules)
+		return;
+	for (size_t i = 0; i < rules->ngroups; i++) {
+		struct rule_group *const g = &rules->groups[i];
+		xpr_ws_free(g->ws);
+		xpr_prog_free(g->prog);
+		free(g->params);
+		free(g->rules);
+		free(g->cols);
+		free(g->order);
+	}
+	free(rules->groups);
+	free(rules);
+}
+
+struct xpr_rules *xpr_rules_compile(const char *const *exprs, size_t n, const var *vars, const struct xpr_fun *funs)
+{
+	if (0 == n) {
+		errno = EINVAL;
+		return NULL;
+	}
+	size_t hashcap = 16;
+	while (hashcap < 2 * n)
+		hashcap *= 2;
+	struct xpr_rules *rules = calloc(1, sizeof(struct xpr_rules));
+	uint32_t *hash = malloc(hashcap * sizeof(uint32_t));
+	uint64_t *hashes = malloc(n * sizeof(uint64_t));
+	double *params = NULL;
+	if (!rules || !hash || !hashes || !(rules->groups = calloc(n, sizeof(struct rule_group))))
+		goto nomem;
+	memset(hash, 0xff, hashcap * sizeof(uint32_t));
+	rules->nrules = n;
+	for (size_t i = 0; i < n; i++) {
+		struct xpr_prog *prog = xpr_compile_ext(&exprs[i], 1, vars, funs);
+		if (!prog)
+			goto fail;
+		rules->nvars = prog->nvars;
+		size_t np = 0;
+		double *p = realloc(params, (prog->nnodes + 1) * sizeof(double));
+		struct xpr_prog *tmpl = p ? rule_param(prog, (params = p), &np) : NULL;
+		xpr_prog_free(prog);
+		if (!tmpl)
+			goto nomem;
+
+		// find the group of the same program, or start a new group
+		const uint64_t h = rule_hash(tmpl);
+		size_t k = h & (hashcap - 1);
+		for (; NONE != hash[k]; k = (k + 1) & (hashcap - 1))
+			if ((hashes[hash[k]] == h) && rule_same(rules->groups[hash[k]].prog, tmpl))
+				break;
+		struct rule_group *g;
+		if (NONE != hash[k]) {
+			g = &rules->groups[hash[k]];
+			xpr_prog_free(tmpl);
+		} else {
+			hashes[rules->ngroups] = h;
+			hash[k] = rules->ngroups;
+			g = &rules->groups[rules->ngroups++];
+			g->prog = tmpl;
+			g->nparams = np;
+		}
+		if (!rule_add(g, i, params))
+			goto nomem;
+	}
+	for (size_t i = 0; i < rules->ngroups; i++)
+		if (!rule_finish(&rules->groups[i], rules->nvars))
+			goto nomem;
+	free(params);
+	free(hashes);
+	free(hash);
+	return rules;
+nomem:
+	errno = ENOMEM;
+fail:
+	free(params);
+	free(hashes);
+	free(hash);
+	xpr_rules_free(rules);
+	return NULL;
+}
+
+size_t xpr_rules_groups(const struct xpr_rules *rules)
+{
+	return rules->ngroups;
+}
+
+int xpr_rules_eval(struct xpr_rules *rules, const double *values, double *out)
+{
+	for (size_t i = 0; i < rules->ngroups; i++) {
+		struct rule_group *const g = &rules->groups[i];
+		for (size_t s = 0; s < rules->nvars; s++)
+			g->cols[s] = &values[s];
+		rule_run(g, out);
+	}
+	return 0;
+}
+
+int xpr_eval_stream(struct xpr_ws *ws, const double *const *cols, size_t n, double *const *out)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	if (!ws->win && !(ws->win = win_all(prog)))
+		return -1;
+	if (!ws->blk && !(ws->blk = malloc(prog->nnodes * BLOCK * sizeof(double)))) {
+		errno = ENOMEM;
+		return -1;
+	}
+	const struct node *const nodes = prog_nodes(prog);
+	const uint32_t *const args = prog_args(prog);
+	for (size_t first = 0; first < n; first += BLOCK) {
+		const size_t rows = (n - first < BLOCK) ? n - first : BLOCK;
+		for (size_t i = 0; i < prog->nnodes; i++) {
+			if (!ws->win[i]) {
+				node_run_block(prog, i, ws->blk, cols, first, rows, ws->argv);
+				continue;
+			}
+			// the rows of a window function depend on each other
+			const double *const x = &ws->blk[args[nodes[i].data.arg[0]] * (size_t) BLOCK];
+			double *const v = &ws->blk[i * BLOCK];
+			for (size_t j = 0; j < rows; j++)
+				v[j] = win_push(ws->win[i], x[j]);
+		}
+		for (size_t r = 0; r < prog->nroots; r++) {
+			const double *const res = &ws->blk[prog_roots(prog)[r] * (size_t) BLOCK];
+			for (size_t j = 0; j < rows; j++)
+				out[r][first + j] = isnan(res[j]) ? XPR_ERR : res[j];
+		}
+	}
+	return 0;
+}
+
+struct xpr_pool *xpr_pool_new(size_t nthreads, int flags)
+{
+	if (0 == nthreads) {
+		const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = (ncpus > 0) ? (size_t) ncpus : 1;
+	}
+	struct xpr_pool *pool = calloc(1, sizeof(struct xpr_pool));
+	if (!pool)
+		return NULL;
+	pool->nthreads = nthreads;
+	pool->threads = calloc(nthreads, sizeof(pthread_t));
+	pool->queues = calloc(nthreads, sizeof(struct pool_queue));
+	pool->scratch = calloc(nthreads, sizeof(struct pool_scratch));
+	if (!pool->threads || !pool->queues || !pool->scratch) {
+		free(pool->threads);
+		free(pool->queues);
+		free(pool->scratch);
+		free(pool);
+		errno = ENOMEM;
+		return NULL;
+	}
+	pthread_mutex_init(&pool->busy, NULL);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for (size_t k = 0; k < nthreads; k++)
+		pthread_mutex_init(&pool->queues[k].lock, NULL);
+	// the calling thread is worker 0, the pool starts the others
+	for (size_t k = 1; k < nthreads; k++) {
+		struct pool_arg *arg = malloc(sizeof(struct pool_arg));
+		int err = arg ? 0 : ENOMEM;
+		if (arg) {
+			*arg = (struct pool_arg) { pool, k };
+			if ((err = pthread_create(&pool->threads[k], NULL, pool_thread, arg)))
+				free(arg);
+		}
+		if (!err && (flags & XPR_POOL_PIN) && (err = pool_pin(pool->threads[k], k)))
+			k++;
+		if (err) {
+			pool->nthreads = k;
+			xpr_pool_free(pool);
+			errno = err;
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+void xpr_pool_free(struct xpr_pool *pool)
+{
+	if (!pool)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for (size_t k = 1; k < pool->nthreads; k++)
+		pthread_join(pool->threads[k], NULL);
+	for (size_t k = 0; k < pool->nthreads; k++) {
+		pthread_mutex_destroy(&pool->queues[k].lock);
+		free(pool->scratch[k].blk);
+		free(pool->scratch[k].argv);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_mutex_destroy(&pool->busy);
+	free(pool->scratch);
+	free(pool->queues);
+	free(pool->threads);
+	free(pool);
+}
+
+int xpr_eval_parallel(struct xpr_pool *pool, const struct xpr_prog *prog, const double *const *cols, size_t n, double *const *out)
+{
+	if (!pool || (1 == pool->nthreads)) {
+		struct xpr_ws *ws = xpr_ws_new(prog);
+		const int ret = ws ? xpr_eval_batch(ws, cols, n, out) : -1;
+		xpr_ws_free(ws);
+		if (ret)
+			errno = ENOMEM;
+		return ret;
+	}
+	pthread_mutex_lock(&pool->busy);
+	pool->prog = prog;
+	pool->cols = cols;
+	pool->out = out;
+	pool_split(pool, n);
+	pthread_mutex_lock(&pool->lock);
+	pool->failed = false;
+	pool->running = pool->nthreads - 1;
+	pool->gen++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	pool_work(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->running)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	const bool failed = pool->failed;
+	pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_unlock(&pool->busy);
+	if (failed) {
+		errno = ENOMEM;
+		return -1;
+	}
+	return 0;
+}
+
+void xpr_stream_reset(struct xpr_ws *ws)
+{
+	for (size_t i = 0; ws->win && (i < ws->prog->nnodes); i++)
+		if (ws->win[i])
+			win_reset(ws->win[i]);
+}
+
+int xpr_eval_batchf(struct xpr_ws *ws, const float *const *cols, size_t n, float *const *out)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	if (!ws->blkf && !(ws->blkf = malloc(prog->nnodes * BLOCK * sizeof(float))))
+		return -1;
+	for (size_t first = 0; first < n; first += BLOCK) {
+		const size_t rows = (n - first < BLOCK) ? n - first : BLOCK;
+		prog_run_blockf(prog, ws->blkf, cols, first, rows, ws->argv);
+		for (size_t r = 0; r < prog->nroots; r++) {
+			const float *const res = &ws->blkf[prog_roots(prog)[r] * (size_t) BLOCK];
+			for (size_t j = 0; j < rows; j++)
+				out[r][first + j] = isnan(res[j]) ? XPR_ERR : res[j];
+		}
+	}
+	return 0;
+}
+
+static inline bool ws_int(struct xpr_ws *const ws)
+{
+	const size_t n = ws->prog->nnodes * (size_t) BLOCK;
+	if (!ws->blki && !(ws->blki = malloc(n * sizeof(int64_t))))
+		return false;
+	if (!ws->blkbad && !(ws->blkbad = malloc(n * sizeof(bool))))
+		return false;
+	return true;
+}
+
+int xpr_eval_int(struct xpr_ws *ws, const int64_t *values, int64_t *out)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	const uint32_t *const roots = prog_roots(prog);
+	if (ws->isint) {
+		if (!ws_int(ws))
+			return -1;
+		prog_run_block_int(prog, ws->blki, ws->blkbad, NULL, values, 0, 1);
+		bool exact = true;
+		for (size_t r = 0; r < prog->nroots; r++)
+			exact &= !ws->blkbad[roots[r] * (size_t) BLOCK];
+		if (exact) {
+			for (size_t r = 0; r < prog->nroots; r++)
+				out[r] = ws->blki[roots[r] * (size_t) BLOCK];
+			return 0;
+		}
+	}
+
+	// fall back to double precision
+	double *dv = malloc((prog->nvars + 1) * sizeof(double));
+	if (!dv)
+		return -1;
+	for (size_t i = 0; i < prog->nvars; i++)
+		dv[i] = values[i];
+	prog_run(prog, ws->val, dv, ws->argv);
+	free(dv);
+	return 1;
+}
+
+/*
+ * allocate the buffers of the workspace for blocks of variables that need a
+ * conversion to double, which remain for later evaluations
+ */
+static inline bool ws_convert(struct xpr_ws *const ws)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	if (!ws->blk && !(ws->blk = malloc(prog->nnodes * BLOCK * sizeof(double))))
+		return false;
+	if (!ws->blkvar && !(ws->blkvar = malloc((prog->nvars * (size_t) BLOCK + 1) * sizeof(double))))
+		return false;
+	if (!ws->blkcols && !(ws->blkcols = malloc((prog->nvars + 1) * sizeof(double *))))
+		return false;
+	return true;
+}
+
+// evaluate a batch in double precision, from int64 columns
+static inline int batch_int_fallback(struct xpr_ws *const ws, const int64_t *const *const cols, size_t n, double *const *const out)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	if (!ws_convert(ws))
+		return -1;
+	double *const buf = ws->blkvar;
+	const double **const dcols = ws->blkcols;
+	for (size_t first = 0; first < n; first += BLOCK) {
+		const size_t rows = (n - first < BLOCK) ? n - first : BLOCK;
+		for (size_t i = 0; i < prog->nvars; i++) {
+			dcols[i] = cols[i] ? &buf[i * BLOCK] : NULL;
+			for (size_t j = 0; cols[i] && (j < rows); j++)
+				buf[i * BLOCK + j] = cols[i][first + j];
+		}
+		prog_run_block(prog, ws->blk, dcols, 0, rows, ws->argv);
+		for (size_t r = 0; r < prog->nroots; r++) {
+			const double *const res = &ws->blk[prog_roots(prog)[r] * (size_t) BLOCK];
+			for (size_t j = 0; j < rows; j++)
+				out[r][first + j] = isnan(res[j]) ? XPR_ERR : res[j];
+		}
+	}
+	return 1;
+}
+
+int xpr_eval_batch_int(struct xpr_ws *ws, const int64_t *const *cols, size_t n, int64_t *const *out, double *const *fallback)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	const uint32_t *const roots = prog_roots(prog);
+	if (!ws->isint)
+		goto inexact;
+	if (!ws_int(ws))
+		return -1;
+	for (size_t first = 0; first < n; first += BLOCK) {
+		const size_t rows = (n - first < BLOCK) ? n - first : BLOCK;
+		prog_run_block_int(prog, ws->blki, ws->blkbad, cols, NULL, first, rows);
+		for (size_t r = 0; r < prog->nroots; r++) {
+			const int64_t *const res = &ws->blki[roots[r] * (size_t) BLOCK];
+			const bool *const bad = &ws->blkbad[roots[r] * (size_t) BLOCK];
+			bool inexact = false;
+			for (size_t j = 0; j < rows; j++) {
+				inexact |= bad[j];
+				out[r][first + j] = res[j];
+			}
+			if (inexact)
+				goto inexact;
+		}
+	}
+	return 0;
+
+inexact:
+	return fallback ? batch_int_fallback(ws, cols, n, fallback) : 1;
+}
+
+// prepare the buffers for the tangents with respect to the given slots
+static inline bool ws_dual(struct xpr_ws *const ws, const size_t *const wrt, size_t nwrt)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	for (size_t k = 0; k < nwrt; k++) {
+		if (wrt[k] >= prog->nvars) {
+			errno = EINVAL;
+			return false;
+		}
+	}
+	if (!ws->blk && !(ws->blk = malloc(prog->nnodes * BLOCK * sizeof(double))))
+		goto nomem;
+	if (nwrt > ws->nwrt) {
+		if (nwrt > SIZE_MAX / sizeof(double) / BLOCK / (prog->nnodes + 1))
+			goto nomem;
+		free(ws->blkdot);
+		ws->nwrt = 0;
+		if (!(ws->blkdot = malloc(prog->nnodes * nwrt * BLOCK * sizeof(double))))
+			goto nomem;
+		ws->nwrt = nwrt;
+	}
+	return true;
+
+nomem:
+	errno = ENOMEM;
+	return false;
+}
+
+int xpr_eval_grad(struct xpr_ws *ws, const double *values, const size_t *wrt, size_t nwrt, double *out, double *grad)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	const double **cols = malloc((prog->nvars + 1) * sizeof(double *));
+	if (!cols || !ws_dual(ws, wrt, nwrt)) {
+		free(cols);
+		return -1;
+	}
+	for (size_t i = 0; i < prog->nvars; i++)
+		cols[i] = &values[i];
+	prog_run_block_dual(prog, ws->blk, ws->blkdot, wrt, nwrt, cols, 0, 1, ws->argv);
+	free(cols);
+	for (size_t r = 0; r < prog->nroots; r++) {
+		const uint32_t root = prog_roots(prog)[r];
+		const double res = ws->blk[root * (size_t) BLOCK];
+		out[r] = isnan(res) ? XPR_ERR : res;
+		for (size_t k = 0; k < nwrt; k++) {
+			const double d = ws->blkdot[(root * nwrt + k) * BLOCK];
+			grad[r * nwrt + k] = isnan(d) ? XPR_ERR : d;
+		}
+	}
+	return 0;
+}
+
+int xpr_eval_batch_grad(struct xpr_ws *ws, const double *const *cols, size_t n, const size_t *wrt, size_t nwrt, double *const *out, double *const *grad)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	if (!ws_dual(ws, wrt, nwrt))
+		return -1;
+	for (size_t first = 0; first < n; first += BLOCK) {
+		const size_t rows = (n - first < BLOCK) ? n - first : BLOCK;
+		prog_run_block_dual(prog, ws->blk, ws->blkdot, wrt, nwrt, cols, first, rows, ws->argv);
+		for (size_t r = 0; r < prog->nroots; r++) {
+			const uint32_t root = prog_roots(prog)[r];
+			const double *const res = &ws->blk[root * (size_t) BLOCK];
+			for (size_t j = 0; j < rows; j++)
+				out[r][first + j] = isnan(res[j]) ? XPR_ERR : res[j];
+			for (size_t k = 0; k < nwrt; k++) {
+				const double *const d = &ws->blkdot[(root * nwrt + k) * BLOCK];
+				for (size_t j = 0; j < rows; j++)
+					grad[r * nwrt + k][first + j] = isnan(d[j]) ? XPR_ERR : d[j];
+			}
+		}
+	}
+	return 0;
+}
+
+int xpr_eval_interval(struct xpr_ws *ws, const double *lo, const double *hi, double *outlo, double *outhi)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	if (!ws->ival && !(ws->ival = malloc(prog->nnodes * sizeof(struct ival)))) {
+		errno = ENOMEM;
+		return -1;
+	}
+	prog_run_ival(prog, ws->ival, lo, hi, ws->argv);
+	bool err = false;
+	for (size_t r = 0; r < prog->nroots; r++) {
+		const struct ival res = ws->ival[prog_roots(prog)[r]];
+		outlo[r] = iv_empty(res) ? XPR_ERR : res.lo;
+		outhi[r] = iv_empty(res) ? XPR_ERR : res.hi;
+		err |= res.err;
+	}
+	return err;
+}
+
+int xpr_eval_columns(struct xpr_ws *ws, const struct xpr_column *cols, size_t n, double *const *out)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	const struct node *const nodes = prog_nodes(prog);
+	for (size_t i = 0; i < prog->nvars; i++) {
+		if ((cols[i].kind < XPR_COL_PLAIN) || (cols[i].kind > XPR_COL_CONST)) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	int ret = -1;
+	uint32_t *kind = malloc((prog->nnodes + 1) * sizeof(uint32_t));
+	bool *need = malloc(prog->nnodes + 1);
+	double **table = calloc(prog->nnodes + 1, sizeof(double *));
+	const double **dcols = malloc((prog->nvars + 1) * sizeof(double *));
+	if (!kind || !need || !table || !dcols || (!ws->blk && !(ws->blk = malloc(prog->nnodes * BLOCK * sizeof(double)))))
+		goto nomem;
+	dict_classify(prog, cols, n, kind, need);
+
+	// constant nodes keep their values in all rows of the block
+	for (size_t i = 0; i < prog->nvars; i++)
+		dcols[i] = (XPR_COL_CONST == cols[i].kind) ? cols[i].values : NULL;
+	for (size_t i = 0; i < prog->nnodes; i++) {
+		if (KIND_CONST != kind[i])
+			continue;
+		double *const v = &ws->blk[i * BLOCK];
+		node_run_block(prog, i, ws->blk, dcols, 0, 1, ws->argv);
+		for (size_t j = 1; j < BLOCK; j++)
+			v[j] = v[0];
+	}
+
+	// compute the needed dictionary nodes once per entry, variables use the dictionary itself
+	for (size_t i = 0; i < prog->nnodes; i++) {
+		if ((kind[i] >= KIND_CONST) || !need[i])
+			continue;
+		if (OP_VAR == nodes[i].op)
+			table[i] = (double *) cols[kind[i]].values;
+		else if (!(table[i] = malloc((cols[kind[i]].nvalues + 1) * sizeof(double))))
+			goto nomem;
+	}
+	for (size_t s = 0; s < prog->nvars; s++) {
+		if (XPR_COL_DICT != cols[s].kind)
+			continue;
+		dcols[s] = cols[s].values;
+		for (size_t first = 0; first < cols[s].nvalues; first += BLOCK) {
+			const size_t rows = (cols[s].nvalues - first < BLOCK) ? cols[s].nvalues - first : BLOCK;
+			for (size_t i = 0; i < prog->nnodes; i++) {
+				if (kind[i] != s)
+					continue;
+				node_run_block(prog, i, ws->blk, dcols, first, rows, ws->argv);
+				if (need[i] && (OP_VAR != nodes[i].op))
+					memcpy(&table[i][first], &ws->blk[i * BLOCK], rows * sizeof(double));
+			}
+		}
+		dcols[s] = NULL;
+	}
+
+	// the rows only compute their own nodes
+	for (size_t i = 0; i < prog->nvars; i++)
+		dcols[i] = (XPR_COL_PLAIN == cols[i].kind) ? cols[i].values : NULL;
+	for (size_t first = 0; first < n; first += BLOCK) {
+		const size_t rows = (n - first < BLOCK) ? n - first : BLOCK;
+		for (size_t i = 0; i < prog->nnodes; i++) {
+			if (KIND_ROW == kind[i])
+				node_run_block(prog, i, ws->blk, dcols, first, rows, ws->argv);
+			else if ((KIND_CONST != kind[i]) && need[i])
+				dict_gather(&ws->blk[i * BLOCK], table[i], &cols[kind[i]], first, rows);
+		}
+		for (size_t r = 0; r < prog->nroots; r++) {
+			const double *const res = &ws->blk[prog_roots(prog)[r] * (size_t) BLOCK];
+			for (size_t j = 0; j < rows; j++)
+				out[r][first + j] = isnan(res[j]) ? XPR_ERR : res[j];
+		}
+	}
+	ret = 0;
+	goto out;
+
+nomem:
+	errno = ENOMEM;
+out:
+	for (size_t i = 0; table && (i < prog->nnodes); i++)
+		if (OP_VAR != nodes[i].op)
+			free(table[i]);
+	free(table);
+	free(dcols);
+	free(need);
+	free(kind);
+	return ret;
+}
+
+// the address of the field of record k
+#define FIELD(f, k)      ((const char *) (f)->base + (f)->offset + (k) * (f)->stride)
+#define OUT_FIELD(f, k)  ((char *) (f)->base + (f)->offset + (k) * (f)->stride)
+
+int xpr_eval_strided(struct xpr_ws *ws, const struct xpr_field *fields, size_t n, const struct xpr_out_field *out)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	for (size_t i = 0; i < prog->nvars; i++) {
+		if (fields[i].base && ((fields[i].type < XPR_TYPE_DOUBLE) || (fields[i].type > XPR_TYPE_INT32))) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	for (size_t r = 0; r < prog->nroots; r++) {
+		if ((XPR_TYPE_DOUBLE != out[r].type) && (XPR_TYPE_FLOAT != out[r].type)) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	if (!ws_convert(ws)) {
+		errno = ENOMEM;
+		return -1;
+	}
+	double *const buf = ws->blkvar;
+	const double **const dcols = ws->blkcols;
+	for (size_t first = 0; first < n; first += BLOCK) {
+		const size_t rows = (n - first < BLOCK) ? n - first : BLOCK;
+		// gather the fields of the block, memcpy() allows unaligned fields
+		for (size_t i = 0; i < prog->nvars; i++) {
+			const struct xpr_field *const f = &fields[i];
+			double *const v = &buf[i * BLOCK];
+			dcols[i] = f->base ? v : NULL;
+#			define GATHER(T) for (size_t j = 0; j < rows; j++) { T x; memcpy(&x, FIELD(f, first + j), sizeof(x)); v[j] = x; }
+			switch (f->base ? f->type : -1) {
+			case XPR_TYPE_DOUBLE: GATHER(double);  break;
+			case XPR_TYPE_FLOAT:  GATHER(float);   break;
+			case XPR_TYPE_INT64:  GATHER(int64_t); break;
+			case XPR_TYPE_INT32:  GATHER(int32_t); break;
+			}
+#			undef GATHER
+		}
+		prog_run_block(prog, ws->blk, dcols, 0, rows, ws->argv);
+		for (size_t r = 0; r < prog->nroots; r++) {
+			const double *const res = &ws->blk[prog_roots(prog)[r] * (size_t) BLOCK];
+#			define SCATTER(T) for (size_t j = 0; j < rows; j++) { T x = isnan(res[j]) ? XPR_ERR : res[j]; memcpy(OUT_FIELD(&out[r], first + j), &x, sizeof(x)); }
+			if (XPR_TYPE_DOUBLE == out[r].type)
+				SCATTER(double)
+			else
+				SCATTER(float)
+#			undef SCATTER
+		}
+	}
+	return 0;
+}
+
+#undef FIELD
+#undef OUT_FIELD
+
+int xpr_eval_arrow(struct xpr_ws *ws, const struct ArrowSchema *const *schemas, const struct ArrowArray *const *arrays, struct ArrowSchema *out_schemas, struct ArrowArray *out_arrays)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	const uint32_t *const varnode = prog_varnode(prog);
+	int ret = -1;
+	char *format = malloc(prog->nvars + 1);
+	const double **dcols = calloc(prog->nvars + 1, sizeof(double *));
+	double *buf = malloc((prog->nvars * (size_t) BLOCK + 1) * sizeof(double));
+	struct arrow_out **outs = calloc(prog->nroots, sizeof(struct arrow_out *));
+	if (!format || !dcols || !buf || !outs || (!ws->blk && !(ws->blk = malloc(prog->nnodes * BLOCK * sizeof(double))))) {
+		errno = ENOMEM;
+		goto out;
+	}
+
+	// all columns of used variables must be supported, and have the same length
+	size_t n = 0;
+	bool haslen = false;
+	for (size_t i = 0; i < prog->nvars; i++) {
+		format[i] = 0;
+		if (NONE == varnode[i])
+			continue;
+		if (!(format[i] = arrow_format(schemas[i], arrays[i])) || (haslen && ((size_t) arrays[i]->length != n))) {
+			errno = EINVAL;
+			goto out;
+		}
+		n = arrays[i]->length;
+		haslen = true;
+	}
+	// without variables, any column determines the length
+	for (size_t i = 0; !haslen && (i < prog->nvars); i++)
+		if ((haslen = arrays[i] && (arrays[i]->length > 0)))
+			n = arrays[i]->length;
+	for (size_t r = 0; r < prog->nroots; r++) {
+		if (!(outs[r] = arrow_out_new(n))) {
+			errno = ENOMEM;
+			goto out;
+		}
+	}
+
+	size_t nulls = 0;
+	for (size_t first = 0; first < n; first += BLOCK) {
+		const size_t rows = (n - first < BLOCK) ? n - first : BLOCK;
+		for (size_t i = 0; i < prog->nvars; i++)
+			dcols[i] = format[i] ? arrow_block(format[i], arrays[i], first, rows, &buf[i * BLOCK]) : NULL;
+		prog_run_block(prog, ws->blk, dcols, 0, rows, ws->argv);
+		for (size_t r = 0; r < prog->nroots; r++) {
+			const double *const res = &ws->blk[prog_roots(prog)[r] * (size_t) BLOCK];
+			for (size_t j = 0; j < rows; j++)
+				outs[r]->values[first + j] = isnan(res[j]) ? XPR_ERR : res[j];
+		}
+
+		// null in any used variable means null out
+		uint8_t *const bits = arrow_out_bits(outs[0], n);
+		for (size_t j = 0; j < rows; j++) {
+			bool valid = true;
+			for (size_t i = 0; i < prog->nvars; i++)
+				valid &= !format[i] || arrow_valid(arrays[i], first + j);
+			const size_t k = first + j;
+			if (0 == k % 8)
+				bits[k / 8] = 0;
+			bits[k / 8] |= (uint8_t) valid << (k % 8);
+			nulls += !valid;
+		}
+	}
+	for (size_t r = 0; r < prog->nroots; r++) {
+		if (r)
+			memcpy(arrow_out_bits(outs[r], n), arrow_out_bits(outs[0], n), (n + 7) / 8);
+		arrow_export(outs[r], n, nulls, &out_schemas[r], &out_arrays[r]);
+	}
+	ret = 0;
+
+out:
+	if (ret)
+		for (size_t r = 0; outs && (r < prog->nroots); r++)
+			free(outs[r]);
+	free(outs);
+	free(buf);
+	free(dcols);
+	free(format);
+	return ret;
+}
+
+double xpr_update(struct xpr_ws *ws, size_t slot, double value)
+{
+	const struct xpr_prog *const prog = ws->prog;
+	if (slot >= prog->nvars)
+		return XPR_ERR;
+	const uint32_t v = prog_varnode(prog)[slot];
+	if (NONE == v)
+		return ws_result(ws, 0);
+
+	// only recompute the nodes that depend on the variable, in order
+	const struct node *const nodes = prog_nodes(prog);
+	const uint32_t *const args = prog_args(prog);
+	const uint32_t *const deps = prog_deps(prog);
+	const uint32_t end = prog_depoff(prog)[slot + 1];
+	ws->val[v] = value;
+	for (uint32_t k = prog_depoff(prog)[slot]; k < end; k++)
+		ws->val[deps[k]] = node_eval(&nodes[deps[k]], args, ws->val, prog->ext.funs, ws->argv);
+	return ws_result(ws, 0);
+}
+
+size_t xpr_vars_used(const struct xpr_prog *prog, size_t *slots)
+{
+	size_t n = 0;
+	for (size_t slot = 0; slot < prog->nvars; slot++) {
+		if (NONE == prog_varnode(prog)[slot])
+			continue;
+		if (slots)
+			slots[n] = slot;
+		n++;
+	}
+	return n;
+}
+
+size_t xpr_image_write(const struct xpr_prog *const *progs, size_t nprogs, void *buf, size_t size)
+{
+	if (nprogs >= NONE) {
+		errno = EINVAL;
+		return 0;
+	}
+	size_t total = img_align(sizeof(struct img_header) + nprogs * sizeof(uint64_t));
+	for (size_t i = 0; i < nprogs; i++) {
+		// user-defined functions are not part of the image
+		if (progs[i]->ext.funs) {
+			errno = EINVAL;
+			return 0;
+		}
+		total += img_align(prog_bytes(progs[i]));
+	}
+	if (!buf || (size < total))
+		return total;
+
+	// the padding is part of the checksum, so it must be zero
+	memset(buf, 0, total);
+	struct img_header *h = buf;
+	uint64_t *offset = (uint64_t *) (h + 1);
+	size_t off = img_align(sizeof(*h) + nprogs * sizeof(uint64_t));
+	for (size_t i = 0; i < nprogs; i++) {
+		offset[i] = off;
+		memcpy((char *) buf + off, progs[i], prog_bytes(progs[i]));
+		off += img_align(prog_bytes(progs[i]));
+	}
+	memcpy(h->magic, IMG_MAGIC, sizeof(h->magic));
+	h->version = IMG_VERSION;
+	h->endian = IMG_ENDIAN;
+	h->nprogs = nprogs;
+	h->size = total;
+	h->checksum = img_checksum(h + 1, total - sizeof(*h));
+	return total;
+}
+
+struct xpr_image *xpr_image_load(const void *buf, size_t size)
+{
+	const int err = img_valid(buf, size);
+	if (err) {
+		errno = err;
+		return NULL;
+	}
+	struct xpr_image *img = malloc(sizeof(*img));
+	if (!img) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	img->header = buf;
+	img->map = NULL;
+	img->mapsz = 0;
+	return img;
+}
+
+struct xpr_image *xpr_image_open(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (0 != fstat(fd, &st))
+		;
+	else if (0 >= st.st_size)
+		errno = EINVAL;
+	else
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	int err = errno;
+	close(fd);
+	if (MAP_FAILED == map) {
+		errno = err;
+		return NULL;
+	}
+	struct xpr_image *img = xpr_image_load(map, st.st_size);
+	if (!img) {
+		err = errno;
+		munmap(map, st.st_size);
+		errno = err;
+		return NULL;
+	}
+	img->map = map;
+	img->mapsz = st.st_size;
+	return img;
+}
+
+void xpr_image_close(struct xpr_image *img)
+{
+	if (img && img->map)
+		munmap(img->map, img->mapsz);
+	free(img);
+}
+
+size_t xpr_image_count(const struct xpr_image *img)
+{
+	return img->header->nprogs;
+}
+
+const struct xpr_prog *xpr_image_prog(const struct xpr_image *img, size_t i)
+{
+	if (i >= img->header->nprogs)
+		return NULL;
+	return (const struct xpr_prog *) ((const char *) img->header + img_offset(img->header)[i]);
+}
+
+// report the identifiers in order, where definitions hide variables of the same name
+int xpr_list_idents(const char *str, xpr_ident_cb cb, void *arg)
+{
+	// find the definitions of a program in one pass, expressions without ';' have none
+	const bool isprog = (NULL != strchr(str, ';'));
+	struct def_index ix = { .slot = NULL };
+	struct def *defs = NULL;
+	int ret = 0;
+	if (isprog) {
+		size_t nstmts = 1;
+		for (const char *p = str; *p; p++)
+			nstmts += (';' == *p);
+		bool failed = !(defs = malloc(nstmts * sizeof(struct def))) || !def_index_init(&ix, defs);
+		for (const char *stmt = str; stmt && !failed; stmt = strchr(stmt, ';')) {
+			if (';' == *stmt)
+				stmt++;
+			// a repeated name is a definition already
+			if (stmt_def(stmt, &defs[ix.ndefs]))
+				def_index_add(&ix, &failed);
+		}
+		if (failed) {
+			errno = ENOMEM;
+			ret = -1;
+			goto out;
+		}
+	}
+	tok t;
+	while ('\0' != *str) {
+		const char *start = str;
+		// without variables, the lexer reports unknown identifiers as errors
+		next(&str, &t, NULL, NULL, NULL);
+		if (isalpha(*start) && (CLASS_OP != CLASS_GET(t.tag))) {
+			int kind = XPR_IDENT_VAR;
+			if (isprog && def_index_find(&ix, start, str - start))
+				kind = XPR_IDENT_DEF;
+			else if (CLASS_FUNC == CLASS_GET(t.tag))
+				kind = XPR_IDENT_FUN;
+			else if (CLASS_VALUE == CLASS_GET(t.tag))
+				kind = XPR_IDENT_CONST;
+			if ((ret = cb(arg, start, str - start, kind)))
+				goto out;
+		} else if ((TK_ERR == t.tag) && !(isprog && ((';' == *start) || ('=' == *start)))) {
+			ret = -1;
+			goto out;
+		}
+	}
+out:
+	free(ix.slot);
+	free(defs);
+	return ret;
+}
+
+static double xpr_program(const char *str, const var *const vars, const struct xpr_fun *const funs)
+{
+	struct xpr_prog *prog = xpr_compile_ext(&str, 1, vars, funs);
+	if (!prog)
+		return (E2BIG == errno) ? XPR_ERR_LIMIT : XPR_ERR;
+	double result = XPR_ERR;
+	struct xpr_ws *ws = xpr_ws_new(prog);
+	double *values = malloc((prog->nvars + 1) * sizeof(double));
+	if (ws && values) {
+		for (size_t i = 0; i < prog->nvars; i++)
+			values[i] = vars[i].value;
+		result = xpr_eval(ws, values);
+	}
+	free(values);
+	xpr_ws_free(ws);
+	xpr_prog_free(prog);
+	return result;
+}
+
 #ifdef MAIN
 int main(int argc, char **argv)
 {
@@ -648,7 +2396,8 @@ int main(int argc, char **argv)
 	var vars[argc];
 	vars[0].name = NULL;
 	for (int i = 1; i < argc; i++) {
-		if (strchr(argv[i], '=')) {
+		struct def def;
+		if (stmt_def(argv[i], &def)) {
 			char *name = strtok(argv[i], "=");
 			char *val  = strtok(NULL, "=");
 			if (NULL == val)
@@ -40,12 +40,23 @@ extern "C" {
 
 
 #include <math.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /*
  * error code for the xpr() function
  */
 #define XPR_ERR NAN
 
+/*
+ * error code for the xpr() function when the evaluation exceeds a limit
+ *
+ * This is a NAN with the sign bit set. Therefore, isnan() detects it as an
+ *   error, and XPR_IS_LIMIT() distinguishes it from all other errors.
+ */
+#define XPR_ERR_LIMIT (-NAN)
+#define XPR_IS_LIMIT(d) (isnan(d) && signbit(d))
+
 /*
  * data structure for XPR variables
  *
@@ -69,9 +80,866 @@ struct xpr_var {
  * returns:
  *          The result of the given expression, evaluated using the data type
  *          double. On error, the function returns XPR_ERR, which is NAN.
+ *          When the evaluation exceeds a limit, the function returns
+ *          XPR_ERR_LIMIT, which is NAN as well.
  */
 extern double xpr(const char *expr, const struct xpr_var *vars);
 
+/*
+ * callback of a user-defined function
+ *
+ * The callback gets the arguments of one function call, and returns the
+ *   result. It returns NAN on error.
+ */
+typedef double (*xpr_fun_cb)(void *arg, size_t nargs, const double *args);
+
+/*
+ * batch variant of a user-defined function
+ *
+ * The callback computes n function calls at once. The k-th argument of the
+ *   i-th call is args[k][i], and its result goes to out[i].
+ */
+typedef void (*xpr_fun_batch_cb)(void *arg, size_t nargs, const double *const *args, size_t n, double *out);
+
+/*
+ * the result of a pure function only depends on its arguments, so the
+ * compiler can compute it once for identical arguments
+ */
+#define XPR_FUN_PURE 0x1
+
+/*
+ * data structure for user-defined functions
+ *
+ * The name follows the rules of variable names. User-defined functions hide
+ *   built-in functions with the same name, and variables hide user-defined
+ *   functions. Calls with less than minargs or more than maxargs arguments are
+ *   errors, use SIZE_MAX for maxargs to allow any number of arguments.
+ */
+struct xpr_fun {
+	const char *name;
+	xpr_fun_cb fun;
+	xpr_fun_batch_cb batch;  // optional, can be NULL
+	void *arg;               // the first argument of both callbacks
+	size_t minargs;
+	size_t maxargs;
+	int flags;               // XPR_FUN_PURE, or 0
+};
+
+/*
+ * data structure for a lookup table, e.g., a calibration curve
+ *
+ * The breakpoints are in strictly ascending order, and each has a value. The
+ *   table does not copy the arrays, so they must remain valid.
+ */
+struct xpr_table {
+	const double *x;         // the breakpoints
+	const double *y;         // the value of each breakpoint
+	size_t n;                // the number of breakpoints
+};
+
+/*
+ * look up a value in a table
+ *
+ * The callbacks of a user-defined function with one argument, where arg is a
+ *   struct xpr_table. Register the table as a function to use it by name,
+ *   e.g., { "curve", xpr_interp, xpr_interp_batch, &table, 1, 1, XPR_FUN_PURE }
+ *   makes curve(x) interpolate the table. Arguments beyond the breakpoints
+ *   result in the first or last value, and an empty table is an error.
+ *
+ *  xpr_interp   piecewise-linear interpolation between the breakpoints
+ *  xpr_step     the value of the last breakpoint <= x
+ */
+extern double xpr_interp(void *arg, size_t nargs, const double *args);
+extern void xpr_interp_batch(void *arg, size_t nargs, const double *const *args, size_t n, double *out);
+extern double xpr_step(void *arg, size_t nargs, const double *args);
+extern void xpr_step_batch(void *arg, size_t nargs, const double *const *args, size_t n, double *out);
+
+/*
+ * evaluate an arithmetic expression with user-defined functions
+ *
+ * params:
+ *    expr  The expression to evaluate, like for xpr()
+ *    vars  The list of variables, like for xpr()
+ *    funs  An array of functions, terminated by an entry with the name NULL.
+ *          This parameter can be NULL, which is equivalent to an empty list.
+ *
+ * returns:
+ *          The result of the given expression, like xpr().
+ */
+extern double xpr_ext(const char *expr, const struct xpr_var *vars, const struct xpr_fun *funs);
+
+/*
+ * data structure for compiled XPR programs
+ *
+ * A program is an expression that is parsed once and evaluated many times.
+ *   The program refers to variables by their slot, which is the position of
+ *   the variable in the list of variables passed to xpr_compile(). Programs
+ *   are read-only, so concurrent evaluations can share them.
+ */
+struct xpr_prog;
+
+/*
+ * data structure for the evaluation state of a program
+ *
+ * A workspace belongs to one program, and it caches all intermediate values of
+ *   the most recent evaluation. Concurrent evaluations need separate
+ *   workspaces.
+ */
+struct xpr_ws;
+
+/*
+ * compile an arithmetic expression
+ *
+ * params:
+ *    expr  The expression to compile, as a null-terminated string
+ *    vars  An array of variables, terminated by an entry with the name NULL.
+ *          Only the names are relevant, the index of each variable is its
+ *          slot. This parameter can be NULL, which is equivalent to an empty
+ *          list.
+ *
+ * returns:
+ *          The compiled program, which must be released with xpr_prog_free().
+ *          On error, the function returns NULL and sets errno to EINVAL for
+ *          invalid expressions, to E2BIG when the expression exceeds a limit,
+ *          or to ENOMEM.
+ */
+extern struct xpr_prog *xpr_compile(const char *expr, const struct xpr_var *vars);
+
+/*
+ * compile a set of arithmetic expressions into a single program
+ *
+ * The expressions share all common subexpressions, so the evaluation computes
+ *   each of them only once. All expressions use the same variable slots.
+ *
+ * params:
+ *    exprs   The expressions to compile, as null-terminated strings
+ *    nexprs  The number of expressions, at least 1
+ *    vars    The list of variables, like for xpr_compile()
+ *
+ * returns:
+ *          The compiled program, like xpr_compile(). The compilation fails
+ *          if any of the expressions is invalid.
+ */
+extern struct xpr_prog *xpr_compile_set(const char *const *exprs, size_t nexprs, const struct xpr_var *vars);
+
+/*
+ * compile a set of expressions with user-defined functions
+ *
+ * The program refers to the list of functions, which must remain valid until
+ *   the program is released. Calls of pure functions with constant arguments
+ *   are evaluated at compile time.
+ *
+ * params:
+ *    exprs   The expressions to compile, like for xpr_compile_set()
+ *    nexprs  The number of expressions, at least 1
+ *    vars    The list of variables, like for xpr_compile()
+ *    funs    The list of functions, like for xpr_ext()
+ *
+ * returns:
+ *          The compiled program, like xpr_compile().
+ */
+extern struct xpr_prog *xpr_compile_ext(const char *const *exprs, size_t nexprs, const struct xpr_var *vars, const struct xpr_fun *funs);
+
+/*
+ * release a compiled program
+ */
+extern void xpr_prog_free(struct xpr_prog *prog);
+
+/*
+ * create a workspace for a program
+ *
+ * returns:
+ *          The workspace, which must be released with xpr_ws_free(), or NULL
+ *          on error. All variables of a new workspace are undefined, and the
+ *          function does not call user-defined functions.
+ */
+extern struct xpr_ws *xpr_ws_new(const struct xpr_prog *prog);
+
+/*
+ * release a workspace
+ *
+ * The workspace does not access its program, which may be released before.
+ */
+extern void xpr_ws_free(struct xpr_ws *ws);
+
+/*
+ * evaluate a program
+ *
+ * params:
+ *    ws      The workspace of the program
+ *    values  The value of each variable slot
+ *
+ * returns:
+ *          The result of the program. On error, the function returns XPR_ERR.
+ *          For programs with multiple expressions, this is the result of the
+ *          first expression.
+ */
+extern double xpr_eval(struct xpr_ws *ws, const double *values);
+
+/*
+ * evaluate a program with multiple expressions
+ *
+ * params:
+ *    ws      The workspace of the program
+ *    values  The value of each variable slot
+ *    out     An array that receives the result of each expression. Each result
+ *            is XPR_ERR on error.
+ */
+extern void xpr_eval_set(struct xpr_ws *ws, const double *values, double *out);
+
+/*
+ * callback for xpr_eval_resolve(), which returns the value of a variable slot
+ */
+typedef double (*xpr_resolve_cb)(void *arg, size_t slot);
+
+/*
+ * evaluate a program, and get the values of variables from a callback
+ *
+ * The callback is called exactly once per evaluation for each slot that the
+ *   program depends on, see xpr_vars_used(), and never for the other slots. So
+ *   expensive variables are only computed if the program uses them. The
+ *   branches of select(), and, and or are not skipped, because their errors
+ *   propagate, so the callback also resolves the slots of branches that the
+ *   result does not take. The results of all expressions are available with
+ *   xpr_results().
+ *
+ * params:
+ *    ws      The workspace of the program
+ *    cb      The callback, which may return XPR_ERR for missing values
+ *    arg     The first argument of the callback
+ *
+ * returns:
+ *          The result of the first expression, like xpr_eval()
+ */
+extern double xpr_eval_resolve(struct xpr_ws *ws, xpr_resolve_cb cb, void *arg);
+
+/*
+ * get the results of the most recent evaluation or update
+ *
+ * params:
+ *    ws      The workspace of the program
+ *    out     An array that receives the result of each expression
+ */
+extern void xpr_results(const struct xpr_ws *ws, double *out);
+
+/*
+ * evaluate a program for many rows of variable values
+ *
+ * The evaluation processes blocks of rows at once, and calls the batch
+ *   variant of user-defined functions once per block. It does not change the
+ *   intermediate values that xpr_update() and xpr_results() refer to.
+ *
+ * params:
+ *    ws      The workspace of the program
+ *    cols    For each variable slot, an array with the value of each row. The
+ *            entries of unused slots can be NULL.
+ *    n       The number of rows
+ *    out     For each expression, an array that receives the result of each
+ *            row. Each result is XPR_ERR on error.
+ *
+ * returns:
+ *          0 on success, or -1 if the workspace cannot allocate memory
+ */
+extern int xpr_eval_batch(struct xpr_ws *ws, const double *const *cols, size_t n, double *const *out);
+
+/*
+ * select the rows for which a condition holds
+ *
+ * Like xpr_eval_batch(), but instead of the results, the function reports the
+ *   rows for which the first expression is neither zero nor XPR_ERR.
+ *
+ * params:
+ *    bitmap  An array of (n + 63) / 64 words that receives one bit per row,
+ *            with row i at bit i % 64 of word i / 64, or NULL
+ *    index   An array of n entries that receives the selected row numbers in
+ *            ascending order, or NULL
+ *
+ * returns:
+ *          The number of selected rows, or SIZE_MAX if the workspace cannot
+ *          allocate memory
+ */
+extern size_t xpr_filter(struct xpr_ws *ws, const double *const *cols, size_t n, uint64_t *bitmap, size_t *index);
+
+/*
+ * data structure for the aggregates of an expression over a batch
+ *
+ * xpr_eval_agg() fills one for each expression of a program. The histogram of
+ *   xpr_eval_hist() only covers the first expression.
+ */
+struct xpr_agg {
+	double sum;              // the sum of the results, except errors
+	double min;              // the smallest result, or XPR_ERR without results
+	double max;              // the largest result, or XPR_ERR without results
+	size_t count;            // the number of results that are not errors
+	size_t nerr;             // the number of errors
+};
+
+// compensated summation for the sum of xpr_eval_agg()
+#define XPR_AGG_KAHAN 0x1
+
+/*
+ * aggregate the results of a program for many rows
+ *
+ * Like xpr_eval_batch(), but instead of writing the results, the function
+ *   reduces each block of results as soon as the block is computed. The sum of
+ *   each block is a pairwise sum, and the flag XPR_AGG_KAHAN compensates the
+ *   rounding errors of adding the blocks.
+ *
+ * params:
+ *    flags   XPR_AGG_KAHAN, or 0
+ *    agg     For each expression, the aggregates
+ *
+ * returns:
+ *          0 on success, or -1 if the workspace or the compensations cannot
+ *          allocate memory
+ */
+extern int xpr_eval_agg(struct xpr_ws *ws, const double *const *cols, size_t n, int flags, struct xpr_agg *agg);
+
+/*
+ * count the results of the first expression in equally wide bins
+ *
+ * The bins split the range from lo to hi, excluding hi. Errors and results
+ *   out of range are not counted.
+ *
+ * params:
+ *    nbins   The number of bins
+ *    bins    An array of nbins counters
+ *
+ * returns:
+ *          0 on success, or -1 and errno is EINVAL for an empty range or no
+ *          bins, or ENOMEM
+ */
+extern int xpr_eval_hist(struct xpr_ws *ws, const double *const *cols, size_t n, double lo, double hi, size_t nbins, uint64_t *bins);
+
+/*
+ * evaluate a program for the next rows of a time series
+ *
+ * Like xpr_eval_batch(), but the rows of consecutive calls form a stream, so
+ *   the window functions wsum(), wmin(), wmax(), wavg(), and lag() refer to
+ *   the previous rows. The workspace keeps the windows, and each row costs O(1)
+ *   regardless of the window size. Other evaluations of the workspace do not
+ *   affect the stream, and see a window of one row.
+ *
+ * returns:
+ *          0 on success, or -1 and errno is ENOMEM, or EINVAL if a window size
+ *          is not a constant
+ */
+extern int xpr_eval_stream(struct xpr_ws *ws, const double *const *cols, size_t n, double *const *out);
+
+/*
+ * start a new stream, i.e., clear the windows of the workspace
+ *
+ * params:
+ *    ws      The workspace of the program
+ */
+extern void xpr_stream_reset(struct xpr_ws *ws);
+
+/*
+ * data structure for a pool of threads for parallel evaluations
+ *
+ * The threads wait for evaluations, so a pool saves the start-up cost of
+ *   threads across calls. A pool runs one evaluation at a time, concurrent
+ *   calls wait for each other.
+ */
+struct xpr_pool;
+
+// pin each thread of a pool to a CPU
+#define XPR_POOL_PIN 0x1
+
+/*
+ * create a thread pool
+ *
+ * params:
+ *    nthreads  The number of threads, including the thread that calls
+ *              xpr_eval_parallel(), or 0 for the number of online CPUs
+ *    flags     XPR_POOL_PIN, or 0
+ *
+ * returns:
+ *          The pool, or NULL and errno is ENOMEM, the error of
+ *          pthread_create() or pthread_setaffinity_np(), or ENOTSUP for
+ *          XPR_POOL_PIN where the platform cannot pin threads
+ */
+extern struct xpr_pool *xpr_pool_new(size_t nthreads, int flags);
+
+/*
+ * stop the threads of a pool, and free it
+ */
+extern void xpr_pool_free(struct xpr_pool *pool);
+
+/*
+ * evaluate a program for many rows, with the threads of a pool
+ *
+ * Like xpr_eval_batch(), but the threads split the rows into chunks of whole
+ *   blocks. Idle threads steal chunks from busy ones. Each thread has its own
+ *   workspace, and the results are identical to xpr_eval_batch() for any
+ *   number of threads. User-defined functions must be thread-safe, and impure
+ *   functions see the rows in no particular order.
+ *
+ * params:
+ *    pool    The thread pool, or NULL to evaluate in the calling thread
+ *    prog    The program
+ *
+ * returns:
+ *          0 on success, or -1 and errno is ENOMEM
+ */
+extern int xpr_eval_parallel(struct xpr_pool *pool, const struct xpr_prog *prog, const double *const *cols, size_t n, double *const *out);
+
+/*
+ * data structure for a set of rules, i.e., expressions for the same record
+ *
+ * The constants of each rule become parameters, and rules that only differ in
+ *   their parameters form a group. A group evaluates all of its rules in one
+ *   batch, with a row per rule. For instance, the rules "x * 2 + y > 10" and
+ *   "x * 3 + y > 5" form one group.
+ */
+struct xpr_rules;
+
+/*
+ * compile a set of rules
+ *
+ * Each rule is compiled like an expression of xpr_compile_ext(), so constant
+ *   parts are computed before grouping.
+ *
+ * params:
+ *    exprs   The rules
+ *    n       The number of rules, at least 1
+ *    vars    The list of variables, like for xpr_compile()
+ *    funs    The list of functions, like for xpr_ext()
+ *
+ * returns:
+ *          The rules, which must be released with xpr_rules_free(), or NULL
+ *          like xpr_compile().
+ */
+extern struct xpr_rules *xpr_rules_compile(const char *const *exprs, size_t n, const struct xpr_var *vars, const struct xpr_fun *funs);
+
+/*
+ * get the number of groups of a set of rules
+ */
+extern size_t xpr_rules_groups(const struct xpr_rules *rules);
+
+/*
+ * evaluate all rules for a record
+ *
+ * Like a workspace, a set of rules must not be evaluated concurrently.
+ *
+ * params:
+ *    values  The value of each variable slot
+ *    out     For each rule, the result
+ *
+ * returns:
+ *          0, the evaluation does not allocate memory
+ */
+extern int xpr_rules_eval(struct xpr_rules *rules, const double *values, double *out);
+
+/*
+ * release a set of rules
+ */
+extern void xpr_rules_free(struct xpr_rules *rules);
+
+/*
+ * evaluate a program for many rows, in single precision
+ *
+ * Like xpr_eval_batch(), but all values and intermediate results are float.
+ *   Constant parts of the program are still computed in double precision at
+ *   compile time. User-defined functions receive double arguments, and their
+ *   batch variants do not apply.
+ */
+extern int xpr_eval_batchf(struct xpr_ws *ws, const float *const *cols, size_t n, float *const *out);
+
+/*
+ * evaluate a program exactly, with int64 variable values
+ *
+ * Programs that only consist of integral constants, the arithmetic operators,
+ *   and the functions floor, ceil, round, min, max, and sum are evaluated with
+ *   overflow-checked int64 arithmetic, so the results are exact even beyond
+ *   2^53. A division must not have a remainder, unless floor, ceil, or round
+ *   directly apply to the quotient, e.g., floor(x/60). In all other cases, the
+ *   function falls back to double precision, like xpr_eval_set().
+ *
+ * params:
+ *    ws      The workspace of the program
+ *    values  The value of each variable slot
+ *    out     An array that receives the exact result of each expression
+ *
+ * returns:
+ *          0 if out holds the exact results, or 1 if the evaluation fell back to
+ *          double precision and xpr_results() returns the results. On error,
+ *          the function returns -1.
+ */
+extern int xpr_eval_int(struct xpr_ws *ws, const int64_t *values, int64_t *out);
+
+/*
+ * evaluate a program exactly for many rows, with int64 variable values
+ *
+ * Like xpr_eval_batch(), but for the programs of xpr_eval_int(). If the result
+ *   of any row is inexact, the function evaluates all rows in double
+ *   precision, and writes the results to fallback instead of out.
+ *
+ * params:
+ *    fallback The result arrays for the evaluation in double precision, like
+ *             the out parameter of xpr_eval_batch(), or NULL to skip the
+ *             evaluation.
+ *
+ * returns:
+ *          0 if out holds the exact results, or 1 if the function fell back to
+ *          double precision. On error, the function returns -1.
+ */
+extern int xpr_eval_batch_int(struct xpr_ws *ws, const int64_t *const *cols, size_t n, int64_t *const *out, double *const *fallback);
+
+/*
+ * evaluate a program and its gradient
+ *
+ * The evaluation propagates the partial derivatives with respect to the given
+ *   variable slots through all operators and functions, so a single pass
+ *   computes the results and their gradients. Comparisons, logical operators,
+ *   floor, ceil, and round have zero derivatives, and derivatives of
+ *   user-defined functions are central differences. The function does not
+ *   change the intermediate values that xpr_update() and xpr_results() refer
+ *   to.
+ *
+ * params:
+ *    ws      The workspace of the program
+ *    values  The value of each variable slot
+ *    wrt     The variable slots of the partial derivatives
+ *    nwrt    The number of entries in wrt
+ *    out     An array that receives the result of each expression
+ *    grad    An array that receives nwrt partial derivatives per expression,
+ *            i.e., grad[r * nwrt + k] is the derivative of expression r with
+ *            respect to slot wrt[k]. Derivatives of errors are XPR_ERR.
+ *
+ * returns:
+ *          0 on success, or -1 and errno is EINVAL for an invalid slot, or
+ *          ENOMEM
+ */
+extern int xpr_eval_grad(struct xpr_ws *ws, const double *values, const size_t *wrt, size_t nwrt, double *out, double *grad);
+
+/*
+ * evaluate a program and its gradient for many rows
+ *
+ * Like xpr_eval_batch() and xpr_eval_grad() combined. The entry
+ *   grad[r * nwrt + k] is an array that receives the derivative of expression
+ *   r with respect to slot wrt[k] for each row.
+ */
+extern int xpr_eval_batch_grad(struct xpr_ws *ws, const double *const *cols, size_t n, const size_t *wrt, size_t nwrt, double *const *out, double *const *grad);
+
+/*
+ * bound the results of a program for ranges of variable values
+ *
+ * The evaluation uses interval arithmetic with outward rounding, so the
+ *   results of all values within the ranges are guaranteed to lie within the
+ *   computed bounds. The bounds are not always tight, e.g., division by a range
+ *   that contains 0, and user-defined functions, are unbounded. The function
+ *   does not change the intermediate values that xpr_update() and
+ *   xpr_results() refer to.
+ *
+ * params:
+ *    ws      The workspace of the program
+ *    lo      The lower bound of each variable slot
+ *    hi      The upper bound of each variable slot. A variable is an error if
+ *            the bounds are NAN, or if lo > hi.
+ *    outlo   An array that receives the lower bound of each expression
+ *    outhi   An array that receives the upper bound of each expression. If
+ *            all values result in an error, both bounds are XPR_ERR.
+ *
+ * returns:
+ *          0 if no values within the ranges result in an error, or 1 if some
+ *          values may result in an error. The bounds only refer to the
+ *          results without error. On error, the function returns -1.
+ */
+extern int xpr_eval_interval(struct xpr_ws *ws, const double *lo, const double *hi, double *outlo, double *outhi);
+
+#define XPR_COL_PLAIN 0
+#define XPR_COL_DICT  1
+#define XPR_COL_CONST 2
+
+/*
+ * data structure for a column of a batch
+ */
+struct xpr_column {
+	int kind;               // XPR_COL_*
+	const double *values;   // PLAIN: the value of each row, DICT: the
+	                        // dictionary, CONST: the value of all rows
+	const uint32_t *index;  // DICT: the dictionary entry of each row
+	size_t nvalues;         // DICT: the number of dictionary entries
+};
+
+/*
+ * evaluate a program for many rows of dictionary-encoded or constant columns
+ *
+ * Like xpr_eval_batch(), but each column is plain, dictionary-encoded, or
+ *   constant. Subexpressions that only depend on constant columns are computed
+ *   once, and subexpressions that only depend on one dictionary column and
+ *   constants are computed once per dictionary entry, then looked up by the
+ *   index of each row. Impure user-defined functions are still called per row.
+ *   Rows with an index beyond the dictionary are XPR_ERR.
+ *
+ * params:
+ *    ws      The workspace of the program
+ *    cols    For each variable slot, the column. Unused slots can be plain
+ *            columns with the values NULL.
+ *    n       The number of rows
+ *    out     For each expression, an array that receives the result of each
+ *            row
+ *
+ * returns:
+ *          0 on success, or -1 and errno is EINVAL for an invalid kind, or
+ *          ENOMEM
+ */
+extern int xpr_eval_columns(struct xpr_ws *ws, const struct xpr_column *cols, size_t n, double *const *out);
+
+#define XPR_TYPE_DOUBLE 0
+#define XPR_TYPE_FLOAT  1
+#define XPR_TYPE_INT64  2
+#define XPR_TYPE_INT32  3
+
+/*
+ * data structure for a field of an array of records
+ *
+ * The field of record k is at base + offset + k * stride, e.g., the base is an
+ *   array of structs, the offset is offsetof() the field, and the stride is
+ *   sizeof() the struct.
+ */
+struct xpr_field {
+	const void *base;   // the array of records, or NULL for unused slots
+	size_t offset;      // the offset of the field within a record, in bytes
+	size_t stride;      // the distance between records, in bytes
+	int type;           // XPR_TYPE_*
+};
+
+/*
+ * data structure for a field of an array of records that receives results
+ *
+ * Like struct xpr_field, but the records are writable.
+ */
+struct xpr_out_field {
+	void *base;         // the array of records
+	size_t offset;      // the offset of the field within a record, in bytes
+	size_t stride;      // the distance between records, in bytes
+	int type;           // XPR_TYPE_DOUBLE or XPR_TYPE_FLOAT
+};
+
+/*
+ * evaluate a program directly over an array of records
+ *
+ * Like xpr_eval_batch(), but each variable slot refers to a field of the
+ *   records. The evaluation gathers the fields of a block of records at once,
+ *   and never copies the records.
+ *
+ * params:
+ *    ws      The workspace of the program
+ *    fields  For each variable slot, the field of the records
+ *    n       The number of records
+ *    out     For each expression, the field that receives the result
+ *
+ * returns:
+ *          0 on success, or -1 and errno is EINVAL for invalid types, or
+ *          ENOMEM
+ */
+extern int xpr_eval_strided(struct xpr_ws *ws, const struct xpr_field *fields, size_t n, const struct xpr_out_field *out);
+
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+/*
+ * the Arrow C data interface, see https://arrow.apache.org/docs/format/CDataInterface.html
+ */
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+	const char *format;
+	const char *name;
+	const char *metadata;
+	int64_t flags;
+	int64_t n_children;
+	struct ArrowSchema **children;
+	struct ArrowSchema *dictionary;
+	void (*release)(struct ArrowSchema *);
+	void *private_data;
+};
+
+struct ArrowArray {
+	int64_t length;
+	int64_t null_count;
+	int64_t offset;
+	int64_t n_buffers;
+	int64_t n_children;
+	const void **buffers;
+	struct ArrowArray **children;
+	struct ArrowArray *dictionary;
+	void (*release)(struct ArrowArray *);
+	void *private_data;
+};
+
+#endif /* ARROW_C_DATA_INTERFACE */
+
+/*
+ * evaluate a program for Arrow columns
+ *
+ * Like xpr_eval_batch(), but the variables and the results are arrays of the
+ *   Arrow C data interface. The function reads float64 columns in place, and
+ *   converts float32 and int64 columns block by block. A row is null if any
+ *   variable of the program is null in this row, and errors are XPR_ERR, like
+ *   for xpr_eval_batch().
+ *
+ * params:
+ *    ws      The workspace of the program
+ *    schemas For each variable slot, the schema of the column, with the
+ *            format "g" (float64), "f" (float32), or "l" (int64). The entries
+ *            of unused slots can be NULL.
+ *    arrays  For each variable slot, the column. All columns of used slots
+ *            must have the same length.
+ *    out_schemas For each expression, a schema that receives the float64
+ *            schema of the result
+ *    out_arrays  For each expression, an array that receives the result
+ *            column. The caller must release the results with their release
+ *            callbacks.
+ *
+ * returns:
+ *          0 on success, or -1 and errno is EINVAL for unsupported columns, or
+ *          ENOMEM. On error, the function does not export any results.
+ */
+extern int xpr_eval_arrow(struct xpr_ws *ws, const struct ArrowSchema *const *schemas, const struct ArrowArray *const *arrays, struct ArrowSchema *out_schemas, struct ArrowArray *out_arrays);
+
+/*
+ * change a single variable, and evaluate the program again
+ *
+ * This function only recomputes the intermediate values that depend on the
+ *   variable, all other intermediate values remain from previous evaluations.
+ *
+ * params:
+ *    ws      The workspace of the program
+ *    slot    The slot of the variable
+ *    value   The new value of the variable
+ *
+ * returns:
+ *          The result of the program, like xpr_eval(). Use xpr_results() to
+ *          get the results of all expressions.
+ */
+extern double xpr_update(struct xpr_ws *ws, size_t slot, double value);
+
+/*
+ * get the variables that a program depends on
+ *
+ * params:
+ *    prog    The compiled program
+ *    slots   An array with room for one entry per variable slot, which
+ *            receives the used slots in ascending order. This parameter can
+ *            be NULL to only count the used slots.
+ *
+ * returns:
+ *          The number of variable slots that the program depends on.
+ */
+extern size_t xpr_vars_used(const struct xpr_prog *prog, size_t *slots);
+
+/*
+ * data structure for images, which store compiled programs in a binary format
+ *
+ * An image is position-independent and read-only, so processes can map it
+ *   from a file and share its pages. The programs of an image are ready to
+ *   evaluate, without parsing or allocating memory per program. Images cannot
+ *   contain programs with user-defined functions.
+ */
+struct xpr_image;
+
+/*
+ * write programs to an image
+ *
+ * params:
+ *    progs   The programs
+ *    nprogs  The number of programs
+ *    buf     The buffer for the image, which must be aligned to 8 bytes. This
+ *            parameter can be NULL to get the size of the image.
+ *    size    The size of the buffer
+ *
+ * returns:
+ *          The size of the image. The function only writes the image when it
+ *          fits into the buffer. On error, the function returns 0 and sets
+ *          errno to EINVAL, e.g., for programs with user-defined functions.
+ */
+extern size_t xpr_image_write(const struct xpr_prog *const *progs, size_t nprogs, void *buf, size_t size);
+
+/*
+ * use an image in memory, without copying it
+ *
+ * The buffer must remain valid until the image is closed.
+ *
+ * returns:
+ *          The image, which must be released with xpr_image_close(). On error,
+ *          the function returns NULL and sets errno to EINVAL for invalid or
+ *          corrupt images, to ENOTSUP for images of a newer version, which may
+ *          contain unknown operations, or to ENOMEM.
+ */
+extern struct xpr_image *xpr_image_load(const void *buf, size_t size);
+
+/*
+ * map an image file into memory
+ *
+ * returns:
+ *          The image, like xpr_image_load(). On error, errno can also be set
+ *          by open() or mmap().
+ */
+extern struct xpr_image *xpr_image_open(const char *path);
+
+/*
+ * release an image, and unmap its file
+ *
+ * All programs of the image become invalid, and must not be released with
+ *   xpr_prog_free().
+ */
+extern void xpr_image_close(struct xpr_image *img);
+
+/*
+ * get the number of programs of an image
+ */
+extern size_t xpr_image_count(const struct xpr_image *img);
+
+/*
+ * get a program of an image
+ *
+ * returns:
+ *          The i-th program, or NULL if the image has less programs.
+ */
+extern const struct xpr_prog *xpr_image_prog(const struct xpr_image *img, size_t i);
+
+/*
+ * kinds of identifiers, as reported by xpr_list_idents()
+ */
+#define XPR_IDENT_VAR   0
+#define XPR_IDENT_CONST 1
+#define XPR_IDENT_FUN   2
+#define XPR_IDENT_DEF   3
+
+/*
+ * callback for xpr_list_idents()
+ *
+ * The name is not null-terminated, len is its length. The callback returns 0
+ *   to continue, or a positive value to stop.
+ */
+typedef int (*xpr_ident_cb)(void *arg, const char *name, size_t len, int kind);
+
+/*
+ * list all identifiers of an expression, without evaluating it
+ *
+ * All identifiers that are neither built-in constants nor built-in functions
+ *   are variables, unless the program defines them. Note that definitions hide
+ *   variables, and variables hide built-in identifiers with the same name.
+ *
+ * params:
+ *    expr  The expression, as a null-terminated string
+ *    cb    The callback, called once per occurrence of each identifier, in
+ *          order
+ *    arg   The first argument of the callback
+ *
+ * returns:
+ *          0 on success, the return value of the callback if it stops the
+ *          iteration, or -1 if the expression contains invalid tokens, or -1
+ *          and errno is ENOMEM.
+ */
+extern int xpr_list_idents(const char *expr, xpr_ident_cb cb, void *arg);
+
 #ifdef __cplusplus
 } /* extern C */
 #endif /* __cplusplus */
@@ -0,0 +1,779 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+/*
+ * xpr.hpp
+ *
+ * This header provides C++20 wrappers for XPR. The expression template
+ * xpr::expr<"..."> parses a literal expression at compile time, and computes
+ * the same results as the xpr() function, except for decimal numbers outside
+ * the range of parser::number(), which may differ in the last bit. Syntax
+ * errors are compile errors, and the evaluation does not parse or dispatch
+ * anything at runtime. The template supports the arithmetic subset of the
+ * grammar, see detail::parser, and the other operators and functions of xpr()
+ * are compile errors.
+ *
+ *   constexpr xpr::expr<"a*b + sin(c)"> e;
+ *   double x = e(1.0, 2.0, 3.0);                       // in order of appearance
+ *   double y = e(xpr::var<"c"> = 3.0, xpr::var<"a"> = 1.0, xpr::var<"b"> = 2.0);
+ *
+ * All identifiers that are neither built-in constants nor built-in functions
+ * are variables. Errors are XPR_ERR, like for xpr().
+ *
+ * For expressions that are only known at runtime, xpr::program owns a compiled
+ * program, and xpr::workspace owns the evaluation state. Once constructed,
+ * their evaluation functions do not allocate memory.
+ *
+ *   xpr::program p("x*y + sum(1,2,3)", { "x", "y" });
+ *   double r = p.eval(std::array { 2.0, 3.0 });
+ *
+ * C++ cannot have a namespace xpr next to the function xpr(), so this header
+ * declares the C interface in the namespace xpr instead, e.g., xpr::xpr() and
+ * xpr::xpr_compile(). Do not include xpr.h in the same translation unit.
+ */
+#ifndef __XPR_HPP__
+#define __XPR_HPP__
+
+#ifdef __XPR_H__
+#error "xpr.hpp declares the C interface in namespace xpr, include it instead of xpr.h"
+#endif
+
+// the C interface includes these, which must not end up in the namespace
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace xpr {
+#include "xpr.h"
+}
+
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace xpr {
+
+/*
+ * a string literal as template argument
+ */
+template <std::size_t N>
+struct fixed_string {
+	char str[N];
+
+	constexpr fixed_string(const char (&s)[N])
+	{
+		for (std::size_t i = 0; i < N; i++)
+			str[i] = s[i];
+	}
+
+	constexpr std::string_view view() const
+	{
+		return std::string_view(str, N - 1);
+	}
+};
+
+namespace detail {
+
+// the built-in functions, shared with the C implementation
+#define FUN(name) fun_##name
+#define ARGS double
+#define ARG(ap, n) (ap[n])
+#include "fun.h"
+
+#define DIV_OK(l, r)     (0 != (r))
+#define POW_OK(l, r)     (!std::isnan(l) && !std::isnan(r) && ((0 <= (l)) || (std::round(r) == (r))))
+
+enum class op : unsigned char { num, var, neg, add, sub, mul, div, pow, fun };
+
+enum class fn : unsigned char {
+	identity, acos, acosh, asin, asinh, atan, atanh, cbrt, ceil, cos, cosh, exp,
+	floor, log, max, min, round, scale, sin, sinh, sqrt, sum, tan, tanh
+};
+
+struct fun_info {
+	std::string_view name;
+	fn id;
+};
+
+inline constexpr fun_info funs[] = {
+	{ "acos", fn::acos },   { "acosh", fn::acosh }, { "asin", fn::asin },
+	{ "asinh", fn::asinh }, { "atan", fn::atan },   { "atanh", fn::atanh },
+	{ "cbrt", fn::cbrt },   { "ceil", fn::ceil },   { "cos", fn::cos },
+	{ "cosh", fn::cosh },   { "exp", fn::exp },     { "floor", fn::floor },
+	{ "log", fn::log },     { "max", fn::max },     { "min", fn::min },
+	{ "round", fn::round }, { "scale", fn::scale }, { "sin", fn::sin },
+	{ "sinh", fn::sinh },   { "sqrt", fn::sqrt },   { "sum", fn::sum },
+	{ "tan", fn::tan },     { "tanh", fn::tanh },
+};
+
+// functions of xpr() outside the subset of the parser, which rejects them
+inline constexpr std::string_view unsupported_funs[] = {
+	"lag", "poly", "select", "wavg", "wmax", "wmin", "wsum",
+};
+
+// argument counts that are no errors
+constexpr bool arity_ok(fn f, std::size_t n)
+{
+	switch (f) {
+	case fn::log:   return (1 == n) || (2 == n);
+	case fn::scale: return (3 == n) || (5 == n);
+	case fn::max:
+	case fn::min:   return 0 != n;
+	case fn::sum:   return true;
+	default:        return 1 == n;
+	}
+}
+
+/*
+ * the syntax tree of an expression with at most N characters
+ *
+ * Each node only refers to nodes with a lower index, and the last node is the
+ * root. Variables are numbered in order of their first appearance.
+ */
+struct node {
+	op kind = op::num;
+	fn f = fn::identity;
+	double value = 0;
+	std::size_t a = 0;   // operators: the operands, variables: the number
+	std::size_t b = 0;   // functions: a is the first entry in args, b is the count
+};
+
+template <std::size_t N>
+struct ast {
+	node nodes[N] = {};
+	std::size_t args[N] = {};
+	std::size_t var_pos[N] = {};
+	std::size_t var_len[N] = {};
+	std::size_t nnodes = 0;
+	std::size_t nargs = 0;
+	std::size_t nvars = 0;
+};
+
+/*
+ * syntax errors call these functions, which are not constexpr, so that the
+ * compiler reports their name
+ */
+inline void error_unexpected_character() {}
+inline void error_invalid_number() {}
+inline void error_missing_operand() {}
+inline void error_missing_close_brace() {}
+inline void error_trailing_input() {}
+inline void error_function_without_arguments() {}
+inline void error_wrong_argument_count() {}
+inline void error_unsupported_operator() {}
+inline void error_unsupported_function() {}
+inline void error_unsupported_definition() {}
+
+constexpr bool is_space(char c) { return (' ' == c) || (('\t' <= c) && ('\r' >= c)); }
+constexpr bool is_digit(char c) { return ('0' <= c) && ('9' >= c); }
+constexpr bool is_alpha(char c) { return (('a' <= c) && ('z' >= c)) || (('A' <= c) && ('Z' >= c)); }
+constexpr bool is_alnum(char c) { return is_alpha(c) || is_digit(c); }
+
+constexpr int hex_digit(char c)
+{
+	if (is_digit(c))
+		return c - '0';
+	if (('a' <= c) && ('f' >= c))
+		return c - 'a' + 10;
+	if (('A' <= c) && ('F' >= c))
+		return c - 'A' + 10;
+	return -1;
+}
+
+/*
+ * recursive descent parser for the arithmetic subset of the xpr() grammar:
+ *
+ *  sum     ::= product (('+' | '-') product)*
+ *  product ::= power (('*' | '/') power)*
+ *  power   ::= unary ('^' unary)*           left-associative, like in xpr()
+ *  unary   ::= ('+' | '-') unary | primary
+ *  primary ::= number | constant | variable | name? '(' (sum (',' sum)*)? ')'
+ *
+ * The comparisons, and, or, not, definitions, and the functions in
+ * unsupported_funs are compile errors instead of variables or trailing input.
+ */
+template <std::size_t N>
+struct parser {
+	std::string_view s;
+	std::size_t pos = 0;
+	ast<N> t = {};
+
+	constexpr char peek()
+	{
+		while ((pos < s.size()) && is_space(s[pos]))
+			pos++;
+		return (pos < s.size()) ? s[pos] : '\0';
+	}
+
+	constexpr std::size_t emit(const node &n)
+	{
+		t.nodes[t.nnodes] = n;
+		return t.nnodes++;
+	}
+
+	constexpr std::size_t binary(op kind, std::size_t l, std::size_t r)
+	{
+		return emit(node { kind, fn::identity, 0, l, r });
+	}
+
+	// decimal numbers are correctly rounded, like strtod(), if their digits form an
+	// integer up to 2^53 and the exponent is within 22; otherwise they are rounded
+	// through long double and may differ in the last bit
+	constexpr double number()
+	{
+		std::uint64_t m = 0;
+		int e = 0;
+		bool digits = false;
+		if (('0' == s[pos]) && (pos + 1 < s.size()) && (('x' == s[pos + 1]) || ('X' == s[pos + 1])) && (pos + 2 < s.size()) && ((0 <= hex_digit(s[pos + 2])) || ('.' == s[pos + 2])))
+			return hex_number();
+		for (; (pos < s.size()) && is_digit(s[pos]); pos++, digits = true)
+			(m < 1000000000000000000ULL) ? (void) (m = 10 * m + (s[pos] - '0')) : (void) e++;
+		if ((pos < s.size()) && ('.' == s[pos]))
+			for (pos++; (pos < s.size()) && is_digit(s[pos]); pos++, digits = true)
+				(m < 1000000000000000000ULL) ? (void) (m = 10 * m + (s[pos] - '0'), e--) : (void) 0;
+		if (!digits)
+			error_invalid_number();
+		e += exponent('e', 'E');
+		const bool exact = (m <= (1ULL << 53)) && (-22 <= e) && (22 >= e);
+		long double v = m;
+		long double p = 1;
+		for (int i = 0; i < (e < 0 ? -e : e); i++)
+			p *= 10;
+		if (exact)
+			return (e < 0) ? (double) m / (double) p : (double) m * (double) p;
+		return (double) ((e < 0) ? v / p : v * p);
+	}
+
+	constexpr double hex_number()
+	{
+		std::uint64_t m = 0;
+		int e = 0;
+		for (pos += 2; (pos < s.size()) && (0 <= hex_digit(s[pos])); pos++)
+			(m >> 60) ? (void) (e += 4) : (void) (m = 16 * m + hex_digit(s[pos]));
+		if ((pos < s.size()) && ('.' == s[pos]))
+			for (pos++; (pos < s.size()) && (0 <= hex_digit(s[pos])); pos++)
+				(m >> 60) ? (void) 0 : (void) (m = 16 * m + hex_digit(s[pos]), e -= 4);
+		e += exponent('p', 'P');
+		double v = m;
+		for (; e > 0; e--)
+			v *= 2;
+		for (; e < 0; e++)
+			v /= 2;
+		return v;
+	}
+
+	// an optional exponent, like strtod(), which ignores incomplete exponents
+	constexpr int exponent(char lower, char upper)
+	{
+		if ((pos >= s.size()) || ((lower != s[pos]) && (upper != s[pos])))
+			return 0;
+		std::size_t p = pos + 1;
+		bool neg = false;
+		if ((p < s.size()) && (('+' == s[p]) || ('-' == s[p])))
+			neg = ('-' == s[p++]);
+		if ((p >= s.size()) || !is_digit(s[p]))
+			return 0;
+		int e = 0;
+		for (; (p < s.size()) && is_digit(s[p]); p++)
+			e = (e < 100000) ? 10 * e + (s[p] - '0') : e;
+		pos = p;
+		return neg ? -e : e;
+	}
+
+	// an operator or definition of xpr() where the subset expects ')' or the end
+	constexpr void unsupported()
+	{
+		const char c = peek();
+		std::size_t end = pos;
+		while ((end < s.size()) && is_alnum(s[end]))
+			end++;
+		const std::string_view word = s.substr(pos, end - pos);
+		if ((';' == c) || (('=' == c) && ((pos + 1 >= s.size()) || ('=' != s[pos + 1]))))
+			error_unsupported_definition();
+		else if (('<' == c) || ('>' == c) || ('=' == c) || ('!' == c) || ("and" == word) || ("or" == word))
+			error_unsupported_operator();
+	}
+
+	constexpr std::size_t call(fn f)
+	{
+		std::size_t argv[N] = {};
+		std::size_t n = 0;
+		pos++;
+		if (')' != peek()) {
+			argv[n++] = sum();
+			while (',' == peek()) {
+				pos++;
+				argv[n++] = sum();
+			}
+		}
+		unsupported();
+		if (')' != peek())
+			error_missing_close_brace();
+		pos++;
+		if (!arity_ok(f, n))
+			error_wrong_argument_count();
+		// braces around a single value do not need a node
+		if (fn::identity == f)
+			return argv[0];
+		const std::size_t first = t.nargs;
+		for (std::size_t i = 0; i < n; i++)
+			t.args[t.nargs++] = argv[i];
+		return emit(node { op::fun, f, 0, first, n });
+	}
+
+	constexpr std::size_t ident()
+	{
+		const std::size_t start = pos;
+		while ((pos < s.size()) && is_alnum(s[pos]))
+			pos++;
+		const std::string_view name = s.substr(start, pos - start);
+		if ("e" == name)
+			return emit(node { op::num, fn::identity, M_E, 0, 0 });
+		if ("pi" == name)
+			return emit(node { op::num, fn::identity, M_PI, 0, 0 });
+		if ("phi" == name)
+			return emit(node { op::num, fn::identity, 1.61803398874989484820458683436563811772030917980576, 0, 0 });
+		if (("and" == name) || ("or" == name) || ("not" == name))
+			error_unsupported_operator();
+		for (const std::string_view f : unsupported_funs)
+			if (f == name)
+				error_unsupported_function();
+		for (const fun_info &f : funs) {
+			if (f.name == name) {
+				if ('(' != peek())
+					error_function_without_arguments();
+				return call(f.id);
+			}
+		}
+		std::size_t v = 0;
+		while ((v < t.nvars) && (s.substr(t.var_pos[v], t.var_len[v]) != name))
+			v++;
+		if (v == t.nvars) {
+			t.var_pos[v] = start;
+			t.var_len[v] = pos - start;
+			t.nvars++;
+		}
+		return emit(node { op::var, fn::identity, 0, v, 0 });
+	}
+
+	constexpr std::size_t primary()
+	{
+		const char c = peek();
+		if (is_digit(c) || ('.' == c))
+			return emit(node { op::num, fn::identity, number(), 0, 0 });
+		if (is_alpha(c))
+			return ident();
+		if ('(' == c)
+			return call(fn::identity);
+		if (('\0' == c) || (')' == c) || (',' == c) || ('*' == c) || ('/' == c) || ('^' == c))
+			error_missing_operand();
+		else
+			error_unexpected_character();
+		return 0;
+	}
+
+	constexpr std::size_t unary()
+	{
+		const char c = peek();
+		if ('-' == c) {
+			pos++;
+			return binary(op::neg, unary(), 0);
+		}
+		if ('+' == c) {
+			pos++;
+			return unary();
+		}
+		return primary();
+	}
+
+	constexpr std::size_t power()
+	{
+		std::size_t l = unary();
+		while ('^' == peek()) {
+			pos++;
+			l = binary(op::pow, l, unary());
+		}
+		return l;
+	}
+
+	constexpr std::size_t product()
+	{
+		std::size_t l = power();
+		for (char c = peek(); ('*' == c) || ('/' == c); c = peek()) {
+			pos++;
+			l = binary(('*' == c) ? op::mul : op::div, l, power());
+		}
+		return l;
+	}
+
+	constexpr std::size_t sum()
+	{
+		std::size_t l = product();
+		for (char c = peek(); ('+' == c) || ('-' == c); c = peek()) {
+			pos++;
+			l = binary(('+' == c) ? op::add : op::sub, l, product());
+		}
+		return l;
+	}
+
+	constexpr ast<N> parse()
+	{
+		const std::size_t root = sum();
+		unsupported();
+		if ('\0' != peek())
+			error_trailing_input();
+		// move the root to the end
+		if (root + 1 != t.nnodes)
+			emit(node { op::fun, fn::identity, 0, t.nargs, 1 }), t.args[t.nargs++] = root;
+		return t;
+	}
+};
+
+template <fixed_string S>
+consteval auto parse()
+{
+	constexpr std::size_t n = S.view().size() + 1;
+	parser<n> p { S.view() };
+	return p.parse();
+}
+
+template <fn F>
+inline double call(std::size_t n, const double *ap)
+{
+#	define CASE(name) if constexpr (fn::name == F) return fun_##name(n, ap);
+	CASE(identity) CASE(acos) CASE(acosh) CASE(asin) CASE(asinh) CASE(atan)
+	CASE(atanh) CASE(cbrt) CASE(ceil) CASE(cos) CASE(cosh) CASE(exp) CASE(floor)
+	CASE(log) CASE(max) CASE(min) CASE(round) CASE(scale) CASE(sin) CASE(sinh)
+	CASE(sqrt) CASE(sum) CASE(tan) CASE(tanh)
+#	undef CASE
+}
+
+} // namespace detail
+
+/*
+ * a named variable value, see xpr::var
+ */
+template <fixed_string Name>
+struct bound {
+	double value;
+};
+
+template <fixed_string Name>
+struct variable {
+	constexpr bound<Name> operator=(double value) const
+	{
+		return bound<Name> { value };
+	}
+};
+
+/*
+ * name a variable value: xpr::var<"x"> = 1.0
+ */
+template <fixed_string Name>
+inline constexpr variable<Name> var {};
+
+/*
+ * an expression, parsed at compile time
+ */
+template <fixed_string S>
+class expr {
+	static constexpr auto tree = detail::parse<S>();
+
+	template <std::size_t I>
+	static inline double eval(const double *v)
+	{
+		constexpr detail::node n = tree.nodes[I];
+		using detail::op;
+		if constexpr (op::num == n.kind) {
+			return n.value;
+		} else if constexpr (op::var == n.kind) {
+			return v[n.a];
+		} else if constexpr (op::neg == n.kind) {
+			return -eval<n.a>(v);
+		} else if constexpr (op::add == n.kind) {
+			return eval<n.a>(v) + eval<n.b>(v);
+		} else if constexpr (op::sub == n.kind) {
+			return eval<n.a>(v) - eval<n.b>(v);
+		} else if constexpr (op::mul == n.kind) {
+			return eval<n.a>(v) * eval<n.b>(v);
+		} else if constexpr (op::div == n.kind) {
+			const double l = eval<n.a>(v);
+			const double r = eval<n.b>(v);
+			return DIV_OK(l, r) ? l / r : XPR_ERR;
+		} else if constexpr (op::pow == n.kind) {
+			const double l = eval<n.a>(v);
+			const double r = eval<n.b>(v);
+			return POW_OK(l, r) ? std::pow(l, r) : XPR_ERR;
+		} else {
+			return fun<I>(v, std::make_index_sequence<n.b>());
+		}
+	}
+
+	template <std::size_t I, std::size_t... K>
+	static inline double fun(const double *v, std::index_sequence<K...>)
+	{
+		constexpr detail::node n = tree.nodes[I];
+		const double args[] = { eval<tree.args[n.a + K]>(v)..., 0 };
+		(void) v;
+		return detail::call<n.f>(n.b, args);
+	}
+
+	template <fixed_string Name>
+	static constexpr std::size_t index()
+	{
+		for (std::size_t i = 0; i < nvars; i++)
+			if (names[i] == Name.view())
+				return i;
+		return nvars;
+	}
+
+	template <fixed_string... Names>
+	static constexpr bool distinct()
+	{
+		const std::string_view n[] = { Names.view()..., "" };
+		for (std::size_t i = 0; i < sizeof...(Names); i++)
+			for (std::size_t j = 0; j < i; j++)
+				if (n[i] == n[j])
+					return false;
+		return true;
+	}
+
+public:
+	// the number of variables
+	static constexpr std::size_t nvars = tree.nvars;
+
+	// the names of all variables, in order of their first appearance
+	static constexpr auto names = []<std::size_t... I>(std::index_sequence<I...>) {
+		return std::array<std::string_view, nvars> { S.view().substr(tree.var_pos[I], tree.var_len[I])... };
+	}(std::make_index_sequence<nvars>());
+
+	/*
+	 * evaluate the expression, with the variable values in the order of names
+	 */
+	static double eval(const std::array<double, nvars> &values)
+	{
+		const double r = eval<tree.nnodes - 1>(values.data());
+		return std::isnan(r) ? XPR_ERR : r;
+	}
+
+	template <typename... T>
+	requires (sizeof...(T) == nvars) && (std::is_convertible_v<T, double> && ...)
+	double operator()(T... values) const
+	{
+		return eval(std::array<double, nvars> { static_cast<double>(values)... });
+	}
+
+	/*
+	 * evaluate the expression, with named variable values in any order
+	 */
+	template <fixed_string... Names>
+	requires (0 < sizeof...(Names))
+	double operator()(bound<Names>... values) const
+	{
+		static_assert(((index<Names>() < nvars) && ...), "unknown variable");
+		static_assert(distinct<Names...>(), "duplicate variable");
+		static_assert(sizeof...(Names) == nvars, "missing variable");
+		std::array<double, nvars> v {};
+		((v[index<Names>()] = values.value), ...);
+		return eval(v);
+	}
+};
+
+class program;
+
+/*
+ * the evaluation state of a compiled program
+ *
+ * A workspace refers to its program, which must outlive it. Concurrent
+ * evaluations of the same program need separate workspaces.
+ */
+class workspace {
+	struct deleter {
+		void operator()(xpr_ws *ws) const { xpr_ws_free(ws); }
+	};
+
+	std::unique_ptr<xpr_ws, deleter> ws;
+	std::unique_ptr<double *[]> outs;   // the result arrays of eval_batch()
+	std::size_t nexprs = 0;
+	std::size_t nvars = 0;
+
+	workspace(const xpr_prog *prog, std::size_t nexprs, std::size_t nvars)
+		: ws(xpr_ws_new(prog)), outs(new double *[nexprs]), nexprs(nexprs), nvars(nvars)
+	{
+		// the batch evaluation allocates its buffer on first use
+		if (!ws || (0 != xpr_eval_batch(ws.get(), nullptr, 0, nullptr)))
+			throw std::bad_alloc();
+	}
+
+	friend class program;
+
+public:
+	explicit workspace(const program &prog);
+
+	/*
+	 * evaluate the program, and get the result of the first expression
+	 */
+	double eval(std::span<const double> values)
+	{
+		if (values.size() < nvars)
+			throw std::invalid_argument("xpr: not enough variable values");
+		return xpr_eval(ws.get(), values.data());
+	}
+
+	/*
+	 * evaluate the program, and get the result of each expression
+	 */
+	void eval(std::span<const double> values, std::span<double> out)
+	{
+		if ((values.size() < nvars) || (out.size() < nexprs))
+			throw std::invalid_argument("xpr: not enough variable values or results");
+		xpr_eval_set(ws.get(), values.data(), out.data());
+	}
+
+	/*
+	 * evaluate the program for many rows
+	 *
+	 * Each column contains the values of one variable slot. The results of
+	 * each expression form a contiguous block in out, so the number of rows is
+	 * out.size() divided by the number of expressions.
+	 */
+	void eval_batch(std::span<const double *const> columns, std::span<double> out)
+	{
+		if (columns.size() < nvars)
+			throw std::invalid_argument("xpr: not enough columns");
+		const std::size_t n = out.size() / nexprs;
+		for (std::size_t r = 0; r < nexprs; r++)
+			outs[r] = out.data() + r * n;
+		xpr_eval_batch(ws.get(), columns.data(), n, outs.get());
+	}
+
+	/*
+	 * change a single variable, and evaluate the program again
+	 */
+	double update(std::size_t slot, double value)
+	{
+		return xpr_update(ws.get(), slot, value);
+	}
+};
+
+/*
+ * a compiled program, which is move-only
+ *
+ * The program has an internal workspace for its own evaluation functions.
+ */
+class program {
+	struct deleter {
+		void operator()(xpr_prog *prog) const { xpr_prog_free(prog); }
+	};
+
+	std::unique_ptr<xpr_prog, deleter> prog;
+	std::size_t nexprs_ = 0;
+	std::size_t nvars_ = 0;
+	workspace ws;
+
+	static std::vector<xpr_var> var_list(std::span<const char *const> names)
+	{
+		std::vector<xpr_var> vars;
+		for (const char *name : names)
+			vars.push_back(xpr_var { name, 0 });
+		vars.push_back(xpr_var { nullptr, 0 });
+		return vars;
+	}
+
+	static xpr_prog *compile(std::span<const char *const> exprs, std::span<const char *const> names, const xpr_fun *funs)
+	{
+		xpr_prog *prog = xpr_compile_ext(exprs.data(), exprs.size(), var_list(names).data(), funs);
+		if (!prog)
+			throw std::system_error(errno, std::generic_category(), "xpr_compile");
+		return prog;
+	}
+
+public:
+	/*
+	 * compile a set of expressions, where the index of each variable name is
+	 * its slot, see xpr_compile_ext()
+	 */
+	program(std::span<const char *const> exprs, std::span<const char *const> names, const xpr_fun *funs = nullptr)
+		: prog(compile(exprs, names, funs)), nexprs_(exprs.size()), nvars_(names.size()), ws(prog.get(), nexprs_, nvars_)
+	{
+	}
+
+	program(const char *expr, std::initializer_list<const char *> names = {}, const xpr_fun *funs = nullptr)
+		: program(std::span<const char *const>(&expr, 1), std::span<const char *const>(names.begin(), names.size()), funs)
+	{
+	}
+
+	program(program &&) noexcept = default;
+
+	// the workspace refers to the program, so it must be released first
+	program &operator=(program &&other) noexcept
+	{
+		if (this != &other) {
+			ws = std::move(other.ws);
+			prog = std::move(other.prog);
+			nexprs_ = other.nexprs_;
+			nvars_ = other.nvars_;
+		}
+		return *this;
+	}
+
+	program(const program &) = delete;
+	program &operator=(const program &) = delete;
+
+	std::size_t nexprs() const { return nexprs_; }
+	std::size_t nvars() const { return nvars_; }
+	const xpr_prog *get() const { return prog.get(); }
+
+	// evaluation with the internal workspace, see xpr::workspace
+	double eval(std::span<const double> values) { return ws.eval(values); }
+	void eval(std::span<const double> values, std::span<double> out) { ws.eval(values, out); }
+	void eval_batch(std::span<const double *const> columns, std::span<double> out) { ws.eval_batch(columns, out); }
+	double update(std::size_t slot, double value) { return ws.update(slot, value); }
+};
+
+inline workspace::workspace(const program &prog)
+	: workspace(prog.get(), prog.nexprs(), prog.nvars())
+{
+}
+
+} // namespace xpr
+
+#undef DIV_OK
+#undef POW_OK
+
+#endif /* __XPR_HPP__ */
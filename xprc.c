@@ -0,0 +1,353 @@
+/*****
+ * Copyright (c) 2015-2016, Stefan Reif
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *****/
+
+/*
+ * xprc.c
+ *
+ * This tool compiles expressions ahead of time into C code. It reads one
+ * expression per line, in the syntax of test.in, and writes a C file with one
+ * function per expression and a table of all functions. The generated code
+ * uses the functions of fun.h, so it computes the same results as xpr().
+ *
+ * Each line can define variables, like "x:1;y:2;x*y". The variables are the
+ * slots of the values array of the generated function. A line can end with
+ * the expected result, like "x:1;y:2;x*y=2", and lines starting with '!' are
+ * expected to fail. Lines starting with '?' are skipped. With the option -t,
+ * the generated file contains a main() function, which checks the expected
+ * results.
+ *
+ * Usage:
+ * ./xprc [-t] [-p prefix] <rules.txt >rules.c
+ */
+#ifdef MAIN
+
+#undef MAIN
+#include "xpr.c"
+
+#include <stdio.h>
+#include <unistd.h>
+
+static const char *const funnames[] = {
+	[FUNID(TK_FUN_NONE)]  = "identity",
+	[FUNID(TK_FUN_ACOS)]  = "acos",
+	[FUNID(TK_FUN_ACOSH)] = "acosh",
+	[FUNID(TK_FUN_ASIN)]  = "asin",
+	[FUNID(TK_FUN_ASINH)] = "asinh",
+	[FUNID(TK_FUN_ATAN)]  = "atan",
+	[FUNID(TK_FUN_ATANH)] = "atanh",
+	[FUNID(TK_FUN_CBRT)]  = "cbrt",
+	[FUNID(TK_FUN_CEIL)]  = "ceil",
+	[FUNID(TK_FUN_COS)]   = "cos",
+	[FUNID(TK_FUN_COSH)]  = "cosh",
+	[FUNID(TK_FUN_EXP)]   = "exp",
+	[FUNID(TK_FUN_FLOOR)] = "floor",
+	[FUNID(TK_FUN_LOG)]   = "log",
+	[FUNID(TK_FUN_MAX)]   = "max",
+	[FUNID(TK_FUN_MIN)]   = "min",
+	[FUNID(TK_FUN_ROUND)] = "round",
+	[FUNID(TK_FUN_SCALE)] = "scale",
+	[FUNID(TK_FUN_SIN)]   = "sin",
+	[FUNID(TK_FUN_SINH)]  = "sinh",
+	[FUNID(TK_FUN_SQRT)]  = "sqrt",
+	[FUNID(TK_FUN_SUM)]   = "sum",
+	[FUNID(TK_FUN_TAN)]   = "tan",
+	[FUNID(TK_FUN_TANH)]  = "tanh",
+	[FUNID(TK_FUN_SELECT)] = "select",
+	[FUNID(TK_FUN_WSUM)]  = "wsum",
+	[FUNID(TK_FUN_WMIN)]  = "wmin",
+	[FUNID(TK_FUN_WMAX)]  = "wmax",
+	[FUNID(TK_FUN_WAVG)]  = "wavg",
+	[FUNID(TK_FUN_LAG)]   = "lag",
+	[FUNID(TK_FUN_POLY)]  = "poly",
+};
+
+struct rule {
+	char *expr;
+	unsigned long long lineno;
+	double *values;
+	size_t nvars;
+	bool check;      // whether the line has an expected result
+	bool exact;
+	double expect;
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(EXIT_FAILURE);
+}
+
+// print a double, such that the compiler reads the same value, where folding
+// never produces limit errors, and the sign of other NaNs is arbitrary
+static void print_double(double d)
+{
+	if (isnan(d))
+		printf("XPR_ERR");
+	else if (isinf(d))
+		printf("%sHUGE_VAL", signbit(d) ? "-" : "");
+	else
+		printf("%a", d);
+}
+
+static void print_string(const char *str)
+{
+	putchar('"');
+	for (; *str; str++) {
+		if (('"' == *str) || ('\\' == *str))
+			putchar('\\');
+		putchar(*str);
+	}
+	putchar('"');
+}
+
+static void print_rule(const struct rule *r, size_t i, const struct xpr_prog *prog)
+{
+	const struct node *nodes = prog_nodes(prog);
+	const uint32_t *args = prog_args(prog);
+	printf("\n// %s\nstatic double rule_%zu(const double *v)\n{\n", r->expr, i);
+	bool usesvars = false;
+	for (uint32_t k = 0; k < prog->nnodes; k++)
+		usesvars |= (OP_VAR == nodes[k].op);
+	if (!usesvars)
+		printf("\t(void) v;\n");
+	for (uint32_t k = 0; k < prog->nnodes; k++) {
+		const struct node *n = &nodes[k];
+		const unsigned l = n->data.arg[0], r = n->data.arg[1];
+		printf("\tconst double n%u = ", (unsigned) k);
+		switch (n->op) {
+		case OP_CONST: print_double(n->data.value); break;
+		case OP_VAR:   printf("v[%u]", (unsigned) n->data.slot); break;
+		case OP_NEG:   printf("-n%u", l); break;
+		case OP_ADD:   printf("n%u + n%u", l, r); break;
+		case OP_SUB:   printf("n%u - n%u", l, r); break;
+		case OP_MUL:   printf("n%u * n%u", l, r); break;
+		case OP_DIV:   printf("DIV_OK(n%u, n%u) ? n%u / n%u : XPR_ERR", l, r, l, r); break;
+		case OP_POW:   printf("POW_OK(n%u, n%u) ? pow(n%u, n%u) : XPR_ERR", l, r, l, r); break;
+		case OP_LT:    printf("CMP(n%u, n%u, <)", l, r); break;
+		case OP_LE:    printf("CMP(n%u, n%u, <=)", l, r); break;
+		case OP_GT:    printf("CMP(n%u, n%u, >)", l, r); break;
+		case OP_GE:    printf("CMP(n%u, n%u, >=)", l, r); break;
+		case OP_EQ:    printf("CMP(n%u, n%u, ==)", l, r); break;
+		case OP_NE:    printf("CMP(n%u, n%u, !=)", l, r); break;
+		case OP_AND:   printf("LOGIC(n%u, n%u, &)", l, r); break;
+		case OP_OR:    printf("LOGIC(n%u, n%u, |)", l, r); break;
+		case OP_NOT:   printf("NOT(n%u)", l); break;
+		case OP_FUN:
+			printf("xprc_%s(%u, ", funnames[r], (unsigned) n->nargs);
+			if (0 == n->nargs)
+				printf("NULL");
+			else
+				printf("(const double[]) {");
+			for (uint32_t a = 0; a < n->nargs; a++)
+				printf("%s n%u", a ? "," : "", (unsigned) args[l + a]);
+			printf("%s)", n->nargs ? " }" : "");
+			break;
+		default:
+			assert(0 || !!! "invalid node");
+		}
+		printf(";\n");
+	}
+	// like xpr(), errors are XPR_ERR, and not the NaN of the hardware
+	const unsigned root = prog_roots(prog)[0];
+	printf("\treturn isnan(n%u) ? XPR_ERR : n%u;\n}\n", root, root);
+}
+
+// parse a line like tst.c, and compile its expression
+static struct xpr_prog *parse_rule(char *line, unsigned long long lineno, struct rule *r)
+{
+	struct xpr_var *vars = NULL;
+	size_t nvars = 0;
+	char *tail = line;
+	char *semi;
+	while ((semi = strchr(tail, ';')) && memchr(tail, ':', semi - tail)) {
+		char *vardef = strtok(tail, ";");
+		tail += strlen(vardef) + 1;
+		char *name = strtok(vardef, ":");
+		char *vstr = strtok(NULL, ":");
+		nvars++;
+		if (!(vars = realloc(vars, (nvars + 1) * sizeof(*vars))))
+			die("realloc");
+		vars[nvars-1].name = name;
+		vars[nvars-1].value = vstr ? strtod(vstr, NULL) : 0;
+		vars[nvars].name = NULL;
+	}
+
+	r->lineno = lineno;
+	r->nvars = nvars;
+	r->check = false;
+	r->exact = true;
+	r->expr = tail;
+	if ('!' == *tail) {
+		r->expr = tail + 1;
+		r->check = true;
+		r->expect = XPR_ERR;
+	} else if (strchr(tail, '~') || strchr(tail, '=')) {
+		// the expected result follows the last separator, if it is a number
+		char sep = strchr(tail, '~') ? '~' : '=';
+		char *expect = strrchr(tail, sep);
+		char *end;
+		double d = strtod(expect + 1, &end);
+		// comparison operators end with '=' as well
+		if ((expect != tail) && !strchr("=<>!", expect[-1]) && (end != expect + 1) && !*end) {
+			*expect = '\0';
+			r->check = true;
+			r->exact = ('=' == sep);
+			r->expect = d;
+		}
+	}
+
+	struct xpr_prog *prog = xpr_compile(r->expr, vars);
+	r->values = NULL;
+	if (prog && nvars) {
+		if (!(r->values = malloc(nvars * sizeof(double))))
+			die("malloc");
+		for (size_t i = 0; i < nvars; i++)
+			r->values[i] = vars[i].value;
+	}
+	if (prog && !(r->expr = strdup(r->expr)))
+		die("strdup");
+	free(vars);
+	return prog;
+}
+
+static void print_head(void)
+{
+	printf("// generated by xprc, do not edit\n\n");
+	printf("#include <math.h>\n#include <stddef.h>\n#include \"xpr.h\"\n\n");
+	printf("#define FUN(name) xprc_##name\n#define ARGS double\n#define ARG(ap, n) (ap[n])\n#include \"fun.h\"\n\n");
+	printf("#define DIV_OK(l, r) (0 != (r))\n");
+	printf("#define POW_OK(l, r) (!isnan(l) && !isnan(r) && ((0 <= (l)) || (round(r) == (r))))\n");
+	printf("#define CMP(l, r, op) ((isnan(l) | isnan(r)) ? XPR_ERR : ((l) op (r)))\n");
+	printf("#define LOGIC(l, r, op) ((isnan(l) | isnan(r)) ? XPR_ERR : (((l) != 0) op ((r) != 0)))\n");
+	printf("#define NOT(x) (isnan(x) ? XPR_ERR : ((x) == 0))\n");
+}
+
+static void print_table(const char *prefix, const struct rule *rules, size_t nrules)
+{
+	printf("\nstruct %s_rule {\n\tconst char *expr;\n\tdouble (*fun)(const double *v);\n};\n\n", prefix);
+	printf("const size_t %s_nrules = %zu;\n\n", prefix, nrules);
+	printf("const struct %s_rule %s_rules[] = {\n", prefix, prefix);
+	for (size_t i = 0; i < nrules; i++) {
+		printf("\t{ ");
+		print_string(rules[i].expr);
+		printf(", rule_%zu },\n", i);
+	}
+	if (0 == nrules)
+		printf("\t{ NULL, NULL },\n");
+	printf("};\n");
+}
+
+// the generated test calls each function through a volatile pointer, so the
+// compiler cannot fold the library functions at compile time
+static void print_test(const char *prefix, const struct rule *rules, size_t nrules)
+{
+	printf("\n#include <stdbool.h>\n#include <stdio.h>\n#include <stdlib.h>\n\n");
+	printf("#define EPS (1.0/(1<<20))\n\n");
+	printf("static bool check(unsigned long long lineno, size_t i, const double *v, double expect, bool exact)\n{\n");
+	printf("\tdouble (*volatile fun)(const double *) = %s_rules[i].fun;\n", prefix);
+	printf("\tdouble is = fun(v);\n");
+	printf("\tif ((is == expect) || (isnan(is) && isnan(expect) && (XPR_IS_LIMIT(is) == XPR_IS_LIMIT(expect))))\n\t\treturn true;\n");
+	printf("\tif (!exact && !isnan(is) && (fabs(is - expect) <= ((fabs(expect) > EPS) ? fabs(expect) * EPS : EPS)))\n\t\treturn true;\n");
+	printf("\tfprintf(stderr, \"%%llu: %%s=%%lf as C code, expected=%%lf\\n\", lineno, %s_rules[i].expr, is, expect);\n", prefix);
+	printf("\treturn false;\n}\n\n");
+	printf("int main(void)\n{\n\tbool ok = true;\n");
+	for (size_t i = 0; i < nrules; i++) {
+		const struct rule *r = &rules[i];
+		if (!r->check)
+			continue;
+		printf("\tok &= check(%llu, %zu, ", r->lineno, i);
+		if (0 == r->nvars)
+			printf("NULL");
+		else
+			printf("(const double[]) {");
+		for (size_t k = 0; k < r->nvars; k++) {
+			printf("%s ", k ? "," : "");
+			print_double(r->values[k]);
+		}
+		printf("%s, ", r->nvars ? " }" : "");
+		print_double(r->expect);
+		printf(", %s);\n", r->exact ? "true" : "false");
+	}
+	printf("\treturn ok ? EXIT_SUCCESS : EXIT_FAILURE;\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+	bool test = false;
+	const char *prefix = "xprc";
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "tp:"))) {
+		switch (opt) {
+		case 't': test = true; break;
+		case 'p': prefix = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-t] [-p prefix] <exprs >code.c\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	print_head();
+	struct rule *rules = NULL;
+	size_t nrules = 0, cap = 0;
+	char *line = NULL;
+	size_t linesz = 0;
+	unsigned long long lineno = 0;
+	while (getline(&line, &linesz, stdin) >= 0) {
+		lineno++;
+		line[strcspn(line, "\n")] = '\0';
+		if (('#' == line[0]) || ('\0' == line[0]) || ('?' == line[0]))
+			continue;
+		if ((nrules == cap) && !(rules = realloc(rules, (cap = cap ? 2 * cap : 64) * sizeof(*rules))))
+			die("realloc");
+		struct xpr_prog *prog = parse_rule(line, lineno, &rules[nrules]);
+		if (!prog) {
+			// in test mode, skip expressions that need tst.c, e.g., user-defined functions
+			if (test)
+				continue;
+			fprintf(stderr, "%llu: %s: %s\n", lineno, rules[nrules].expr, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		print_rule(&rules[nrules], nrules, prog);
+		xpr_prog_free(prog);
+		nrules++;
+	}
+	if (ferror(stdin))
+		die("getline");
+	free(line);
+
+	print_table(prefix, rules, nrules);
+	if (test)
+		print_test(prefix, rules, nrules);
+	for (size_t i = 0; i < nrules; i++) {
+		free(rules[i].expr);
+		free(rules[i].values);
+	}
+	free(rules);
+	return 0;
+}
+
+#endif /* MAIN */